@@ -0,0 +1,1174 @@
+#ifndef CRYPTOGRAPHY_BLAKE3_HPP
+#define CRYPTOGRAPHY_BLAKE3_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "cpu_features.hpp"
+#include "thread_pool.hpp"
+
+#ifdef CRYPTOGRAPHY_X86
+#include <immintrin.h>
+#endif
+
+typedef unsigned char byte;
+
+namespace Crypto
+{
+    namespace Blake3Detail
+    {
+        constexpr size_t OutLen = 32;
+        constexpr size_t BlockLen = 64;
+        constexpr size_t ChunkLen = 1024;
+        constexpr size_t MaxDepth = 54;
+        constexpr size_t MaxSimdDegree = 16;
+
+        ///< subtrees at least this large are split across the thread pool
+        constexpr size_t ParallelGrain = 128 * ChunkLen;
+
+        constexpr uint8_t ChunkStart = 1 << 0;
+        constexpr uint8_t ChunkEnd = 1 << 1;
+        constexpr uint8_t Parent = 1 << 2;
+        constexpr uint8_t Root = 1 << 3;
+        constexpr uint8_t KeyedHash = 1 << 4;
+        constexpr uint8_t DeriveKeyContext = 1 << 5;
+        constexpr uint8_t DeriveKeyMaterial = 1 << 6;
+
+        constexpr uint32_t IV[8] = {
+            0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+        };
+
+        ///< message word order of each of the 7 rounds
+        constexpr uint8_t MsgSchedule[7][16] = {
+            {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+            {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+            {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+            {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+            {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+            {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+            {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+        };
+
+        inline uint32_t load32(const byte *p)
+        {
+            return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+                   (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+        }
+
+        inline void store32(byte *p, uint32_t w)
+        {
+            p[0] = static_cast<byte>(w);
+            p[1] = static_cast<byte>(w >> 8);
+            p[2] = static_cast<byte>(w >> 16);
+            p[3] = static_cast<byte>(w >> 24);
+        }
+
+        inline uint32_t rotr(uint32_t x, int n)
+        {
+            return (x >> n) | (x << (32 - n));
+        }
+
+        inline size_t roundDownToPowerOf2(uint64_t x)
+        {
+            return static_cast<size_t>(1ULL << (63 - __builtin_clzll(x | 1)));
+        }
+
+        /********************************************************
+         * Portable compression function
+         *********************************************************/
+
+        inline void g(uint32_t *s, size_t a, size_t b, size_t c, size_t d, uint32_t x, uint32_t y)
+        {
+            s[a] = s[a] + s[b] + x;
+            s[d] = rotr(s[d] ^ s[a], 16);
+            s[c] = s[c] + s[d];
+            s[b] = rotr(s[b] ^ s[c], 12);
+            s[a] = s[a] + s[b] + y;
+            s[d] = rotr(s[d] ^ s[a], 8);
+            s[c] = s[c] + s[d];
+            s[b] = rotr(s[b] ^ s[c], 7);
+        }
+
+        inline void round(uint32_t s[16], const uint32_t m[16], size_t r)
+        {
+            const uint8_t *w = MsgSchedule[r];
+
+            g(s, 0, 4, 8, 12, m[w[0]], m[w[1]]);
+            g(s, 1, 5, 9, 13, m[w[2]], m[w[3]]);
+            g(s, 2, 6, 10, 14, m[w[4]], m[w[5]]);
+            g(s, 3, 7, 11, 15, m[w[6]], m[w[7]]);
+            g(s, 0, 5, 10, 15, m[w[8]], m[w[9]]);
+            g(s, 1, 6, 11, 12, m[w[10]], m[w[11]]);
+            g(s, 2, 7, 8, 13, m[w[12]], m[w[13]]);
+            g(s, 3, 4, 9, 14, m[w[14]], m[w[15]]);
+        }
+
+        inline void compressPre(uint32_t s[16], const uint32_t cv[8], const byte block[BlockLen],
+                                uint8_t blockLen, uint64_t counter, uint8_t flags)
+        {
+            uint32_t m[16];
+            for (size_t i = 0; i < 16; ++i)
+                m[i] = load32(block + 4 * i);
+
+            for (size_t i = 0; i < 8; ++i)
+                s[i] = cv[i];
+            s[8] = IV[0];
+            s[9] = IV[1];
+            s[10] = IV[2];
+            s[11] = IV[3];
+            s[12] = static_cast<uint32_t>(counter);
+            s[13] = static_cast<uint32_t>(counter >> 32);
+            s[14] = blockLen;
+            s[15] = flags;
+
+            for (size_t r = 0; r < 7; ++r)
+                round(s, m, r);
+        }
+
+        inline void compressInPlace(uint32_t cv[8], const byte block[BlockLen], uint8_t blockLen,
+                                    uint64_t counter, uint8_t flags)
+        {
+            uint32_t s[16];
+            compressPre(s, cv, block, blockLen, counter, flags);
+            for (size_t i = 0; i < 8; ++i)
+                cv[i] = s[i] ^ s[i + 8];
+        }
+
+        inline void compressXof(const uint32_t cv[8], const byte block[BlockLen], uint8_t blockLen,
+                                uint64_t counter, uint8_t flags, byte out[64])
+        {
+            uint32_t s[16];
+            compressPre(s, cv, block, blockLen, counter, flags);
+            for (size_t i = 0; i < 8; ++i)
+            {
+                store32(out + 4 * i, s[i] ^ s[i + 8]);
+                store32(out + 32 + 4 * i, s[i + 8] ^ cv[i]);
+            }
+        }
+
+        inline void hashOne(const byte *input, size_t blocks, const uint32_t key[8], uint64_t counter,
+                            uint8_t flags, uint8_t flagsStart, uint8_t flagsEnd, byte out[OutLen])
+        {
+            uint32_t cv[8];
+            std::memcpy(cv, key, sizeof(cv));
+
+            uint8_t blockFlags = flags | flagsStart;
+            while (blocks > 0)
+            {
+                if (blocks == 1)
+                    blockFlags |= flagsEnd;
+                compressInPlace(cv, input, BlockLen, counter, blockFlags);
+                input += BlockLen;
+                blocks -= 1;
+                blockFlags = flags;
+            }
+
+            for (size_t i = 0; i < 8; ++i)
+                store32(out + 4 * i, cv[i]);
+        }
+
+#ifdef CRYPTOGRAPHY_X86
+        /********************************************************
+         * Multi-input kernels : each vector lane carries the state
+         * of a different input, all inputs have the same length.
+         *********************************************************/
+
+        inline void laneCounters(uint64_t counter, bool increment, size_t lanes, uint32_t *lo, uint32_t *hi)
+        {
+            for (size_t i = 0; i < lanes; ++i)
+            {
+                uint64_t c = counter + (increment ? i : 0);
+                lo[i] = static_cast<uint32_t>(c);
+                hi[i] = static_cast<uint32_t>(c >> 32);
+            }
+        }
+
+        namespace Sse41
+        {
+            using V = __m128i;
+
+            __attribute__((target("sse4.1"), always_inline)) inline V add(V a, V b) { return _mm_add_epi32(a, b); }
+            __attribute__((target("sse4.1"), always_inline)) inline V xorv(V a, V b) { return _mm_xor_si128(a, b); }
+            __attribute__((target("sse4.1"), always_inline)) inline V set1(uint32_t x) { return _mm_set1_epi32(static_cast<int>(x)); }
+
+            __attribute__((target("sse4.1"), always_inline)) inline V rot16(V x)
+            {
+                return _mm_shuffle_epi8(x, _mm_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+            }
+
+            __attribute__((target("sse4.1"), always_inline)) inline V rot12(V x)
+            {
+                return _mm_or_si128(_mm_srli_epi32(x, 12), _mm_slli_epi32(x, 20));
+            }
+
+            __attribute__((target("sse4.1"), always_inline)) inline V rot8(V x)
+            {
+                return _mm_shuffle_epi8(x, _mm_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1));
+            }
+
+            __attribute__((target("sse4.1"), always_inline)) inline V rot7(V x)
+            {
+                return _mm_or_si128(_mm_srli_epi32(x, 7), _mm_slli_epi32(x, 25));
+            }
+
+            __attribute__((target("sse4.1"), always_inline)) inline void g(V &a, V &b, V &c, V &d, V x, V y)
+            {
+                a = add(add(a, b), x);
+                d = rot16(xorv(d, a));
+                c = add(c, d);
+                b = rot12(xorv(b, c));
+                a = add(add(a, b), y);
+                d = rot8(xorv(d, a));
+                c = add(c, d);
+                b = rot7(xorv(b, c));
+            }
+
+            __attribute__((target("sse4.1"), always_inline)) inline void round(V v[16], const V m[16], size_t r)
+            {
+                const uint8_t *w = MsgSchedule[r];
+
+                g(v[0], v[4], v[8], v[12], m[w[0]], m[w[1]]);
+                g(v[1], v[5], v[9], v[13], m[w[2]], m[w[3]]);
+                g(v[2], v[6], v[10], v[14], m[w[4]], m[w[5]]);
+                g(v[3], v[7], v[11], v[15], m[w[6]], m[w[7]]);
+                g(v[0], v[5], v[10], v[15], m[w[8]], m[w[9]]);
+                g(v[1], v[6], v[11], v[12], m[w[10]], m[w[11]]);
+                g(v[2], v[7], v[8], v[13], m[w[12]], m[w[13]]);
+                g(v[3], v[4], v[9], v[14], m[w[14]], m[w[15]]);
+            }
+
+            __attribute__((target("sse4.1"), always_inline)) inline void transpose(V v[4])
+            {
+                V ab01 = _mm_unpacklo_epi32(v[0], v[1]);
+                V ab23 = _mm_unpackhi_epi32(v[0], v[1]);
+                V cd01 = _mm_unpacklo_epi32(v[2], v[3]);
+                V cd23 = _mm_unpackhi_epi32(v[2], v[3]);
+
+                v[0] = _mm_unpacklo_epi64(ab01, cd01);
+                v[1] = _mm_unpackhi_epi64(ab01, cd01);
+                v[2] = _mm_unpacklo_epi64(ab23, cd23);
+                v[3] = _mm_unpackhi_epi64(ab23, cd23);
+            }
+
+            __attribute__((target("sse4.1"))) inline void hash4(const byte *const *inputs, size_t blocks,
+                                                                const uint32_t key[8], uint64_t counter, bool increment,
+                                                                uint8_t flags, uint8_t flagsStart, uint8_t flagsEnd, byte *out)
+            {
+                V h[8];
+                for (size_t i = 0; i < 8; ++i)
+                    h[i] = set1(key[i]);
+
+                uint32_t lo[4], hi[4];
+                laneCounters(counter, increment, 4, lo, hi);
+                const V counterLo = _mm_loadu_si128(reinterpret_cast<const V *>(lo));
+                const V counterHi = _mm_loadu_si128(reinterpret_cast<const V *>(hi));
+
+                uint8_t blockFlags = flags | flagsStart;
+                for (size_t b = 0; b < blocks; ++b)
+                {
+                    if (b + 1 == blocks)
+                        blockFlags |= flagsEnd;
+
+                    V m[16];
+                    for (size_t q = 0; q < 4; ++q)
+                    {
+                        for (size_t i = 0; i < 4; ++i)
+                            m[4 * q + i] = _mm_loadu_si128(reinterpret_cast<const V *>(inputs[i] + b * BlockLen + 16 * q));
+                        transpose(&m[4 * q]);
+                    }
+
+                    V v[16] = {
+                        h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+                        set1(IV[0]), set1(IV[1]), set1(IV[2]), set1(IV[3]),
+                        counterLo, counterHi, set1(BlockLen), set1(blockFlags)
+                    };
+                    for (size_t r = 0; r < 7; ++r)
+                        round(v, m, r);
+                    for (size_t i = 0; i < 8; ++i)
+                        h[i] = xorv(v[i], v[i + 8]);
+
+                    blockFlags = flags;
+                }
+
+                transpose(&h[0]);
+                transpose(&h[4]);
+                for (size_t i = 0; i < 4; ++i)
+                {
+                    _mm_storeu_si128(reinterpret_cast<V *>(out + i * OutLen), h[i]);
+                    _mm_storeu_si128(reinterpret_cast<V *>(out + i * OutLen + 16), h[i + 4]);
+                }
+            }
+        } // namespace Sse41
+
+        namespace Avx2
+        {
+            using V = __m256i;
+
+            __attribute__((target("avx2"), always_inline)) inline V add(V a, V b) { return _mm256_add_epi32(a, b); }
+            __attribute__((target("avx2"), always_inline)) inline V xorv(V a, V b) { return _mm256_xor_si256(a, b); }
+            __attribute__((target("avx2"), always_inline)) inline V set1(uint32_t x) { return _mm256_set1_epi32(static_cast<int>(x)); }
+
+            __attribute__((target("avx2"), always_inline)) inline V rot16(V x)
+            {
+                return _mm256_shuffle_epi8(x, _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                                                              13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+            }
+
+            __attribute__((target("avx2"), always_inline)) inline V rot12(V x)
+            {
+                return _mm256_or_si256(_mm256_srli_epi32(x, 12), _mm256_slli_epi32(x, 20));
+            }
+
+            __attribute__((target("avx2"), always_inline)) inline V rot8(V x)
+            {
+                return _mm256_shuffle_epi8(x, _mm256_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+                                                              12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1));
+            }
+
+            __attribute__((target("avx2"), always_inline)) inline V rot7(V x)
+            {
+                return _mm256_or_si256(_mm256_srli_epi32(x, 7), _mm256_slli_epi32(x, 25));
+            }
+
+            __attribute__((target("avx2"), always_inline)) inline void g(V &a, V &b, V &c, V &d, V x, V y)
+            {
+                a = add(add(a, b), x);
+                d = rot16(xorv(d, a));
+                c = add(c, d);
+                b = rot12(xorv(b, c));
+                a = add(add(a, b), y);
+                d = rot8(xorv(d, a));
+                c = add(c, d);
+                b = rot7(xorv(b, c));
+            }
+
+            __attribute__((target("avx2"), always_inline)) inline void round(V v[16], const V m[16], size_t r)
+            {
+                const uint8_t *w = MsgSchedule[r];
+
+                g(v[0], v[4], v[8], v[12], m[w[0]], m[w[1]]);
+                g(v[1], v[5], v[9], v[13], m[w[2]], m[w[3]]);
+                g(v[2], v[6], v[10], v[14], m[w[4]], m[w[5]]);
+                g(v[3], v[7], v[11], v[15], m[w[6]], m[w[7]]);
+                g(v[0], v[5], v[10], v[15], m[w[8]], m[w[9]]);
+                g(v[1], v[6], v[11], v[12], m[w[10]], m[w[11]]);
+                g(v[2], v[7], v[8], v[13], m[w[12]], m[w[13]]);
+                g(v[3], v[4], v[9], v[14], m[w[14]], m[w[15]]);
+            }
+
+            ///< 8x8 transpose of 32 bit words, row i becomes column i
+            __attribute__((target("avx2"), always_inline)) inline void transpose(V v[8])
+            {
+                V ab0145 = _mm256_unpacklo_epi32(v[0], v[1]);
+                V ab2367 = _mm256_unpackhi_epi32(v[0], v[1]);
+                V cd0145 = _mm256_unpacklo_epi32(v[2], v[3]);
+                V cd2367 = _mm256_unpackhi_epi32(v[2], v[3]);
+                V ef0145 = _mm256_unpacklo_epi32(v[4], v[5]);
+                V ef2367 = _mm256_unpackhi_epi32(v[4], v[5]);
+                V gh0145 = _mm256_unpacklo_epi32(v[6], v[7]);
+                V gh2367 = _mm256_unpackhi_epi32(v[6], v[7]);
+
+                V abcd04 = _mm256_unpacklo_epi64(ab0145, cd0145);
+                V abcd15 = _mm256_unpackhi_epi64(ab0145, cd0145);
+                V abcd26 = _mm256_unpacklo_epi64(ab2367, cd2367);
+                V abcd37 = _mm256_unpackhi_epi64(ab2367, cd2367);
+                V efgh04 = _mm256_unpacklo_epi64(ef0145, gh0145);
+                V efgh15 = _mm256_unpackhi_epi64(ef0145, gh0145);
+                V efgh26 = _mm256_unpacklo_epi64(ef2367, gh2367);
+                V efgh37 = _mm256_unpackhi_epi64(ef2367, gh2367);
+
+                v[0] = _mm256_permute2x128_si256(abcd04, efgh04, 0x20);
+                v[1] = _mm256_permute2x128_si256(abcd15, efgh15, 0x20);
+                v[2] = _mm256_permute2x128_si256(abcd26, efgh26, 0x20);
+                v[3] = _mm256_permute2x128_si256(abcd37, efgh37, 0x20);
+                v[4] = _mm256_permute2x128_si256(abcd04, efgh04, 0x31);
+                v[5] = _mm256_permute2x128_si256(abcd15, efgh15, 0x31);
+                v[6] = _mm256_permute2x128_si256(abcd26, efgh26, 0x31);
+                v[7] = _mm256_permute2x128_si256(abcd37, efgh37, 0x31);
+            }
+
+            ///< loads block words of 8 inputs, m[j] holds word j of every input
+            __attribute__((target("avx2"), always_inline)) inline void loadMsg(const byte *const *inputs, size_t offset, V m[16])
+            {
+                for (size_t i = 0; i < 8; ++i)
+                {
+                    m[i] = _mm256_loadu_si256(reinterpret_cast<const V *>(inputs[i] + offset));
+                    m[i + 8] = _mm256_loadu_si256(reinterpret_cast<const V *>(inputs[i] + offset + 32));
+                    _mm_prefetch(reinterpret_cast<const char *>(inputs[i] + offset + 256), _MM_HINT_T0);
+                }
+                transpose(&m[0]);
+                transpose(&m[8]);
+            }
+
+            __attribute__((target("avx2"))) inline void hash8(const byte *const *inputs, size_t blocks,
+                                                             const uint32_t key[8], uint64_t counter, bool increment,
+                                                             uint8_t flags, uint8_t flagsStart, uint8_t flagsEnd, byte *out)
+            {
+                V h[8];
+                for (size_t i = 0; i < 8; ++i)
+                    h[i] = set1(key[i]);
+
+                uint32_t lo[8], hi[8];
+                laneCounters(counter, increment, 8, lo, hi);
+                const V counterLo = _mm256_loadu_si256(reinterpret_cast<const V *>(lo));
+                const V counterHi = _mm256_loadu_si256(reinterpret_cast<const V *>(hi));
+
+                uint8_t blockFlags = flags | flagsStart;
+                for (size_t b = 0; b < blocks; ++b)
+                {
+                    if (b + 1 == blocks)
+                        blockFlags |= flagsEnd;
+
+                    V m[16];
+                    loadMsg(inputs, b * BlockLen, m);
+
+                    V v[16] = {
+                        h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+                        set1(IV[0]), set1(IV[1]), set1(IV[2]), set1(IV[3]),
+                        counterLo, counterHi, set1(BlockLen), set1(blockFlags)
+                    };
+                    for (size_t r = 0; r < 7; ++r)
+                        round(v, m, r);
+                    for (size_t i = 0; i < 8; ++i)
+                        h[i] = xorv(v[i], v[i + 8]);
+
+                    blockFlags = flags;
+                }
+
+                transpose(h);
+                for (size_t i = 0; i < 8; ++i)
+                    _mm256_storeu_si256(reinterpret_cast<V *>(out + i * OutLen), h[i]);
+            }
+        } // namespace Avx2
+
+        ///< GCC 12 seeds masked AVX-512 builtins with a self initialized _mm512_undefined_* value
+        ///< and warns on it (GCC bug 105593, fixed in 13)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+        namespace Avx512
+        {
+            using V = __m512i;
+
+            __attribute__((target("avx512f"), always_inline)) inline V add(V a, V b) { return _mm512_add_epi32(a, b); }
+            __attribute__((target("avx512f"), always_inline)) inline V xorv(V a, V b) { return _mm512_xor_si512(a, b); }
+            __attribute__((target("avx512f"), always_inline)) inline V set1(uint32_t x) { return _mm512_set1_epi32(static_cast<int>(x)); }
+
+            __attribute__((target("avx512f"), always_inline)) inline void g(V &a, V &b, V &c, V &d, V x, V y)
+            {
+                a = add(add(a, b), x);
+                d = _mm512_ror_epi32(xorv(d, a), 16);
+                c = add(c, d);
+                b = _mm512_ror_epi32(xorv(b, c), 12);
+                a = add(add(a, b), y);
+                d = _mm512_ror_epi32(xorv(d, a), 8);
+                c = add(c, d);
+                b = _mm512_ror_epi32(xorv(b, c), 7);
+            }
+
+            __attribute__((target("avx512f"), always_inline)) inline void round(V v[16], const V m[16], size_t r)
+            {
+                const uint8_t *w = MsgSchedule[r];
+
+                g(v[0], v[4], v[8], v[12], m[w[0]], m[w[1]]);
+                g(v[1], v[5], v[9], v[13], m[w[2]], m[w[3]]);
+                g(v[2], v[6], v[10], v[14], m[w[4]], m[w[5]]);
+                g(v[3], v[7], v[11], v[15], m[w[6]], m[w[7]]);
+                g(v[0], v[5], v[10], v[15], m[w[8]], m[w[9]]);
+                g(v[1], v[6], v[11], v[12], m[w[10]], m[w[11]]);
+                g(v[2], v[7], v[8], v[13], m[w[12]], m[w[13]]);
+                g(v[3], v[4], v[9], v[14], m[w[14]], m[w[15]]);
+            }
+
+            __attribute__((target("avx512f"))) inline void hash16(const byte *const *inputs, size_t blocks,
+                                                                 const uint32_t key[8], uint64_t counter, bool increment,
+                                                                 uint8_t flags, uint8_t flagsStart, uint8_t flagsEnd, byte *out)
+            {
+                V h[8];
+                for (size_t i = 0; i < 8; ++i)
+                    h[i] = set1(key[i]);
+
+                uint32_t lo[16], hi[16];
+                laneCounters(counter, increment, 16, lo, hi);
+                const V counterLo = _mm512_loadu_si512(lo);
+                const V counterHi = _mm512_loadu_si512(hi);
+
+                uint8_t blockFlags = flags | flagsStart;
+                for (size_t b = 0; b < blocks; ++b)
+                {
+                    if (b + 1 == blocks)
+                        blockFlags |= flagsEnd;
+
+                    ///< transpose each half of the inputs with the 256 bit kernel, then join
+                    __m256i low[16], high[16];
+                    Avx2::loadMsg(inputs, b * BlockLen, low);
+                    Avx2::loadMsg(inputs + 8, b * BlockLen, high);
+
+                    ///< lanes 0-3 of low then lanes 0-3 of high (index bit 3 picks the second source)
+                    const V join = _mm512_setr_epi64(0, 1, 2, 3, 8, 9, 10, 11);
+                    V m[16];
+                    for (size_t j = 0; j < 16; ++j)
+                        m[j] = _mm512_permutex2var_epi64(_mm512_castsi256_si512(low[j]), join,
+                                                         _mm512_castsi256_si512(high[j]));
+
+                    V v[16] = {
+                        h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+                        set1(IV[0]), set1(IV[1]), set1(IV[2]), set1(IV[3]),
+                        counterLo, counterHi, set1(BlockLen), set1(blockFlags)
+                    };
+                    for (size_t r = 0; r < 7; ++r)
+                        round(v, m, r);
+                    for (size_t i = 0; i < 8; ++i)
+                        h[i] = xorv(v[i], v[i + 8]);
+
+                    blockFlags = flags;
+                }
+
+                __m256i low[8], high[8];
+                for (size_t i = 0; i < 8; ++i)
+                {
+                    low[i] = _mm512_castsi512_si256(h[i]);
+                    high[i] = _mm512_castsi512_si256(_mm512_shuffle_i64x2(h[i], h[i], _MM_SHUFFLE(3, 2, 3, 2)));
+                }
+                Avx2::transpose(low);
+                Avx2::transpose(high);
+                for (size_t i = 0; i < 8; ++i)
+                {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i * OutLen), low[i]);
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + (i + 8) * OutLen), high[i]);
+                }
+            }
+        } // namespace Avx512
+#pragma GCC diagnostic pop
+#endif
+
+        /**
+         * @brief
+         *      number of inputs hashed together by the widest kernel
+         *      the cpu supports
+         */
+        inline size_t simdDegree()
+        {
+#ifdef CRYPTOGRAPHY_X86
+            const CpuFeatures &cpu = CpuFeatures::get();
+            if (cpu.avx512f)
+                return 16;
+            if (cpu.avx2)
+                return 8;
+            if (cpu.sse41)
+                return 4;
+#endif
+            return 1;
+        }
+
+        /**
+         * @brief
+         *      hash num equally long inputs, writing one chaining value per input into out
+         */
+        inline void hashMany(const byte *const *inputs, size_t num, size_t blocks, const uint32_t key[8],
+                             uint64_t counter, bool increment, uint8_t flags, uint8_t flagsStart, uint8_t flagsEnd,
+                             byte *out)
+        {
+#ifdef CRYPTOGRAPHY_X86
+            const CpuFeatures &cpu = CpuFeatures::get();
+
+            if (cpu.avx512f)
+            {
+                for (; num >= 16; num -= 16, inputs += 16, out += 16 * OutLen, counter += increment ? 16 : 0)
+                    Avx512::hash16(inputs, blocks, key, counter, increment, flags, flagsStart, flagsEnd, out);
+            }
+            if (cpu.avx2)
+            {
+                for (; num >= 8; num -= 8, inputs += 8, out += 8 * OutLen, counter += increment ? 8 : 0)
+                    Avx2::hash8(inputs, blocks, key, counter, increment, flags, flagsStart, flagsEnd, out);
+            }
+            if (cpu.sse41)
+            {
+                for (; num >= 4; num -= 4, inputs += 4, out += 4 * OutLen, counter += increment ? 4 : 0)
+                    Sse41::hash4(inputs, blocks, key, counter, increment, flags, flagsStart, flagsEnd, out);
+            }
+#endif
+            for (; num > 0; num -= 1, inputs += 1, out += OutLen, counter += increment ? 1 : 0)
+                hashOne(inputs[0], blocks, key, counter, flags, flagsStart, flagsEnd, out);
+        }
+
+    } // namespace Blake3Detail
+
+    class Blake3
+    {
+    public:
+        static constexpr size_t OutLen = Blake3Detail::OutLen;
+        static constexpr size_t KeyLen = 32;
+
+        /**
+         * @brief Construct a new Blake3 object for the default hash mode
+         */
+        Blake3();
+
+        /**
+         * @brief Construct a new Blake3 object for the keyed hash mode
+         *
+         * @param key
+         */
+        explicit Blake3(const std::array<byte, KeyLen> &key);
+
+        /**
+         * @brief
+         *      create a hasher for the key derivation mode
+         *
+         * @param context
+         *      hardcoded, globally unique, application specific context string
+         */
+        static Blake3 DeriveKey(const std::string &context);
+
+        /**
+         * @brief
+         *
+         * @param data
+         * @param offset
+         * @param len
+         */
+        void addData(std::vector<byte> &data, uint32_t offset, uint32_t len);
+
+        /**
+         * @brief
+         *      hash len bytes; whole subtrees are compressed with the
+         *      widest multi-chunk kernel the cpu supports
+         *
+         * @param data
+         * @param len
+         */
+        void addData(const byte *data, size_t len);
+
+        /**
+         * @brief
+         *      same as addData but large subtrees are compressed in
+         *      parallel on the pool. The result does not depend on the pool.
+         *
+         * @param data
+         * @param len
+         * @param pool
+         */
+        void addData(const byte *data, size_t len, ThreadPool &pool);
+
+        /**
+         * @brief Get the Hash object
+         *
+         *      finalizing does not modify the hasher, more data may be added after
+         *
+         * @param len
+         *      output length, any length is valid (extendable output)
+         *
+         * @return std::vector<byte>
+         */
+        std::vector<byte> GetHash(size_t len = OutLen) const;
+
+        /**
+         * @brief
+         *      write len bytes of extendable output starting at the byte position seek
+         *
+         * @param out
+         * @param len
+         * @param seek
+         */
+        void GetHash(byte *out, size_t len, uint64_t seek = 0) const;
+
+        /**
+         * @brief
+         *      forget all input, keeping the key and the mode
+         */
+        void reset();
+
+    private:
+        struct Output
+        {
+            uint32_t inputCv[8];
+            byte block[Blake3Detail::BlockLen];
+            uint8_t blockLen;
+            uint64_t counter;
+            uint8_t flags;
+
+            void chainingValue(byte out[OutLen]) const;
+            void rootBytes(uint64_t seek, byte *out, size_t len) const;
+        };
+
+        struct ChunkState
+        {
+            uint32_t cv[8];
+            uint64_t chunkCounter;
+            byte buf[Blake3Detail::BlockLen];
+            uint8_t bufLen;
+            uint8_t blocksCompressed;
+            uint8_t flags;
+
+            void init(const uint32_t key[8], uint8_t flags);
+            void resetTo(const uint32_t key[8], uint64_t chunkCounter);
+            size_t len() const;
+            uint8_t startFlag() const;
+            void update(const byte *input, size_t len);
+            Output output() const;
+        };
+
+        Blake3(const uint32_t key[8], uint8_t flags);
+
+        static Output parentOutput(const byte block[Blake3Detail::BlockLen], const uint32_t key[8], uint8_t flags);
+
+        static size_t leftLen(size_t contentLen);
+
+        static size_t compressChunksParallel(const byte *input, size_t len, const uint32_t key[8],
+                                             uint64_t chunkCounter, uint8_t flags, byte *out);
+
+        static size_t compressParentsParallel(const byte *childCvs, size_t numCvs, const uint32_t key[8],
+                                              uint8_t flags, byte *out);
+
+        static size_t compressSubtreeWide(const byte *input, size_t len, const uint32_t key[8],
+                                          uint64_t chunkCounter, uint8_t flags, byte *out, ThreadPool *pool);
+
+        static void compressSubtreeToParentNode(const byte *input, size_t len, const uint32_t key[8],
+                                                uint64_t chunkCounter, uint8_t flags, byte out[2 * OutLen],
+                                                ThreadPool *pool);
+
+        void update(const byte *data, size_t len, ThreadPool *pool);
+        void mergeCvStack(uint64_t totalLen);
+        void pushCv(const byte cv[OutLen], uint64_t chunkCounter);
+
+        uint32_t key[8];
+        ChunkState chunk;
+        byte cvStack[(Blake3Detail::MaxDepth + 1) * OutLen];
+        uint8_t cvStackLen = 0;
+    };
+
+    ///< Implementation
+    inline void Blake3::Output::chainingValue(byte out[OutLen]) const
+    {
+        uint32_t cv[8];
+        std::memcpy(cv, inputCv, sizeof(cv));
+        Blake3Detail::compressInPlace(cv, block, blockLen, counter, flags);
+        for (size_t i = 0; i < 8; ++i)
+            Blake3Detail::store32(out + 4 * i, cv[i]);
+    }
+
+    inline void Blake3::Output::rootBytes(uint64_t seek, byte *out, size_t len) const
+    {
+        uint64_t blockCounter = seek / 64;
+        size_t offset = static_cast<size_t>(seek % 64);
+        byte wide[64];
+
+        while (len > 0)
+        {
+            Blake3Detail::compressXof(inputCv, block, blockLen, blockCounter, flags | Blake3Detail::Root, wide);
+            size_t take = 64 - offset;
+            if (take > len)
+                take = len;
+            std::memcpy(out, wide + offset, take);
+            out += take;
+            len -= take;
+            blockCounter += 1;
+            offset = 0;
+        }
+    }
+
+    inline void Blake3::ChunkState::init(const uint32_t key[8], uint8_t flags)
+    {
+        this->flags = flags;
+        resetTo(key, 0);
+    }
+
+    inline void Blake3::ChunkState::resetTo(const uint32_t key[8], uint64_t chunkCounter)
+    {
+        std::memcpy(cv, key, sizeof(cv));
+        this->chunkCounter = chunkCounter;
+        std::memset(buf, 0, sizeof(buf));
+        bufLen = 0;
+        blocksCompressed = 0;
+    }
+
+    inline size_t Blake3::ChunkState::len() const
+    {
+        return Blake3Detail::BlockLen * static_cast<size_t>(blocksCompressed) + bufLen;
+    }
+
+    inline uint8_t Blake3::ChunkState::startFlag() const
+    {
+        return blocksCompressed == 0 ? Blake3Detail::ChunkStart : 0;
+    }
+
+    inline void Blake3::ChunkState::update(const byte *input, size_t len)
+    {
+        using namespace Blake3Detail;
+
+        if (bufLen > 0)
+        {
+            size_t take = BlockLen - bufLen;
+            if (take > len)
+                take = len;
+            std::memcpy(buf + bufLen, input, take);
+            bufLen += static_cast<uint8_t>(take);
+            input += take;
+            len -= take;
+
+            if (len > 0)
+            {
+                compressInPlace(cv, buf, BlockLen, chunkCounter, flags | startFlag());
+                blocksCompressed += 1;
+                bufLen = 0;
+                std::memset(buf, 0, sizeof(buf));
+            }
+        }
+
+        ///< the last block of a chunk is only compressed at output time
+        while (len > BlockLen)
+        {
+            compressInPlace(cv, input, BlockLen, chunkCounter, flags | startFlag());
+            blocksCompressed += 1;
+            input += BlockLen;
+            len -= BlockLen;
+        }
+
+        std::memcpy(buf + bufLen, input, len);
+        bufLen += static_cast<uint8_t>(len);
+    }
+
+    inline Blake3::Output Blake3::ChunkState::output() const
+    {
+        Output out;
+        std::memcpy(out.inputCv, cv, sizeof(cv));
+        std::memcpy(out.block, buf, sizeof(buf));
+        out.blockLen = bufLen;
+        out.counter = chunkCounter;
+        out.flags = flags | startFlag() | Blake3Detail::ChunkEnd;
+        return out;
+    }
+
+    inline Blake3::Blake3() : Blake3(Blake3Detail::IV, 0)
+    {
+    }
+
+    inline Blake3::Blake3(const std::array<byte, KeyLen> &key)
+    {
+        uint32_t words[8];
+        for (size_t i = 0; i < 8; ++i)
+            words[i] = Blake3Detail::load32(key.data() + 4 * i);
+
+        *this = Blake3(words, Blake3Detail::KeyedHash);
+    }
+
+    inline Blake3::Blake3(const uint32_t key[8], uint8_t flags)
+    {
+        std::memcpy(this->key, key, sizeof(this->key));
+        chunk.init(key, flags);
+    }
+
+    inline Blake3 Blake3::DeriveKey(const std::string &context)
+    {
+        Blake3 contextHasher(Blake3Detail::IV, Blake3Detail::DeriveKeyContext);
+        contextHasher.addData(reinterpret_cast<const byte *>(context.data()), context.size());
+
+        byte contextKey[KeyLen];
+        contextHasher.GetHash(contextKey, KeyLen);
+
+        uint32_t words[8];
+        for (size_t i = 0; i < 8; ++i)
+            words[i] = Blake3Detail::load32(contextKey + 4 * i);
+
+        return Blake3(words, Blake3Detail::DeriveKeyMaterial);
+    }
+
+    inline Blake3::Output Blake3::parentOutput(const byte block[Blake3Detail::BlockLen], const uint32_t key[8], uint8_t flags)
+    {
+        Output out;
+        std::memcpy(out.inputCv, key, sizeof(out.inputCv));
+        std::memcpy(out.block, block, Blake3Detail::BlockLen);
+        out.blockLen = Blake3Detail::BlockLen;
+        out.counter = 0;
+        out.flags = flags | Blake3Detail::Parent;
+        return out;
+    }
+
+    inline size_t Blake3::leftLen(size_t contentLen)
+    {
+        ///< the left subtree holds the largest power of 2 number of full chunks
+        ///< that leaves at least one byte for the right subtree
+        size_t fullChunks = (contentLen - 1) / Blake3Detail::ChunkLen;
+        return Blake3Detail::roundDownToPowerOf2(fullChunks) * Blake3Detail::ChunkLen;
+    }
+
+    inline size_t Blake3::compressChunksParallel(const byte *input, size_t len, const uint32_t key[8],
+                                                 uint64_t chunkCounter, uint8_t flags, byte *out)
+    {
+        using namespace Blake3Detail;
+
+        const byte *chunks[MaxSimdDegree];
+        size_t numChunks = 0;
+        size_t position = 0;
+
+        while (len - position >= ChunkLen)
+        {
+            chunks[numChunks++] = input + position;
+            position += ChunkLen;
+        }
+
+        hashMany(chunks, numChunks, ChunkLen / BlockLen, key, chunkCounter, true, flags, ChunkStart, ChunkEnd, out);
+
+        if (len > position)
+        {
+            ChunkState partial;
+            partial.init(key, flags);
+            partial.chunkCounter = chunkCounter + numChunks;
+            partial.update(input + position, len - position);
+            partial.output().chainingValue(out + numChunks * OutLen);
+            return numChunks + 1;
+        }
+
+        return numChunks;
+    }
+
+    inline size_t Blake3::compressParentsParallel(const byte *childCvs, size_t numCvs, const uint32_t key[8],
+                                                  uint8_t flags, byte *out)
+    {
+        using namespace Blake3Detail;
+
+        const byte *parents[MaxSimdDegree];
+        size_t numParents = 0;
+
+        while (numCvs - 2 * numParents >= 2)
+        {
+            parents[numParents] = childCvs + 2 * numParents * OutLen;
+            numParents += 1;
+        }
+
+        hashMany(parents, numParents, 1, key, 0, false, flags | Parent, 0, 0, out);
+
+        ///< an odd child is passed up unchanged
+        if (numCvs > 2 * numParents)
+        {
+            std::memcpy(out + numParents * OutLen, childCvs + 2 * numParents * OutLen, OutLen);
+            return numParents + 1;
+        }
+
+        return numParents;
+    }
+
+    inline size_t Blake3::compressSubtreeWide(const byte *input, size_t len, const uint32_t key[8],
+                                              uint64_t chunkCounter, uint8_t flags, byte *out, ThreadPool *pool)
+    {
+        using namespace Blake3Detail;
+
+        size_t degree = simdDegree();
+        if (len <= degree * ChunkLen)
+            return compressChunksParallel(input, len, key, chunkCounter, flags, out);
+
+        size_t left = leftLen(len);
+        size_t right = len - left;
+        uint64_t rightChunkCounter = chunkCounter + left / ChunkLen;
+
+        ///< with a degree of 1 the left side still returns 2 cvs, keep room for them
+        if (left > ChunkLen && degree == 1)
+            degree = 2;
+
+        byte cvs[2 * MaxSimdDegree * OutLen];
+        byte *rightCvs = cvs + degree * OutLen;
+        size_t leftN, rightN;
+
+        if (pool != nullptr && left >= ParallelGrain)
+        {
+            auto leftTask = pool->submit([&] {
+                return compressSubtreeWide(input, left, key, chunkCounter, flags, cvs, pool);
+            });
+            rightN = compressSubtreeWide(input + left, right, key, rightChunkCounter, flags, rightCvs, pool);
+            leftN = pool->wait(leftTask);
+        }
+        else
+        {
+            leftN = compressSubtreeWide(input, left, key, chunkCounter, flags, cvs, nullptr);
+            rightN = compressSubtreeWide(input + left, right, key, rightChunkCounter, flags, rightCvs, nullptr);
+        }
+
+        ///< a single left cv means there are exactly two children, the caller merges them
+        if (leftN == 1)
+        {
+            std::memcpy(out, cvs, 2 * OutLen);
+            return 2;
+        }
+
+        return compressParentsParallel(cvs, leftN + rightN, key, flags, out);
+    }
+
+    inline void Blake3::compressSubtreeToParentNode(const byte *input, size_t len, const uint32_t key[8],
+                                                    uint64_t chunkCounter, uint8_t flags, byte out[2 * OutLen],
+                                                    ThreadPool *pool)
+    {
+        using namespace Blake3Detail;
+
+        byte cvs[MaxSimdDegree * OutLen];
+        size_t numCvs = compressSubtreeWide(input, len, key, chunkCounter, flags, cvs, pool);
+
+        byte parents[MaxSimdDegree * OutLen / 2];
+        while (numCvs > 2)
+        {
+            numCvs = compressParentsParallel(cvs, numCvs, key, flags, parents);
+            std::memcpy(cvs, parents, numCvs * OutLen);
+        }
+
+        std::memcpy(out, cvs, 2 * OutLen);
+    }
+
+    inline void Blake3::mergeCvStack(uint64_t totalLen)
+    {
+        ///< the stack holds one cv per set bit of the number of completed chunks
+        size_t postMergeLen = static_cast<size_t>(__builtin_popcountll(totalLen));
+
+        while (cvStackLen > postMergeLen)
+        {
+            byte *parentNode = cvStack + (cvStackLen - 2) * OutLen;
+            parentOutput(parentNode, key, chunk.flags).chainingValue(parentNode);
+            cvStackLen -= 1;
+        }
+    }
+
+    inline void Blake3::pushCv(const byte cv[OutLen], uint64_t chunkCounter)
+    {
+        mergeCvStack(chunkCounter);
+        std::memcpy(cvStack + cvStackLen * OutLen, cv, OutLen);
+        cvStackLen += 1;
+    }
+
+    inline void Blake3::update(const byte *input, size_t len, ThreadPool *pool)
+    {
+        using namespace Blake3Detail;
+
+        if (len == 0)
+            return;
+
+        ///< finish a partially filled chunk first
+        if (chunk.len() > 0)
+        {
+            size_t take = ChunkLen - chunk.len();
+            if (take > len)
+                take = len;
+            chunk.update(input, take);
+            input += take;
+            len -= take;
+
+            if (len == 0)
+                return;
+
+            byte cv[OutLen];
+            chunk.output().chainingValue(cv);
+            pushCv(cv, chunk.chunkCounter);
+            chunk.resetTo(key, chunk.chunkCounter + 1);
+        }
+
+        ///< compress the largest power of 2 subtrees aligned with the chunk counter,
+        ///< always keeping at least one byte back for the final chunk
+        while (len > ChunkLen)
+        {
+            size_t subtreeLen = roundDownToPowerOf2(len);
+            uint64_t countSoFar = chunk.chunkCounter * ChunkLen;
+            while (((static_cast<uint64_t>(subtreeLen) - 1) & countSoFar) != 0)
+                subtreeLen /= 2;
+
+            uint64_t subtreeChunks = subtreeLen / ChunkLen;
+            if (subtreeLen <= ChunkLen)
+            {
+                ChunkState single;
+                single.init(key, chunk.flags);
+                single.chunkCounter = chunk.chunkCounter;
+                single.update(input, subtreeLen);
+
+                byte cv[OutLen];
+                single.output().chainingValue(cv);
+                pushCv(cv, single.chunkCounter);
+            }
+            else
+            {
+                byte cvPair[2 * OutLen];
+                compressSubtreeToParentNode(input, subtreeLen, key, chunk.chunkCounter, chunk.flags, cvPair, pool);
+                pushCv(cvPair, chunk.chunkCounter);
+                pushCv(cvPair + OutLen, chunk.chunkCounter + subtreeChunks / 2);
+            }
+
+            chunk.chunkCounter += subtreeChunks;
+            input += subtreeLen;
+            len -= subtreeLen;
+        }
+
+        if (len > 0)
+        {
+            chunk.update(input, len);
+            mergeCvStack(chunk.chunkCounter);
+        }
+    }
+
+    inline void Blake3::addData(std::vector<byte> &data, uint32_t offset, uint32_t len)
+    {
+        update(data.data() + offset, len, nullptr);
+    }
+
+    inline void Blake3::addData(const byte *data, size_t len)
+    {
+        update(data, len, nullptr);
+    }
+
+    inline void Blake3::addData(const byte *data, size_t len, ThreadPool &pool)
+    {
+        update(data, len, &pool);
+    }
+
+    inline std::vector<byte> Blake3::GetHash(size_t len) const
+    {
+        std::vector<byte> out(len);
+        GetHash(out.data(), len);
+        return out;
+    }
+
+    inline void Blake3::GetHash(byte *out, size_t len, uint64_t seek) const
+    {
+        if (len == 0)
+            return;
+
+        if (cvStackLen == 0)
+        {
+            chunk.output().rootBytes(seek, out, len);
+            return;
+        }
+
+        ///< fold the cv stack from the right, the current chunk being the rightmost node
+        Output output;
+        size_t remaining;
+
+        if (chunk.len() > 0)
+        {
+            remaining = cvStackLen;
+            output = chunk.output();
+        }
+        else
+        {
+            remaining = cvStackLen - 2;
+            output = parentOutput(cvStack + remaining * OutLen, key, chunk.flags);
+        }
+
+        while (remaining > 0)
+        {
+            remaining -= 1;
+            byte parentBlock[Blake3Detail::BlockLen];
+            std::memcpy(parentBlock, cvStack + remaining * OutLen, OutLen);
+            output.chainingValue(parentBlock + OutLen);
+            output = parentOutput(parentBlock, key, chunk.flags);
+        }
+
+        output.rootBytes(seek, out, len);
+    }
+
+    inline void Blake3::reset()
+    {
+        chunk.init(key, chunk.flags);
+        cvStackLen = 0;
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_BLAKE3_HPP */
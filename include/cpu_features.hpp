@@ -0,0 +1,108 @@
+#ifndef CRYPTOGRAPHY_CPU_FEATURES_HPP
+#define CRYPTOGRAPHY_CPU_FEATURES_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define CRYPTOGRAPHY_X86 1
+#endif
+
+namespace Crypto
+{
+    /**
+     * @brief
+     *      instruction set extensions available on the running cpu,
+     *      detected once with cpuid / xgetbv
+     */
+    struct CpuFeatures
+    {
+        bool sse41 = false;
+        bool sse42 = false;
+        bool pclmul = false;
+        bool avx2 = false;
+        bool avx512f = false;
+        bool avx512vl = false;
+        bool sha = false;
+
+        ///< brand string, e.g. "Intel(R) Xeon(R) Gold 6338 CPU @ 2.00GHz"
+        std::string model;
+
+        /**
+         * @brief Get the features of the current cpu
+         *
+         * @return const CpuFeatures&
+         */
+        static const CpuFeatures &get();
+
+    private:
+        static CpuFeatures detect();
+    };
+
+    ///< Implementation
+    inline const CpuFeatures &CpuFeatures::get()
+    {
+        static const CpuFeatures features = detect();
+        return features;
+    }
+
+    inline CpuFeatures CpuFeatures::detect()
+    {
+        CpuFeatures f;
+#ifdef CRYPTOGRAPHY_X86
+        unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+            return f;
+
+        f.sse41 = (ecx >> 19) & 1;
+        f.sse42 = (ecx >> 20) & 1;
+        f.pclmul = (ecx >> 1) & 1;
+
+        bool osxsave = (ecx >> 27) & 1;
+        bool avx = (ecx >> 28) & 1;
+        uint64_t xcr0 = 0;
+
+        if (osxsave)
+        {
+            uint32_t lo, hi;
+            __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+            xcr0 = (static_cast<uint64_t>(hi) << 32) | lo;
+        }
+
+        ///< the os has to save ymm (and zmm) state for us to use it
+        bool ymm = (xcr0 & 0x6) == 0x6;
+        bool zmm = ymm && (xcr0 & 0xE0) == 0xE0;
+
+        if (__get_cpuid_max(0, nullptr) >= 7)
+        {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            f.avx2 = avx && ymm && ((ebx >> 5) & 1);
+            f.avx512f = zmm && ((ebx >> 16) & 1);
+            f.avx512vl = f.avx512f && ((ebx >> 31) & 1);
+            f.sha = (ebx >> 29) & 1;
+        }
+
+        if (__get_cpuid_max(0x80000000, nullptr) >= 0x80000004)
+        {
+            unsigned int brand[12];
+            for (unsigned int i = 0; i < 3; ++i)
+                __get_cpuid(0x80000002 + i, &brand[4 * i], &brand[4 * i + 1], &brand[4 * i + 2], &brand[4 * i + 3]);
+
+            char text[sizeof(brand) + 1] = {};
+            std::memcpy(text, brand, sizeof(brand));
+            f.model = text;
+
+            size_t first = f.model.find_first_not_of(' ');
+            size_t last = f.model.find_last_not_of(' ');
+            f.model = first == std::string::npos ? std::string() : f.model.substr(first, last - first + 1);
+        }
+#endif
+        return f;
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_CPU_FEATURES_HPP */
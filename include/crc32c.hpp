@@ -0,0 +1,248 @@
+#ifndef CRYPTOGRAPHY_CRC32C_HPP
+#define CRYPTOGRAPHY_CRC32C_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "cpu_features.hpp"
+
+#ifdef CRYPTOGRAPHY_X86
+#include <immintrin.h>
+#endif
+
+typedef unsigned char byte;
+
+namespace Crypto
+{
+    /**
+     * @brief
+     *      CRC-32C (Castagnoli), hardware accelerated with the SSE4.2 crc32
+     *      instruction on three interleaved streams joined with PCLMUL
+     */
+    class Crc32c
+    {
+    public:
+        /**
+         * @brief
+         *
+         * @param data
+         * @param offset
+         * @param len
+         */
+        void addData(std::vector<byte> &data, uint32_t offset, uint32_t len);
+
+        /**
+         * @brief
+         *
+         * @param data
+         * @param len
+         */
+        void addData(const byte *data, size_t len);
+
+        /**
+         * @brief Get the checksum of the data added so far
+         *
+         * @return uint32_t
+         */
+        uint32_t GetValue() const;
+
+        /**
+         * @brief
+         *      forget all input
+         */
+        void reset();
+
+        /**
+         * @brief
+         *      advance a raw (not inverted) crc register over len bytes
+         *
+         * @return uint32_t
+         */
+        static uint32_t Extend(uint32_t crc, const byte *data, size_t len);
+
+    private:
+        static constexpr uint32_t Poly = 0x82F63B78;
+
+        ///< stride of each of the three interleaved streams
+        static constexpr size_t LongStride = 8192;
+        static constexpr size_t ShortStride = 256;
+
+        static const std::array<uint32_t, 256> &table();
+        static uint32_t extendPortable(uint32_t crc, const byte *data, size_t len);
+
+        static uint32_t multModP(uint32_t a, uint32_t b);
+        static uint32_t xPowModP(uint64_t n);
+
+#ifdef CRYPTOGRAPHY_X86
+        static uint32_t extendSse42(uint32_t crc, const byte *data, size_t len);
+        static uint32_t shift(uint32_t crc, uint32_t k, bool clmul);
+#endif
+
+        uint32_t state = 0xFFFFFFFF;
+    };
+
+    ///< Implementation
+    inline void Crc32c::addData(std::vector<byte> &data, uint32_t offset, uint32_t len)
+    {
+        addData(data.data() + offset, len);
+    }
+
+    inline void Crc32c::addData(const byte *data, size_t len)
+    {
+        state = Extend(state, data, len);
+    }
+
+    inline uint32_t Crc32c::GetValue() const
+    {
+        return ~state;
+    }
+
+    inline void Crc32c::reset()
+    {
+        state = 0xFFFFFFFF;
+    }
+
+    inline uint32_t Crc32c::Extend(uint32_t crc, const byte *data, size_t len)
+    {
+#ifdef CRYPTOGRAPHY_X86
+        if (CpuFeatures::get().sse42)
+            return extendSse42(crc, data, len);
+#endif
+        return extendPortable(crc, data, len);
+    }
+
+    inline const std::array<uint32_t, 256> &Crc32c::table()
+    {
+        static const std::array<uint32_t, 256> t = [] {
+            std::array<uint32_t, 256> r{};
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? (c >> 1) ^ Poly : c >> 1;
+                r[i] = c;
+            }
+            return r;
+        }();
+        return t;
+    }
+
+    inline uint32_t Crc32c::extendPortable(uint32_t crc, const byte *data, size_t len)
+    {
+        const std::array<uint32_t, 256> &t = table();
+        while (len-- > 0)
+            crc = t[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+        return crc;
+    }
+
+    inline uint32_t Crc32c::multModP(uint32_t a, uint32_t b)
+    {
+        ///< bit 31 is x^0 in the reflected representation
+        uint32_t m = 1u << 31, p = 0;
+        for (;;)
+        {
+            if (a & m)
+            {
+                p ^= b;
+                if ((a & (m - 1)) == 0)
+                    break;
+            }
+            m >>= 1;
+            b = (b & 1) ? (b >> 1) ^ Poly : b >> 1;
+        }
+        return p;
+    }
+
+    inline uint32_t Crc32c::xPowModP(uint64_t n)
+    {
+        ///< square and multiply, x^(2^k) kept in sq
+        uint32_t p = 1u << 31;
+        uint32_t sq = 1u << 30;
+        while (n > 0)
+        {
+            if (n & 1)
+                p = multModP(sq, p);
+            sq = multModP(sq, sq);
+            n >>= 1;
+        }
+        return p;
+    }
+
+#ifdef CRYPTOGRAPHY_X86
+    __attribute__((target("sse4.2,pclmul"))) inline uint32_t Crc32c::shift(uint32_t crc, uint32_t k, bool clmul)
+    {
+        if (!clmul)
+            return multModP(k, crc);
+
+        ///< the carry-less product is reduced by the crc32 instruction, which
+        ///< multiplies by x^33 on the way (k is pre-divided accordingly)
+        __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(static_cast<int>(crc)),
+                                               _mm_cvtsi32_si128(static_cast<int>(k)), 0x00);
+        return static_cast<uint32_t>(_mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(product))));
+    }
+
+    __attribute__((target("sse4.2,pclmul"))) inline uint32_t Crc32c::extendSse42(uint32_t crc, const byte *data, size_t len)
+    {
+        static const bool clmul = CpuFeatures::get().pclmul;
+
+        ///< constants shifting a crc over 1 and 2 strides of zeros
+        static const std::array<uint32_t, 4> k = [] {
+            uint32_t adjust = CpuFeatures::get().pclmul ? 33 : 0;
+            return std::array<uint32_t, 4>{
+                xPowModP(8 * LongStride - adjust), xPowModP(16 * LongStride - adjust),
+                xPowModP(8 * ShortStride - adjust), xPowModP(16 * ShortStride - adjust)};
+        }();
+
+        uint64_t crc0 = crc;
+
+        while (len > 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0)
+        {
+            crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *data++);
+            --len;
+        }
+
+        ///< the crc32 instruction has a latency of 3 and a throughput of 1,
+        ///< three independent streams keep it busy
+        const size_t strides[2] = {LongStride, ShortStride};
+        for (size_t s = 0; s < 2; ++s)
+        {
+            const size_t stride = strides[s];
+            while (len >= 3 * stride)
+            {
+                uint64_t crc1 = 0, crc2 = 0;
+                const byte *end = data + stride;
+                for (; data < end; data += 8)
+                {
+                    uint64_t w0, w1, w2;
+                    std::memcpy(&w0, data, 8);
+                    std::memcpy(&w1, data + stride, 8);
+                    std::memcpy(&w2, data + 2 * stride, 8);
+                    crc0 = _mm_crc32_u64(crc0, w0);
+                    crc1 = _mm_crc32_u64(crc1, w1);
+                    crc2 = _mm_crc32_u64(crc2, w2);
+                }
+                crc0 = shift(static_cast<uint32_t>(crc0), k[2 * s + 1], clmul) ^
+                       shift(static_cast<uint32_t>(crc1), k[2 * s], clmul) ^ static_cast<uint32_t>(crc2);
+                data += 2 * stride;
+                len -= 3 * stride;
+            }
+        }
+
+        for (; len >= 8; len -= 8, data += 8)
+        {
+            uint64_t w;
+            std::memcpy(&w, data, 8);
+            crc0 = _mm_crc32_u64(crc0, w);
+        }
+        for (; len > 0; --len)
+            crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *data++);
+
+        return static_cast<uint32_t>(crc0);
+    }
+#endif
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_CRC32C_HPP */
@@ -0,0 +1,748 @@
+#ifndef CRYPTOGRAPHY_DELTA_SYNC_HPP
+#define CRYPTOGRAPHY_DELTA_SYNC_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cpu_features.hpp"
+#include "hash_dispatch.hpp"
+#include "thread_pool.hpp"
+
+#ifdef CRYPTOGRAPHY_X86
+#include <immintrin.h>
+#endif
+
+namespace Crypto
+{
+    namespace DeltaSyncDetail
+    {
+        constexpr char SignatureMagic[8] = {'C', 'R', 'Y', 'D', 'S', 'I', 'G', '1'};
+        constexpr char DeltaMagic[8] = {'C', 'R', 'Y', 'D', 'L', 'T', 'A', '1'};
+
+        ///< bytes of old file signed / new file scanned by one pool task
+        constexpr size_t TaskBytes = 4 << 20;
+
+        ///< blocks following a match confirmed by one multi lane MD5 call
+        constexpr size_t RunBlocks = 16;
+
+        ///< rsync weak sum state: a = sum of bytes, b = sum of running a, both mod 2^16
+        struct Rolling
+        {
+            uint32_t a = 0;
+            uint32_t b = 0;
+
+            uint32_t value() const
+            {
+                return (a & 0xffff) | (b << 16);
+            }
+
+            ///< slide a window of n bytes one byte on: out leaves, in enters
+            void roll(byte out, byte in, uint32_t n)
+            {
+                a += static_cast<uint32_t>(in) - out;
+                b += a - n * out;
+            }
+        };
+
+        inline void sumPortable(Rolling &sum, const byte *data, size_t len)
+        {
+            uint32_t a = sum.a, b = sum.b;
+            for (size_t i = 0; i < len; ++i)
+            {
+                a += data[i];
+                b += a;
+            }
+            sum.a = a;
+            sum.b = b;
+        }
+
+#ifdef CRYPTOGRAPHY_X86
+        /**
+         * @brief
+         *      32 bytes per step: sad gives the byte sum, maddubs against the
+         *      weights 32..1 the position weighted sum; sums of earlier chunks
+         *      are folded in once at the end (same scheme as zlib's adler32)
+         */
+        __attribute__((target("avx2"))) inline void sumAvx2(Rolling &sum, const byte *data, size_t len)
+        {
+            using V = __m256i;
+
+            const size_t chunks = len / 32;
+            const V weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                               16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+            const V ones = _mm256_set1_epi16(1);
+            const V zero = _mm256_setzero_si256();
+
+            V bytes = zero, prior = zero, weighted = zero;
+            for (size_t i = 0; i < chunks; ++i)
+            {
+                V x = _mm256_loadu_si256(reinterpret_cast<const V *>(data + 32 * i));
+                prior = _mm256_add_epi32(prior, bytes);
+                bytes = _mm256_add_epi32(bytes, _mm256_sad_epu8(x, zero));
+                weighted = _mm256_add_epi32(weighted, _mm256_madd_epi16(_mm256_maddubs_epi16(x, weights), ones));
+            }
+
+            alignas(32) uint32_t lanes[3][8];
+            _mm256_store_si256(reinterpret_cast<V *>(lanes[0]), bytes);
+            _mm256_store_si256(reinterpret_cast<V *>(lanes[1]), prior);
+            _mm256_store_si256(reinterpret_cast<V *>(lanes[2]), weighted);
+
+            uint32_t a = 0, earlier = 0, within = 0;
+            for (int i = 0; i < 8; ++i)
+            {
+                a += lanes[0][i];
+                earlier += lanes[1][i];
+                within += lanes[2][i];
+            }
+
+            sum.b += static_cast<uint32_t>(32 * chunks) * sum.a + 32 * earlier + within;
+            sum.a += a;
+            sumPortable(sum, data + 32 * chunks, len % 32);
+        }
+#endif
+
+        inline Rolling sum(const byte *data, size_t len)
+        {
+            Rolling rolling;
+#ifdef CRYPTOGRAPHY_X86
+            if (CpuFeatures::get().avx2)
+            {
+                sumAvx2(rolling, data, len);
+                return rolling;
+            }
+#endif
+            sumPortable(rolling, data, len);
+            return rolling;
+        }
+
+        ///< one multiply per scanned byte, the filter takes the top bits
+        inline uint32_t tag(uint32_t weak)
+        {
+            return weak * 0x9E3779B1U;
+        }
+
+        ///< full mix for the bucket, only computed for windows that pass the filter
+        inline uint32_t mix(uint32_t x)
+        {
+            x ^= x >> 16;
+            x *= 0x7feb352dU;
+            x ^= x >> 15;
+            x *= 0x846ca68bU;
+            x ^= x >> 16;
+            return x;
+        }
+
+        inline void putVarint(std::vector<byte> &out, uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                out.push_back(static_cast<byte>(value | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<byte>(value));
+        }
+
+        inline uint64_t getVarint(const byte *&p, const byte *end)
+        {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                if (p == end)
+                    break;
+                byte c = *p++;
+                value |= static_cast<uint64_t>(c & 0x7f) << shift;
+                if ((c & 0x80) == 0)
+                    return value;
+            }
+            throw std::runtime_error("corrupt delta");
+        }
+    } // namespace DeltaSyncDetail
+
+    /**
+     * @brief
+     *      rsync style delta transfer.
+     *
+     *      the receiver signs its old copy: per block a rolling weak sum and
+     *      an MD5. The sender slides a window over the new file one byte at a
+     *      time, updating the weak sum in O(1); windows whose weak sum is in
+     *      the signature are confirmed with MD5 and become copies of old
+     *      blocks, everything else is sent as literals. The receiver patches
+     *      its old copy with the delta.
+     *
+     *      signing hashes the equal length blocks with the multi lane MD5
+     *      kernels; both signing and scanning split the input over a
+     *      ThreadPool when given one.
+     *
+     * @code
+     *      DeltaSync::Signature signature = DeltaSync::Sign(old, oldLen, DeltaSync::BlockSizeFor(oldLen), pool);
+     *      DeltaSync::Delta delta = DeltaSync::Diff(signature, data, len, pool);
+     *      std::vector<byte> rebuilt = DeltaSync::Patch(old, oldLen, delta);
+     * @endcode
+     */
+    class DeltaSync
+    {
+    public:
+        struct BlockSignature
+        {
+            uint32_t weak;
+            byte strong[16];
+        };
+
+        struct Signature
+        {
+            uint32_t blockSize = 0;
+            uint64_t fileSize = 0;
+            ///< one per block, the last one may be shorter than blockSize
+            std::vector<BlockSignature> blocks;
+
+            std::vector<byte> serialize() const;
+
+            ///< @throw std::runtime_error when data is not a signature
+            static Signature Deserialize(const byte *data, size_t len);
+        };
+
+        struct Op
+        {
+            enum class Kind : uint8_t
+            {
+                Copy,
+                Literal
+            };
+
+            Kind kind;
+            ///< Copy: offset in the old file, Literal: offset in Delta::literals
+            uint64_t offset;
+            uint64_t length;
+        };
+
+        struct Delta
+        {
+            uint64_t newSize = 0;
+            std::vector<Op> ops;
+            std::vector<byte> literals;
+
+            uint64_t copiedBytes() const
+            {
+                return newSize - literals.size();
+            }
+
+            /**
+             * @brief
+             *      magic, varint newSize, then per op varint(length << 1 |
+             *      literal) followed by the old offset or the literal bytes
+             */
+            std::vector<byte> serialize() const;
+
+            ///< @throw std::runtime_error when data is not a delta
+            static Delta Deserialize(const byte *data, size_t len);
+        };
+
+        ///< rsync's choice: about sqrt(fileSize), multiple of 8, between 700 bytes and 128 KiB
+        static uint32_t BlockSizeFor(uint64_t fileSize);
+
+        ///< weak sum of one window, what the signature stores
+        static uint32_t WeakSum(const byte *data, size_t len);
+
+        static Signature Sign(const byte *data, size_t len, uint32_t blockSize);
+        static Signature Sign(const byte *data, size_t len, uint32_t blockSize, ThreadPool &pool);
+
+        static Delta Diff(const Signature &signature, const byte *data, size_t len);
+        static Delta Diff(const Signature &signature, const byte *data, size_t len, ThreadPool &pool);
+
+        /**
+         * @brief
+         *      rebuild the new file from the old one and a delta
+         *
+         * @throw std::out_of_range when a copy reaches past the old file
+         */
+        static std::vector<byte> Patch(const byte *old, size_t oldLen, const Delta &delta);
+
+    private:
+        ///< an op at a position of the new file, before merging segments
+        struct Piece
+        {
+            Op::Kind kind;
+            uint64_t at;
+            uint64_t length;
+            uint64_t offset;
+        };
+
+        ///< weak sum -> blocks with that sum, full length blocks only
+        class Index
+        {
+        public:
+            explicit Index(const Signature &signature);
+
+            ///< false when no block has this weak sum; one bit test in cache, inlined in the scan
+            bool mayContain(uint32_t weak) const
+            {
+                uint32_t bit = DeltaSyncDetail::tag(weak) >> filterShift;
+                return (filter[bit / 64] & (uint64_t(1) << (bit & 63))) != 0;
+            }
+
+            ///< block whose sums match the window at data, -1 when none
+            int64_t find(uint32_t weak, const byte *data) const;
+
+        private:
+            const Signature &signature;
+            uint64_t mask = 0;
+            unsigned filterShift = 0;
+            std::vector<uint64_t> filter;
+            std::vector<uint32_t> heads;
+            std::vector<uint32_t> next;
+        };
+
+        static void signRange(const byte *data, size_t len, uint32_t blockSize, size_t first, size_t count, BlockSignature *out);
+
+        /**
+         * @brief
+         *      unchanged stretches match block after block: check the weak
+         *      sums of the windows right after a match against the next old
+         *      blocks and confirm them RunBlocks at a time with Md5Many
+         *
+         * @return position after the last confirmed block
+         */
+        template <typename Emit>
+        static size_t followRun(const Signature &signature, const byte *data, size_t pos, size_t stop, size_t next, Emit &emit);
+
+        ///< matches for windows starting in [begin, end)
+        static std::vector<Piece> scan(const Signature &signature, const Index &index, const byte *data, size_t len,
+                                       size_t begin, size_t end);
+
+        static Delta merge(const std::vector<std::vector<Piece>> &segments, const byte *data, size_t len);
+    };
+
+    ///< Implementation
+    inline uint32_t DeltaSync::BlockSizeFor(uint64_t fileSize)
+    {
+        uint64_t size = static_cast<uint64_t>(std::sqrt(static_cast<double>(fileSize))) & ~uint64_t(7);
+        return static_cast<uint32_t>(std::min<uint64_t>(std::max<uint64_t>(size, 700), 128 * 1024));
+    }
+
+    inline uint32_t DeltaSync::WeakSum(const byte *data, size_t len)
+    {
+        return DeltaSyncDetail::sum(data, len).value();
+    }
+
+    inline void DeltaSync::signRange(const byte *data, size_t len, uint32_t blockSize, size_t first, size_t count,
+                                     BlockSignature *out)
+    {
+        const size_t fullBlocks = len / blockSize;
+        size_t full = first + count <= fullBlocks ? count : fullBlocks - std::min(first, fullBlocks);
+
+        ///< full blocks are back to back and of equal length: one multi lane MD5 call
+        std::vector<byte> digests(16 * full);
+        if (full > 0)
+            HashDispatch::Md5Many(data + first * blockSize, blockSize, full, digests.data());
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            const size_t block = first + i;
+            const byte *start = data + block * blockSize;
+            const size_t length = std::min<size_t>(blockSize, len - block * blockSize);
+
+            out[i].weak = WeakSum(start, length);
+            if (i < full)
+                std::memcpy(out[i].strong, digests.data() + 16 * i, 16);
+            else
+                HashDispatch::Md5(start, length, out[i].strong);
+        }
+    }
+
+    inline DeltaSync::Signature DeltaSync::Sign(const byte *data, size_t len, uint32_t blockSize)
+    {
+        if (blockSize == 0)
+            throw std::invalid_argument("block size must not be 0");
+
+        Signature signature;
+        signature.blockSize = blockSize;
+        signature.fileSize = len;
+        signature.blocks.resize((len + blockSize - 1) / blockSize);
+        signRange(data, len, blockSize, 0, signature.blocks.size(), signature.blocks.data());
+        return signature;
+    }
+
+    inline DeltaSync::Signature DeltaSync::Sign(const byte *data, size_t len, uint32_t blockSize, ThreadPool &pool)
+    {
+        if (blockSize == 0)
+            throw std::invalid_argument("block size must not be 0");
+
+        Signature signature;
+        signature.blockSize = blockSize;
+        signature.fileSize = len;
+        signature.blocks.resize((len + blockSize - 1) / blockSize);
+
+        const size_t perTask = std::max<size_t>(1, DeltaSyncDetail::TaskBytes / blockSize);
+        std::vector<std::future<void>> tasks;
+        for (size_t first = 0; first < signature.blocks.size(); first += perTask)
+        {
+            size_t count = std::min(perTask, signature.blocks.size() - first);
+            BlockSignature *out = signature.blocks.data() + first;
+            tasks.push_back(pool.submit([=] { signRange(data, len, blockSize, first, count, out); }));
+        }
+        for (std::future<void> &task : tasks)
+            pool.wait(task);
+
+        return signature;
+    }
+
+    inline DeltaSync::Index::Index(const Signature &signature) : signature(signature)
+    {
+        const size_t blocks = signature.blocks.size();
+
+        size_t buckets = 1024;
+        while (buckets < 2 * blocks)
+            buckets *= 2;
+        mask = buckets - 1;
+
+        ///< 32 bits per block: almost every window is rejected by one bit test
+        size_t bits = 8192;
+        filterShift = 32 - 13;
+        while (bits < 32 * blocks && filterShift > 0)
+        {
+            bits *= 2;
+            --filterShift;
+        }
+        filter.assign(bits / 64, 0);
+
+        heads.assign(buckets, UINT32_MAX);
+        next.assign(blocks, UINT32_MAX);
+
+        ///< inserted back to front so chains list blocks in file order
+        for (size_t i = blocks; i-- > 0;)
+        {
+            if (static_cast<uint64_t>(i + 1) * signature.blockSize > signature.fileSize)
+                continue;
+
+            uint32_t weak = signature.blocks[i].weak;
+            uint32_t bit = DeltaSyncDetail::tag(weak) >> filterShift;
+            filter[bit / 64] |= uint64_t(1) << (bit & 63);
+
+            uint32_t &head = heads[DeltaSyncDetail::mix(weak) & mask];
+            next[i] = head;
+            head = static_cast<uint32_t>(i);
+        }
+    }
+
+    inline int64_t DeltaSync::Index::find(uint32_t weak, const byte *data) const
+    {
+        byte strong[16];
+        bool hashed = false;
+        for (uint32_t block = heads[DeltaSyncDetail::mix(weak) & mask]; block != UINT32_MAX; block = next[block])
+        {
+            const BlockSignature &candidate = signature.blocks[block];
+            if (candidate.weak != weak)
+                continue;
+
+            if (!hashed)
+            {
+                HashDispatch::Md5(data, signature.blockSize, strong);
+                hashed = true;
+            }
+            if (std::memcmp(strong, candidate.strong, 16) == 0)
+                return block;
+        }
+        return -1;
+    }
+
+    template <typename Emit>
+    size_t DeltaSync::followRun(const Signature &signature, const byte *data, size_t pos, size_t stop, size_t next, Emit &emit)
+    {
+        const uint32_t blockSize = signature.blockSize;
+        const size_t fullBlocks = static_cast<size_t>(signature.fileSize / blockSize);
+        byte digests[16 * DeltaSyncDetail::RunBlocks];
+
+        for (;;)
+        {
+            size_t run = 0;
+            while (run < DeltaSyncDetail::RunBlocks && next + run < fullBlocks && pos + run * blockSize < stop &&
+                   WeakSum(data + pos + run * blockSize, blockSize) == signature.blocks[next + run].weak)
+                ++run;
+            if (run == 0)
+                return pos;
+
+            HashDispatch::Md5Many(data + pos, blockSize, run, digests);
+
+            size_t confirmed = 0;
+            while (confirmed < run && std::memcmp(digests + 16 * confirmed, signature.blocks[next + confirmed].strong, 16) == 0)
+            {
+                emit(pos, static_cast<uint64_t>(next + confirmed) * blockSize, blockSize);
+                pos += blockSize;
+                ++confirmed;
+            }
+            if (confirmed < run)
+                return pos;
+            next += run;
+        }
+    }
+
+    inline std::vector<DeltaSync::Piece> DeltaSync::scan(const Signature &signature, const Index &index, const byte *data,
+                                                         size_t len, size_t begin, size_t end)
+    {
+        const uint32_t blockSize = signature.blockSize;
+        std::vector<Piece> pieces;
+        size_t literalStart = begin;
+        size_t pos = begin;
+
+        auto emit = [&](size_t matchAt, uint64_t oldOffset, uint64_t length) {
+            if (matchAt > literalStart)
+                pieces.push_back({Op::Kind::Literal, literalStart, matchAt - literalStart, 0});
+            pieces.push_back({Op::Kind::Copy, matchAt, length, oldOffset});
+            literalStart = matchAt + length;
+        };
+
+        ///< windows start before stop and lie inside the file
+        const size_t stop = len >= blockSize ? std::min(end, len - blockSize + 1) : 0;
+
+        while (pos < stop)
+        {
+            DeltaSyncDetail::Rolling rolling = DeltaSyncDetail::sum(data + pos, blockSize);
+
+            ///< the per byte loop: roll, one bit test, nothing else unless it hits
+            for (;;)
+            {
+                const uint32_t weak = rolling.value();
+                if (index.mayContain(weak))
+                {
+                    int64_t block = index.find(weak, data + pos);
+                    if (block >= 0)
+                    {
+                        emit(pos, static_cast<uint64_t>(block) * blockSize, blockSize);
+                        pos += blockSize;
+                        pos = followRun(signature, data, pos, stop, static_cast<size_t>(block) + 1, emit);
+                        break;
+                    }
+                }
+
+                if (++pos >= stop)
+                    break;
+                rolling.roll(data[pos - 1], data[pos - 1 + blockSize], blockSize);
+            }
+        }
+
+        ///< the last segment may end on the old file's short tail block
+        const size_t tail = signature.fileSize % blockSize;
+        if (end == len && tail != 0 && len >= tail && len - tail >= literalStart)
+        {
+            const BlockSignature &last = signature.blocks.back();
+            const byte *window = data + len - tail;
+            byte strong[16];
+            if (WeakSum(window, tail) == last.weak)
+            {
+                HashDispatch::Md5(window, tail, strong);
+                if (std::memcmp(strong, last.strong, 16) == 0)
+                    emit(len - tail, signature.fileSize - tail, tail);
+            }
+        }
+
+        size_t covered = std::max(end, literalStart);
+        if (covered > literalStart)
+            pieces.push_back({Op::Kind::Literal, literalStart, covered - literalStart, 0});
+        return pieces;
+    }
+
+    inline DeltaSync::Delta DeltaSync::merge(const std::vector<std::vector<Piece>> &segments, const byte *data, size_t len)
+    {
+        Delta delta;
+        delta.newSize = len;
+        uint64_t cursor = 0;
+
+        auto literal = [&](uint64_t at, uint64_t length) {
+            if (!delta.ops.empty() && delta.ops.back().kind == Op::Kind::Literal)
+                delta.ops.back().length += length;
+            else
+                delta.ops.push_back({Op::Kind::Literal, delta.literals.size(), length});
+            delta.literals.insert(delta.literals.end(), data + at, data + at + length);
+        };
+
+        ///< a match running into the next segment wins, that segment's
+        ///< pieces are cut to start where it ends
+        for (const std::vector<Piece> &pieces : segments)
+        {
+            for (const Piece &piece : pieces)
+            {
+                uint64_t pieceEnd = piece.at + piece.length;
+                if (pieceEnd <= cursor)
+                    continue;
+
+                if (piece.kind == Op::Kind::Literal || piece.at < cursor)
+                {
+                    uint64_t start = std::max(piece.at, cursor);
+                    literal(start, pieceEnd - start);
+                }
+                else if (!delta.ops.empty() && delta.ops.back().kind == Op::Kind::Copy &&
+                         delta.ops.back().offset + delta.ops.back().length == piece.offset)
+                {
+                    delta.ops.back().length += piece.length;
+                }
+                else
+                {
+                    delta.ops.push_back({Op::Kind::Copy, piece.offset, piece.length});
+                }
+                cursor = pieceEnd;
+            }
+        }
+        return delta;
+    }
+
+    inline DeltaSync::Delta DeltaSync::Diff(const Signature &signature, const byte *data, size_t len)
+    {
+        if (signature.blockSize == 0)
+            throw std::invalid_argument("block size must not be 0");
+
+        Index index(signature);
+        return merge({scan(signature, index, data, len, 0, len)}, data, len);
+    }
+
+    inline DeltaSync::Delta DeltaSync::Diff(const Signature &signature, const byte *data, size_t len, ThreadPool &pool)
+    {
+        if (signature.blockSize == 0)
+            throw std::invalid_argument("block size must not be 0");
+
+        Index index(signature);
+
+        const size_t segment = std::max<size_t>(DeltaSyncDetail::TaskBytes, signature.blockSize);
+        std::vector<std::future<std::vector<Piece>>> tasks;
+        for (size_t begin = 0; begin < len || begin == 0; begin += segment)
+        {
+            size_t end = std::min(len, begin + segment);
+            tasks.push_back(pool.submit([&, begin, end] { return scan(signature, index, data, len, begin, end); }));
+            if (end == len)
+                break;
+        }
+
+        std::vector<std::vector<Piece>> segments;
+        for (std::future<std::vector<Piece>> &task : tasks)
+            segments.push_back(pool.wait(task));
+        return merge(segments, data, len);
+    }
+
+    inline std::vector<byte> DeltaSync::Patch(const byte *old, size_t oldLen, const Delta &delta)
+    {
+        std::vector<byte> out;
+        out.reserve(delta.newSize);
+
+        for (const Op &op : delta.ops)
+        {
+            const byte *from;
+            if (op.kind == Op::Kind::Copy)
+            {
+                if (op.offset > oldLen || op.length > oldLen - op.offset)
+                    throw std::out_of_range("delta copies past the end of the old file");
+                from = old + op.offset;
+            }
+            else
+            {
+                if (op.offset > delta.literals.size() || op.length > delta.literals.size() - op.offset)
+                    throw std::out_of_range("delta literal past its data");
+                from = delta.literals.data() + op.offset;
+            }
+            out.insert(out.end(), from, from + op.length);
+        }
+
+        if (out.size() != delta.newSize)
+            throw std::out_of_range("delta does not cover the new file");
+        return out;
+    }
+
+    inline std::vector<byte> DeltaSync::Signature::serialize() const
+    {
+        std::vector<byte> out(DeltaSyncDetail::SignatureMagic, DeltaSyncDetail::SignatureMagic + 8);
+        DeltaSyncDetail::putVarint(out, blockSize);
+        DeltaSyncDetail::putVarint(out, fileSize);
+        for (const BlockSignature &block : blocks)
+        {
+            for (int i = 0; i < 4; ++i)
+                out.push_back(static_cast<byte>(block.weak >> (8 * i)));
+            out.insert(out.end(), block.strong, block.strong + 16);
+        }
+        return out;
+    }
+
+    inline DeltaSync::Signature DeltaSync::Signature::Deserialize(const byte *data, size_t len)
+    {
+        const byte *end = data + len;
+        if (len < 8 || std::memcmp(data, DeltaSyncDetail::SignatureMagic, 8) != 0)
+            throw std::runtime_error("not a delta signature");
+        data += 8;
+
+        Signature signature;
+        signature.blockSize = static_cast<uint32_t>(DeltaSyncDetail::getVarint(data, end));
+        signature.fileSize = DeltaSyncDetail::getVarint(data, end);
+        if (signature.blockSize == 0)
+            throw std::runtime_error("corrupt delta signature");
+
+        size_t count = static_cast<size_t>((signature.fileSize + signature.blockSize - 1) / signature.blockSize);
+        if (static_cast<size_t>(end - data) != 20 * count)
+            throw std::runtime_error("corrupt delta signature");
+
+        signature.blocks.resize(count);
+        for (BlockSignature &block : signature.blocks)
+        {
+            block.weak = static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+                         (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+            std::memcpy(block.strong, data + 4, 16);
+            data += 20;
+        }
+        return signature;
+    }
+
+    inline std::vector<byte> DeltaSync::Delta::serialize() const
+    {
+        std::vector<byte> out(DeltaSyncDetail::DeltaMagic, DeltaSyncDetail::DeltaMagic + 8);
+        out.reserve(8 + 10 + 12 * ops.size() + literals.size());
+        DeltaSyncDetail::putVarint(out, newSize);
+
+        for (const Op &op : ops)
+        {
+            DeltaSyncDetail::putVarint(out, op.length << 1 | (op.kind == Op::Kind::Literal ? 1 : 0));
+            if (op.kind == Op::Kind::Copy)
+                DeltaSyncDetail::putVarint(out, op.offset);
+            else
+                out.insert(out.end(), literals.begin() + op.offset, literals.begin() + op.offset + op.length);
+        }
+        return out;
+    }
+
+    inline DeltaSync::Delta DeltaSync::Delta::Deserialize(const byte *data, size_t len)
+    {
+        const byte *end = data + len;
+        if (len < 8 || std::memcmp(data, DeltaSyncDetail::DeltaMagic, 8) != 0)
+            throw std::runtime_error("not a delta");
+        data += 8;
+
+        Delta delta;
+        delta.newSize = DeltaSyncDetail::getVarint(data, end);
+        while (data != end)
+        {
+            uint64_t word = DeltaSyncDetail::getVarint(data, end);
+            Op op;
+            op.length = word >> 1;
+            if (word & 1)
+            {
+                if (op.length > static_cast<uint64_t>(end - data))
+                    throw std::runtime_error("corrupt delta");
+                op.kind = Op::Kind::Literal;
+                op.offset = delta.literals.size();
+                delta.literals.insert(delta.literals.end(), data, data + op.length);
+                data += op.length;
+            }
+            else
+            {
+                op.kind = Op::Kind::Copy;
+                op.offset = DeltaSyncDetail::getVarint(data, end);
+            }
+            delta.ops.push_back(op);
+        }
+        return delta;
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_DELTA_SYNC_HPP */
@@ -0,0 +1,718 @@
+#ifndef CRYPTOGRAPHY_DIGEST_DEDUP_HPP
+#define CRYPTOGRAPHY_DIGEST_DEDUP_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cpu_features.hpp"
+#include "thread_pool.hpp"
+
+#ifdef CRYPTOGRAPHY_X86
+#include <immintrin.h>
+#endif
+
+typedef unsigned char byte;
+
+namespace Crypto
+{
+    namespace DigestDedupDetail
+    {
+        ///< the MSD pass splits on the top 16 bits that differ
+        constexpr unsigned MsdBits = 16;
+        constexpr size_t MsdBuckets = size_t(1) << MsdBits;
+
+        ///< buckets up to this size are insertion sorted instead of split further
+        constexpr size_t SmallBucket = 48;
+
+        ///< spill partitions per level, one per value of the next digest byte
+        constexpr size_t Partitions = 256;
+
+        ///< first 8 digest bytes as a big endian integer, the radix key
+        inline uint64_t prefix(const byte *digest)
+        {
+            uint64_t key = 0;
+            for (int i = 0; i < 8; ++i)
+                key = key << 8 | digest[i];
+            return key;
+        }
+
+        inline void writeAll(int fd, const void *data, size_t len, const std::string &path)
+        {
+            const byte *p = static_cast<const byte *>(data);
+            while (len > 0)
+            {
+                ssize_t n = write(fd, p, len);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0)
+                    throw std::system_error(errno, std::generic_category(), "write " + path);
+                p += n;
+                len -= static_cast<size_t>(n);
+            }
+        }
+
+        inline void readAll(int fd, void *data, size_t len, const std::string &path)
+        {
+            byte *p = static_cast<byte *>(data);
+            while (len > 0)
+            {
+                ssize_t n = read(fd, p, len);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    throw std::system_error(n < 0 ? errno : EIO, std::generic_category(), "read " + path);
+                p += n;
+                len -= static_cast<size_t>(n);
+            }
+        }
+
+        ///< index j >= i of the first record equal to record j + 1, count when there is none
+        inline size_t nextEqualPortable(const byte *base, size_t stride, size_t digestSize, size_t i, size_t count)
+        {
+            for (size_t j = i; j + 1 < count; ++j)
+                if (std::memcmp(base + j * stride, base + (j + 1) * stride, digestSize) == 0)
+                    return j;
+            return count;
+        }
+
+#ifdef CRYPTOGRAPHY_X86
+        ///< 16 byte digests, one SSE2 compare per neighbour, each digest loaded once
+        __attribute__((target("sse2"))) inline size_t nextEqual16(const byte *base, size_t stride, size_t i, size_t count)
+        {
+            if (i + 1 >= count)
+                return count;
+
+            __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i *>(base + i * stride));
+            for (size_t j = i; j + 1 < count; ++j)
+            {
+                __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i *>(base + (j + 1) * stride));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi8(previous, current)) == 0xFFFF)
+                    return j;
+                previous = current;
+            }
+            return count;
+        }
+
+        ///< 32 byte digests in one AVX2 register
+        __attribute__((target("avx2"))) inline size_t nextEqual32(const byte *base, size_t stride, size_t i, size_t count)
+        {
+            if (i + 1 >= count)
+                return count;
+
+            __m256i previous = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(base + i * stride));
+            for (size_t j = i; j + 1 < count; ++j)
+            {
+                __m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(base + (j + 1) * stride));
+                if (static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(previous, current))) == 0xFFFFFFFFu)
+                    return j;
+                previous = current;
+            }
+            return count;
+        }
+#endif
+    } // namespace DigestDedupDetail
+
+    /**
+     * @brief
+     *      finds every digest that occurs more than once among a very large
+     *      set of (digest, payload) records.
+     *
+     *      records live in one packed array, no per key allocation. They are
+     *      sorted with a parallel MSD radix sort: a scatter on the top 16
+     *      varying bits of the digest, then 8 bit splits inside each bucket
+     *      down to insertion sorted bins (equal first 8 bytes fall back to a
+     *      full compare).
+     *      A SIMD pass over neighbours then reports the runs of equal digests.
+     *
+     *      when the records outgrow memoryBytes, sorted runs are spilled to
+     *      256 files by first digest byte; duplicates always share a file, so
+     *      each file is sorted and scanned on its own (split again on the next
+     *      byte if it is still too big). No merge pass is needed.
+     *
+     * @code
+     *      Sha256Dedup dedup;
+     *      for (...)
+     *          dedup.add(digest, fileId);
+     *      dedup.findDuplicates([](const Sha256Dedup::Record *group, size_t count) { ... });
+     * @endcode
+     */
+    template <size_t DigestSize>
+    class DigestDedup
+    {
+    public:
+        struct Record
+        {
+            byte digest[DigestSize];
+            uint64_t payload;
+        };
+
+        static_assert(DigestSize >= 8 && DigestSize % 8 == 0, "digests of whole 64 bit words, so records stay packed");
+        static_assert(sizeof(Record) == DigestSize + 8, "records must be packed");
+
+        struct Options
+        {
+            ///< records plus sort scratch held in memory, larger sets spill to disk
+            size_t memoryBytes = size_t(1) << 30;
+
+            ///< where spill files go, $TMPDIR or /tmp when empty
+            std::string spillDirectory;
+
+            ///< sort workers, 0 for one per cpu
+            size_t threads = 0;
+        };
+
+        DigestDedup();
+        explicit DigestDedup(const Options &options);
+
+        DigestDedup(const DigestDedup &) = delete;
+        DigestDedup &operator=(const DigestDedup &) = delete;
+
+        ///< removes any spill files left
+        ~DigestDedup();
+
+        void add(const byte *digest, uint64_t payload);
+
+        ///< @throw std::invalid_argument when digest is not DigestSize bytes
+        void add(const std::vector<byte> &digest, uint64_t payload);
+
+        void add(const Record *records, size_t count);
+
+        ///< records added so far
+        uint64_t size() const
+        {
+            return total;
+        }
+
+        ///< true once records went to disk
+        bool spilled() const
+        {
+            return !spillPath.empty();
+        }
+
+        /**
+         * @brief
+         *      call onGroup(const Record *group, size_t count) for every digest
+         *      added at least twice, with all its records; groups come in
+         *      digest order. Consumes the records, the object is empty after.
+         *
+         * @return number of groups
+         */
+        template <typename OnGroup>
+        uint64_t findDuplicates(OnGroup onGroup);
+
+        ///< sort records by digest (payload order within equal digests is unspecified)
+        static void Sort(Record *records, size_t count, ThreadPool &pool);
+
+        ///< report the runs of equal digests in sorted records, returns their number
+        template <typename OnGroup>
+        static uint64_t Groups(const Record *sorted, size_t count, OnGroup &&onGroup);
+
+    private:
+        static bool less(const Record &a, const Record &b)
+        {
+            return std::memcmp(a.digest, b.digest, DigestSize) < 0;
+        }
+
+        static void insertionSort(Record *records, size_t n);
+
+        ///< sort bucket src[0, n) into dst on the key bits below shift, src is scratch
+        static void sortBucket(Record *src, Record *dst, size_t n, unsigned shift);
+
+        ///< records of one partition in memory at a time
+        size_t capacity() const
+        {
+            return std::max<size_t>(1024, options.memoryBytes / (2 * sizeof(Record)));
+        }
+
+        ///< sort records and append them to the 256 files of dir, split on digest byte depth
+        void distribute(std::vector<Record> &records, const std::string &dir, size_t depth);
+
+        void spill();
+
+        template <typename OnGroup>
+        uint64_t processPartition(const std::string &path, size_t depth, OnGroup &onGroup);
+
+        static void removeTree(const std::string &dir);
+
+        Options options;
+        ThreadPool pool;
+        std::vector<Record> buffer;
+        uint64_t total = 0;
+        std::string spillPath;
+    };
+
+    using Sha256Dedup = DigestDedup<32>;
+    using Md5Dedup = DigestDedup<16>;
+
+    ///< Implementation
+    template <size_t DigestSize>
+    DigestDedup<DigestSize>::DigestDedup() : DigestDedup(Options())
+    {
+    }
+
+    template <size_t DigestSize>
+    DigestDedup<DigestSize>::DigestDedup(const Options &options) : options(options), pool(options.threads)
+    {
+    }
+
+    template <size_t DigestSize>
+    DigestDedup<DigestSize>::~DigestDedup()
+    {
+        if (!spillPath.empty())
+            removeTree(spillPath);
+    }
+
+    template <size_t DigestSize>
+    void DigestDedup<DigestSize>::add(const byte *digest, uint64_t payload)
+    {
+        Record record;
+        std::memcpy(record.digest, digest, DigestSize);
+        record.payload = payload;
+
+        if (buffer.size() >= capacity())
+            spill();
+        buffer.push_back(record);
+        ++total;
+    }
+
+    template <size_t DigestSize>
+    void DigestDedup<DigestSize>::add(const std::vector<byte> &digest, uint64_t payload)
+    {
+        if (digest.size() != DigestSize)
+            throw std::invalid_argument("digest of the wrong size");
+        add(digest.data(), payload);
+    }
+
+    template <size_t DigestSize>
+    void DigestDedup<DigestSize>::add(const Record *records, size_t count)
+    {
+        while (count > 0)
+        {
+            if (buffer.size() >= capacity())
+                spill();
+
+            size_t take = std::min(count, capacity() - buffer.size());
+            buffer.insert(buffer.end(), records, records + take);
+            records += take;
+            count -= take;
+            total += take;
+        }
+    }
+
+    template <size_t DigestSize>
+    void DigestDedup<DigestSize>::insertionSort(Record *records, size_t n)
+    {
+        for (size_t i = 1; i < n; ++i)
+        {
+            Record record = records[i];
+            size_t j = i;
+            for (; j > 0 && less(record, records[j - 1]); --j)
+                records[j] = records[j - 1];
+            records[j] = record;
+        }
+    }
+
+    template <size_t DigestSize>
+    void DigestDedup<DigestSize>::sortBucket(Record *src, Record *dst, size_t n, unsigned shift)
+    {
+        using DigestDedupDetail::prefix;
+
+        if (n <= DigestDedupDetail::SmallBucket)
+        {
+            std::copy(src, src + n, dst);
+            insertionSort(dst, n);
+            return;
+        }
+
+        ///< the first 8 bytes are equal: duplicates, or (rarely) digests differing later
+        if (shift == 0)
+        {
+            std::copy(src, src + n, dst);
+            std::sort(dst, dst + n, less);
+            return;
+        }
+
+        ///< next 8 key bits below the ones already split on
+        const unsigned position = shift > 8 ? shift - 8 : 0;
+        const uint64_t mask = (uint64_t(1) << (shift - position)) - 1;
+
+        size_t counts[256] = {};
+        for (size_t i = 0; i < n; ++i)
+            ++counts[(prefix(src[i].digest) >> position) & mask];
+
+        size_t starts[257];
+        starts[0] = 0;
+        for (size_t d = 0; d < 256; ++d)
+            starts[d + 1] = starts[d] + counts[d];
+
+        size_t next[256];
+        std::copy(starts, starts + 256, next);
+        for (size_t i = 0; i < n; ++i)
+            dst[next[(prefix(src[i].digest) >> position) & mask]++] = src[i];
+
+        for (size_t d = 0; d < 256; ++d)
+        {
+            const size_t count = counts[d];
+            if (count <= 1)
+                continue;
+
+            Record *bin = dst + starts[d];
+            if (count <= DigestDedupDetail::SmallBucket)
+                insertionSort(bin, count);
+            else
+            {
+                sortBucket(bin, src + starts[d], count, position);
+                std::copy(src + starts[d], src + starts[d] + count, bin);
+            }
+        }
+    }
+
+    template <size_t DigestSize>
+    void DigestDedup<DigestSize>::Sort(Record *records, size_t count, ThreadPool &pool)
+    {
+        using DigestDedupDetail::MsdBuckets;
+        using DigestDedupDetail::prefix;
+
+        if (count < 2)
+            return;
+
+        ///< a few chunks per worker, each with its own histogram
+        const size_t chunks = std::min<size_t>(std::max<size_t>(1, 4 * pool.size()), (count + 4095) / 4096);
+        const size_t chunkSize = (count + chunks - 1) / chunks;
+        auto chunkRange = [&](size_t c) {
+            size_t begin = std::min(count, c * chunkSize);
+            return std::make_pair(begin, std::min(count, begin + chunkSize));
+        };
+
+        ///< split on the top MsdBits of the key bits that actually vary
+        const uint64_t first = prefix(records[0].digest);
+        std::vector<std::future<uint64_t>> varying;
+        for (size_t c = 0; c < chunks; ++c)
+        {
+            varying.push_back(pool.submit([&, c] {
+                uint64_t bits = 0;
+                auto range = chunkRange(c);
+                for (size_t i = range.first; i < range.second; ++i)
+                    bits |= prefix(records[i].digest) ^ first;
+                return bits;
+            }));
+        }
+        uint64_t bits = 0;
+        for (std::future<uint64_t> &part : varying)
+            bits |= pool.wait(part);
+
+        if (bits == 0)
+        {
+            std::sort(records, records + count, less);
+            return;
+        }
+
+        const unsigned top = 64 - static_cast<unsigned>(__builtin_clzll(bits));
+        const unsigned shift = top > DigestDedupDetail::MsdBits ? top - DigestDedupDetail::MsdBits : 0;
+        auto digit = [shift](const Record &record) { return static_cast<size_t>((prefix(record.digest) >> shift) & (MsdBuckets - 1)); };
+
+        std::vector<std::vector<size_t>> offsets(chunks, std::vector<size_t>(MsdBuckets));
+        std::vector<std::future<void>> work;
+        for (size_t c = 0; c < chunks; ++c)
+        {
+            work.push_back(pool.submit([&, c] {
+                std::vector<size_t> &histogram = offsets[c];
+                auto range = chunkRange(c);
+                for (size_t i = range.first; i < range.second; ++i)
+                    ++histogram[digit(records[i])];
+            }));
+        }
+        for (std::future<void> &done : work)
+            pool.wait(done);
+        work.clear();
+
+        ///< bucket b of chunk c starts after bucket b of chunks before c
+        std::vector<size_t> bucketStart(MsdBuckets + 1);
+        size_t offset = 0;
+        for (size_t b = 0; b < MsdBuckets; ++b)
+        {
+            bucketStart[b] = offset;
+            for (size_t c = 0; c < chunks; ++c)
+            {
+                size_t n = offsets[c][b];
+                offsets[c][b] = offset;
+                offset += n;
+            }
+        }
+        bucketStart[MsdBuckets] = count;
+
+        ///< left uninitialized, the scatter writes every slot
+        std::unique_ptr<Record[]> scratch(new Record[count]);
+        for (size_t c = 0; c < chunks; ++c)
+        {
+            work.push_back(pool.submit([&, c] {
+                std::vector<size_t> &next = offsets[c];
+                auto range = chunkRange(c);
+                for (size_t i = range.first; i < range.second; ++i)
+                    scratch[next[digit(records[i])]++] = records[i];
+            }));
+        }
+        for (std::future<void> &done : work)
+            pool.wait(done);
+        work.clear();
+
+        ///< buckets back into records, in runs of about equal record counts
+        const size_t perTask = std::max<size_t>(count / (4 * pool.size() + 1), 1);
+        for (size_t b = 0; b < MsdBuckets;)
+        {
+            size_t end = b;
+            while (end < MsdBuckets && bucketStart[end + 1] - bucketStart[b] < perTask)
+                ++end;
+            end = std::max(end, b + 1);
+
+            work.push_back(pool.submit([&, b, end] {
+                for (size_t i = b; i < end; ++i)
+                {
+                    size_t start = bucketStart[i];
+                    sortBucket(scratch.get() + start, records + start, bucketStart[i + 1] - start, shift);
+                }
+            }));
+            b = end;
+        }
+        for (std::future<void> &done : work)
+            pool.wait(done);
+    }
+
+    template <size_t DigestSize>
+    template <typename OnGroup>
+    uint64_t DigestDedup<DigestSize>::Groups(const Record *sorted, size_t count, OnGroup &&onGroup)
+    {
+        if (count < 2)
+            return 0;
+
+        const byte *base = sorted[0].digest;
+        auto nextEqual = [&](size_t i) -> size_t {
+#ifdef CRYPTOGRAPHY_X86
+            if (DigestSize == 16)
+                return DigestDedupDetail::nextEqual16(base, sizeof(Record), i, count);
+            if (DigestSize == 32 && CpuFeatures::get().avx2)
+                return DigestDedupDetail::nextEqual32(base, sizeof(Record), i, count);
+#endif
+            return DigestDedupDetail::nextEqualPortable(base, sizeof(Record), DigestSize, i, count);
+        };
+
+        uint64_t groups = 0;
+        for (size_t i = 0; i + 1 < count;)
+        {
+            size_t start = nextEqual(i);
+            if (start >= count)
+                break;
+
+            size_t end = start + 2;
+            while (end < count && std::memcmp(sorted[end].digest, sorted[start].digest, DigestSize) == 0)
+                ++end;
+
+            onGroup(sorted + start, end - start);
+            ++groups;
+            i = end;
+        }
+        return groups;
+    }
+
+    template <size_t DigestSize>
+    void DigestDedup<DigestSize>::distribute(std::vector<Record> &records, const std::string &dir, size_t depth)
+    {
+        Sort(records.data(), records.size(), pool);
+
+        char name[8];
+        for (size_t i = 0; i < records.size();)
+        {
+            const byte partition = records[i].digest[depth];
+            size_t j = i;
+            while (j < records.size() && records[j].digest[depth] == partition)
+                ++j;
+
+            std::snprintf(name, sizeof(name), "/p%02x", partition);
+            std::string path = dir + name;
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+            if (fd < 0)
+                throw std::system_error(errno, std::generic_category(), "open " + path);
+            try
+            {
+                DigestDedupDetail::writeAll(fd, records.data() + i, (j - i) * sizeof(Record), path);
+            }
+            catch (...)
+            {
+                close(fd);
+                throw;
+            }
+            close(fd);
+            i = j;
+        }
+        records.clear();
+    }
+
+    template <size_t DigestSize>
+    void DigestDedup<DigestSize>::spill()
+    {
+        if (spillPath.empty())
+        {
+            std::string dir = options.spillDirectory;
+            if (dir.empty())
+            {
+                const char *tmp = std::getenv("TMPDIR");
+                dir = tmp != nullptr && *tmp != '\0' ? tmp : "/tmp";
+            }
+
+            std::string pattern = dir + "/digest-dedup-XXXXXX";
+            if (mkdtemp(&pattern[0]) == nullptr)
+                throw std::system_error(errno, std::generic_category(), "mkdtemp " + pattern);
+            spillPath = pattern;
+        }
+
+        distribute(buffer, spillPath, 0);
+    }
+
+    template <size_t DigestSize>
+    template <typename OnGroup>
+    uint64_t DigestDedup<DigestSize>::processPartition(const std::string &path, size_t depth, OnGroup &onGroup)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == ENOENT)
+                return 0;
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            int err = errno;
+            close(fd);
+            throw std::system_error(err, std::generic_category(), "stat " + path);
+        }
+
+        const size_t count = static_cast<size_t>(st.st_size) / sizeof(Record);
+        uint64_t groups = 0;
+        std::vector<Record> records;
+
+        try
+        {
+            ///< fits, or every record has the same digest and cannot be split further
+            if (count <= capacity() || depth >= DigestSize)
+            {
+                records.resize(count);
+                DigestDedupDetail::readAll(fd, records.data(), count * sizeof(Record), path);
+                close(fd);
+                fd = -1;
+                unlink(path.c_str());
+
+                Sort(records.data(), records.size(), pool);
+                return Groups(records.data(), records.size(), onGroup);
+            }
+
+            ///< still too big: split on the next digest byte, a chunk at a time
+            const std::string dir = path + ".d";
+            if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+                throw std::system_error(errno, std::generic_category(), "mkdir " + dir);
+
+            for (size_t done = 0; done < count;)
+            {
+                size_t take = std::min(capacity(), count - done);
+                records.resize(take);
+                DigestDedupDetail::readAll(fd, records.data(), take * sizeof(Record), path);
+                distribute(records, dir, depth);
+                done += take;
+            }
+            close(fd);
+            fd = -1;
+            unlink(path.c_str());
+            std::vector<Record>().swap(records);
+
+            char name[8];
+            for (size_t p = 0; p < DigestDedupDetail::Partitions; ++p)
+            {
+                std::snprintf(name, sizeof(name), "/p%02zx", p);
+                groups += processPartition(dir + name, depth + 1, onGroup);
+            }
+            rmdir(dir.c_str());
+        }
+        catch (...)
+        {
+            if (fd >= 0)
+                close(fd);
+            throw;
+        }
+        return groups;
+    }
+
+    template <size_t DigestSize>
+    template <typename OnGroup>
+    uint64_t DigestDedup<DigestSize>::findDuplicates(OnGroup onGroup)
+    {
+        uint64_t groups = 0;
+
+        if (spillPath.empty())
+        {
+            Sort(buffer.data(), buffer.size(), pool);
+            groups = Groups(buffer.data(), buffer.size(), onGroup);
+        }
+        else
+        {
+            if (!buffer.empty())
+                distribute(buffer, spillPath, 0);
+            std::vector<Record>().swap(buffer);
+
+            char name[8];
+            for (size_t p = 0; p < DigestDedupDetail::Partitions; ++p)
+            {
+                std::snprintf(name, sizeof(name), "/p%02zx", p);
+                groups += processPartition(spillPath + name, 1, onGroup);
+            }
+            removeTree(spillPath);
+            spillPath.clear();
+        }
+
+        std::vector<Record>().swap(buffer);
+        total = 0;
+        return groups;
+    }
+
+    template <size_t DigestSize>
+    void DigestDedup<DigestSize>::removeTree(const std::string &dir)
+    {
+        DIR *handle = opendir(dir.c_str());
+        if (handle != nullptr)
+        {
+            while (dirent *entry = readdir(handle))
+            {
+                std::string name = entry->d_name;
+                if (name == "." || name == "..")
+                    continue;
+
+                std::string path = dir + "/" + name;
+                struct stat st;
+                if (lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+                    removeTree(path);
+                else
+                    unlink(path.c_str());
+            }
+            closedir(handle);
+        }
+        rmdir(dir.c_str());
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_DIGEST_DEDUP_HPP */
@@ -0,0 +1,566 @@
+#ifndef CRYPTOGRAPHY_DIGEST_INDEX_HPP
+#define CRYPTOGRAPHY_DIGEST_INDEX_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cpu_features.hpp"
+
+#ifdef CRYPTOGRAPHY_X86
+#include <immintrin.h>
+#endif
+
+typedef unsigned char byte;
+
+namespace Crypto
+{
+    namespace DigestIndexDetail
+    {
+        constexpr char Magic[8] = {'C', 'R', 'Y', 'D', 'I', 'G', 'X', '1'};
+        constexpr uint32_t Version = 1;
+
+        ///< slots per bucket, the 32 bit tags of a bucket fill one cache line
+        constexpr size_t SlotsPerBucket = 16;
+        constexpr size_t BloomBlockBytes = 64;
+        constexpr size_t BloomBitsPerKey = 10;
+        constexpr size_t BloomHashes = 7;
+        constexpr size_t MaxLoadPercent = 75;
+
+        ///< on-disk header, little endian, followed by the bloom filter,
+        ///< the tag lines and the keys, each section 64 byte aligned
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t keySize;
+            uint64_t entries;
+            uint64_t bucketCount;
+            uint64_t bloomBlocks;
+            uint64_t seed;
+            uint64_t bloomOffset;
+            uint64_t tagOffset;
+            uint64_t keyOffset;
+            uint64_t fileSize;
+        };
+
+        struct KeyHash
+        {
+            uint64_t bucket;
+            uint64_t bloomBlock;
+            uint64_t bloomBits;
+            uint32_t tag;
+        };
+
+        inline uint64_t load64(const byte *p)
+        {
+            uint64_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        inline uint64_t mix(uint64_t x)
+        {
+            x ^= x >> 33;
+            x *= 0xFF51AFD7ED558CCDULL;
+            x ^= x >> 33;
+            x *= 0xC4CEB9FE1A85EC53ULL;
+            x ^= x >> 33;
+            return x;
+        }
+
+        inline KeyHash hashKey(const byte *key, size_t keySize, uint64_t seed, uint64_t bucketMask, uint64_t bloomMask)
+        {
+            uint64_t lo = load64(key);
+            uint64_t hi = load64(key + 8);
+            if (keySize == 32)
+            {
+                lo ^= load64(key + 16);
+                hi ^= load64(key + 24);
+            }
+
+            uint64_t h1 = mix(lo ^ seed);
+            uint64_t h2 = mix(hi ^ ((h1 << 29) | (h1 >> 35)) ^ (seed * 0x9E3779B97F4A7C15ULL));
+
+            KeyHash h;
+            h.bucket = h1 & bucketMask;
+            h.bloomBits = h1;
+            h.bloomBlock = (h2 >> 32) & bloomMask;
+
+            ///< tag 0 marks an empty slot
+            h.tag = static_cast<uint32_t>(h2);
+            if (h.tag == 0)
+                h.tag = 1;
+
+            return h;
+        }
+
+        inline uint64_t nextPowerOf2(uint64_t x)
+        {
+            uint64_t p = 1;
+            while (p < x)
+                p <<= 1;
+            return p;
+        }
+
+        inline uint64_t align64(uint64_t x)
+        {
+            return (x + 63) & ~uint64_t(63);
+        }
+
+        ///< section offsets of an index with these sizes, false when they overflow 64 bits
+        inline bool layout(uint64_t keySize, uint64_t bucketCount, uint64_t bloomBlocks, Header &header)
+        {
+            uint64_t bloomBytes, slots, tagBytes, keyBytes, end;
+            if (__builtin_mul_overflow(bloomBlocks, uint64_t(BloomBlockBytes), &bloomBytes) ||
+                __builtin_mul_overflow(bucketCount, uint64_t(SlotsPerBucket), &slots) ||
+                __builtin_mul_overflow(slots, uint64_t(sizeof(uint32_t)), &tagBytes) ||
+                __builtin_mul_overflow(slots, keySize, &keyBytes))
+                return false;
+
+            header.bloomOffset = align64(sizeof(Header));
+            if (__builtin_add_overflow(header.bloomOffset, bloomBytes, &end) || end > UINT64_MAX - 63)
+                return false;
+            header.tagOffset = align64(end);
+            if (__builtin_add_overflow(header.tagOffset, tagBytes, &end) || end > UINT64_MAX - 63)
+                return false;
+            header.keyOffset = align64(end);
+            return !__builtin_add_overflow(header.keyOffset, keyBytes, &header.fileSize);
+        }
+
+        ///< bit i of the bloom block is set for each of the 9 bit groups of bloomBits
+        inline bool bloomTest(const byte *block, uint64_t bits)
+        {
+            for (size_t i = 0; i < BloomHashes; ++i, bits >>= 9)
+            {
+                unsigned pos = static_cast<unsigned>(bits & 511);
+                if ((block[pos >> 3] & (1u << (pos & 7))) == 0)
+                    return false;
+            }
+            return true;
+        }
+
+        inline void bloomSet(byte *block, uint64_t bits)
+        {
+            for (size_t i = 0; i < BloomHashes; ++i, bits >>= 9)
+            {
+                unsigned pos = static_cast<unsigned>(bits & 511);
+                block[pos >> 3] |= static_cast<byte>(1u << (pos & 7));
+            }
+        }
+
+        /**
+         * @brief
+         *      compare a tag against the 16 tags of a bucket
+         *
+         * @return bitmask of matching slots, bit 16 set when the bucket has an empty slot
+         */
+        inline uint32_t matchTagsPortable(const uint32_t *tags, uint32_t tag)
+        {
+            uint32_t mask = 0;
+            for (size_t i = 0; i < SlotsPerBucket; ++i)
+            {
+                if (tags[i] == tag)
+                    mask |= 1u << i;
+                if (tags[i] == 0)
+                    mask |= 1u << 16;
+            }
+            return mask;
+        }
+
+#ifdef CRYPTOGRAPHY_X86
+        __attribute__((target("avx2"))) inline uint32_t matchTagsAvx2(const uint32_t *tags, uint32_t tag)
+        {
+            const __m256i *line = reinterpret_cast<const __m256i *>(tags);
+            __m256i lo = _mm256_load_si256(line);
+            __m256i hi = _mm256_load_si256(line + 1);
+            __m256i needle = _mm256_set1_epi32(static_cast<int>(tag));
+            __m256i zero = _mm256_setzero_si256();
+
+            uint32_t match = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(lo, needle)))) |
+                             (static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(hi, needle)))) << 8);
+            uint32_t empty = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(lo, zero)))) |
+                             static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(hi, zero))));
+
+            return match | (empty != 0 ? 1u << 16 : 0);
+        }
+
+        __attribute__((target("avx512f"))) inline uint32_t matchTagsAvx512(const uint32_t *tags, uint32_t tag)
+        {
+            __m512i line = _mm512_load_si512(tags);
+            uint32_t match = _mm512_cmpeq_epi32_mask(line, _mm512_set1_epi32(static_cast<int>(tag)));
+            uint32_t empty = _mm512_cmpeq_epi32_mask(line, _mm512_setzero_si512());
+
+            return match | (empty != 0 ? 1u << 16 : 0);
+        }
+#endif
+
+    } // namespace DigestIndexDetail
+
+    /**
+     * @brief
+     *      builds a DigestIndex file offline from a set of fixed size digests
+     */
+    class DigestIndexBuilder
+    {
+    public:
+        /**
+         * @brief Construct a new Digest Index Builder object
+         *
+         * @param keySize
+         *      16 (MD5) or 32 (SHA-256)
+         */
+        explicit DigestIndexBuilder(size_t keySize);
+
+        /**
+         * @brief
+         *      queue a digest of keySize bytes, duplicates are dropped at write time
+         */
+        void add(const byte *key);
+
+        /**
+         * @brief
+         *      lay out the table and write it to path
+         *
+         * @throw std::system_error on I/O errors
+         */
+        void write(const std::string &path, uint64_t seed = 0x5EEDC0DEULL) const;
+
+    private:
+        size_t keySize;
+        std::vector<byte> keys;
+    };
+
+    /**
+     * @brief
+     *      immutable, memory mapped set of known digests.
+     *
+     *      a blocked bloom filter rejects most misses in one cache line, hits
+     *      are located by comparing the 16 tags of a bucket line with SIMD
+     *      and confirmed against the full key.
+     */
+    class DigestIndex
+    {
+    public:
+        /**
+         * @brief
+         *      map an index file, no data is read up front
+         *
+         * @throw std::system_error when the file cannot be mapped,
+         *        std::runtime_error when it is not a valid index
+         */
+        explicit DigestIndex(const std::string &path);
+
+        DigestIndex(const DigestIndex &) = delete;
+        DigestIndex &operator=(const DigestIndex &) = delete;
+
+        ~DigestIndex();
+
+        /**
+         * @brief
+         *      check a digest of keySize() bytes
+         */
+        bool contains(const byte *key) const;
+
+        /**
+         * @brief
+         *      check count consecutive digests, prefetching bloom blocks and
+         *      buckets of a group of keys before probing any of them
+         *
+         * @return number of digests found
+         */
+        size_t containsBatch(const byte *keys, size_t count, bool *results) const;
+
+        size_t keySize() const
+        {
+            return header->keySize;
+        }
+
+        uint64_t size() const
+        {
+            return header->entries;
+        }
+
+    private:
+        DigestIndexDetail::KeyHash hash(const byte *key) const;
+        bool probe(const byte *key, const DigestIndexDetail::KeyHash &h) const;
+        uint32_t matchTags(const uint32_t *tags, uint32_t tag) const;
+
+        const byte *map = nullptr;
+        size_t mapSize = 0;
+        const DigestIndexDetail::Header *header = nullptr;
+        const byte *bloom = nullptr;
+        const uint32_t *tags = nullptr;
+        const byte *keyData = nullptr;
+        uint64_t bucketMask = 0;
+        uint64_t bloomMask = 0;
+        int simdLevel = 0;
+    };
+
+    ///< Implementation
+    inline DigestIndexBuilder::DigestIndexBuilder(size_t keySize) : keySize(keySize)
+    {
+        if (keySize != 16 && keySize != 32)
+            throw std::invalid_argument("DigestIndex keys are 16 or 32 bytes");
+    }
+
+    inline void DigestIndexBuilder::add(const byte *key)
+    {
+        keys.insert(keys.end(), key, key + keySize);
+    }
+
+    inline void DigestIndexBuilder::write(const std::string &path, uint64_t seed) const
+    {
+        using namespace DigestIndexDetail;
+
+        const uint64_t count = keys.size() / keySize;
+        const uint64_t minBuckets = (count * 100 / MaxLoadPercent + SlotsPerBucket - 1) / SlotsPerBucket;
+        const uint64_t bucketCount = nextPowerOf2(minBuckets + 1);
+        const uint64_t bloomBlocks = nextPowerOf2((count * BloomBitsPerKey + 511) / 512 + 1);
+
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, Magic, sizeof(Magic));
+        header.version = Version;
+        header.keySize = static_cast<uint32_t>(keySize);
+        header.bucketCount = bucketCount;
+        header.bloomBlocks = bloomBlocks;
+        header.seed = seed;
+        if (!layout(keySize, bucketCount, bloomBlocks, header))
+            throw std::length_error("DigestIndex too large");
+
+        std::vector<byte> bloom(bloomBlocks * BloomBlockBytes, 0);
+        std::vector<uint32_t> tags(bucketCount * SlotsPerBucket, 0);
+        std::vector<byte> slots(bucketCount * SlotsPerBucket * keySize, 0);
+        uint64_t entries = 0;
+
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            const byte *key = keys.data() + i * keySize;
+            KeyHash h = hashKey(key, keySize, seed, bucketCount - 1, bloomBlocks - 1);
+
+            ///< linear probing over buckets, stop at a duplicate or the first free slot
+            bool placed = false;
+            for (uint64_t b = h.bucket; !placed; b = (b + 1) & (bucketCount - 1))
+            {
+                for (size_t s = 0; s < SlotsPerBucket; ++s)
+                {
+                    uint64_t slot = b * SlotsPerBucket + s;
+                    if (tags[slot] == 0)
+                    {
+                        tags[slot] = h.tag;
+                        std::memcpy(slots.data() + slot * keySize, key, keySize);
+                        bloomSet(bloom.data() + h.bloomBlock * BloomBlockBytes, h.bloomBits);
+                        entries += 1;
+                        placed = true;
+                        break;
+                    }
+                    if (tags[slot] == h.tag && std::memcmp(slots.data() + slot * keySize, key, keySize) == 0)
+                    {
+                        placed = true;
+                        break;
+                    }
+                }
+            }
+        }
+        header.entries = entries;
+
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+
+        auto put = [&](const void *data, size_t len, uint64_t offset) {
+            const byte *p = static_cast<const byte *>(data);
+            while (len > 0)
+            {
+                ssize_t n = pwrite(fd, p, len, static_cast<off_t>(offset));
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0)
+                {
+                    int err = errno;
+                    close(fd);
+                    throw std::system_error(err, std::generic_category(), "write " + path);
+                }
+                p += n;
+                len -= static_cast<size_t>(n);
+                offset += static_cast<uint64_t>(n);
+            }
+        };
+
+        put(&header, sizeof(header), 0);
+        put(bloom.data(), bloom.size(), header.bloomOffset);
+        put(tags.data(), tags.size() * sizeof(uint32_t), header.tagOffset);
+        put(slots.data(), slots.size(), header.keyOffset);
+
+        if (close(fd) != 0)
+            throw std::system_error(errno, std::generic_category(), "close " + path);
+    }
+
+    inline DigestIndex::DigestIndex(const std::string &path)
+    {
+        using namespace DigestIndexDetail;
+
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            int err = errno;
+            close(fd);
+            throw std::system_error(err, std::generic_category(), "stat " + path);
+        }
+
+        mapSize = static_cast<size_t>(st.st_size);
+        if (mapSize < sizeof(Header))
+        {
+            close(fd);
+            throw std::runtime_error("not a digest index: " + path);
+        }
+
+        void *p = mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+        int err = errno;
+        close(fd);
+        if (p == MAP_FAILED)
+            throw std::system_error(err, std::generic_category(), "mmap " + path);
+
+        ///< lookups are random, do not read ahead around each probe
+        madvise(p, mapSize, MADV_RANDOM);
+
+        map = static_cast<const byte *>(p);
+        header = reinterpret_cast<const Header *>(map);
+
+        ///< every section offset must be the one write() would have computed for these sizes
+        Header expected;
+        bool valid = std::memcmp(header->magic, Magic, sizeof(Magic)) == 0 && header->version == Version &&
+                     (header->keySize == 16 || header->keySize == 32) && header->fileSize == mapSize &&
+                     header->bucketCount != 0 && (header->bucketCount & (header->bucketCount - 1)) == 0 &&
+                     header->bloomBlocks != 0 && (header->bloomBlocks & (header->bloomBlocks - 1)) == 0 &&
+                     layout(header->keySize, header->bucketCount, header->bloomBlocks, expected) &&
+                     expected.bloomOffset == header->bloomOffset && expected.tagOffset == header->tagOffset &&
+                     expected.keyOffset == header->keyOffset && expected.fileSize == header->fileSize;
+        if (!valid)
+        {
+            munmap(const_cast<byte *>(map), mapSize);
+            throw std::runtime_error("not a digest index: " + path);
+        }
+
+        bloom = map + header->bloomOffset;
+        tags = reinterpret_cast<const uint32_t *>(map + header->tagOffset);
+        keyData = map + header->keyOffset;
+        bucketMask = header->bucketCount - 1;
+        bloomMask = header->bloomBlocks - 1;
+
+#ifdef CRYPTOGRAPHY_X86
+        const CpuFeatures &cpu = CpuFeatures::get();
+        simdLevel = cpu.avx512f ? 2 : cpu.avx2 ? 1 : 0;
+#endif
+    }
+
+    inline DigestIndex::~DigestIndex()
+    {
+        if (map != nullptr)
+            munmap(const_cast<byte *>(map), mapSize);
+    }
+
+    inline DigestIndexDetail::KeyHash DigestIndex::hash(const byte *key) const
+    {
+        return DigestIndexDetail::hashKey(key, header->keySize, header->seed, bucketMask, bloomMask);
+    }
+
+    inline uint32_t DigestIndex::matchTags(const uint32_t *line, uint32_t tag) const
+    {
+#ifdef CRYPTOGRAPHY_X86
+        if (simdLevel == 2)
+            return DigestIndexDetail::matchTagsAvx512(line, tag);
+        if (simdLevel == 1)
+            return DigestIndexDetail::matchTagsAvx2(line, tag);
+#endif
+        return DigestIndexDetail::matchTagsPortable(line, tag);
+    }
+
+    inline bool DigestIndex::probe(const byte *key, const DigestIndexDetail::KeyHash &h) const
+    {
+        using namespace DigestIndexDetail;
+
+        const size_t ks = header->keySize;
+        ///< a full table has no empty slot to end the chain, stop after one lap
+        uint64_t b = h.bucket;
+        for (uint64_t visited = 0; visited <= bucketMask; ++visited, b = (b + 1) & bucketMask)
+        {
+            uint32_t mask = matchTags(tags + b * SlotsPerBucket, h.tag);
+
+            for (uint32_t m = mask & 0xFFFF; m != 0; m &= m - 1)
+            {
+                uint64_t slot = b * SlotsPerBucket + static_cast<uint64_t>(__builtin_ctz(m));
+                if (std::memcmp(keyData + slot * ks, key, ks) == 0)
+                    return true;
+            }
+
+            ///< the builder fills buckets in order, an empty slot ends the chain
+            if (mask & (1u << 16))
+                return false;
+        }
+        return false;
+    }
+
+    inline bool DigestIndex::contains(const byte *key) const
+    {
+        DigestIndexDetail::KeyHash h = hash(key);
+        if (!DigestIndexDetail::bloomTest(bloom + h.bloomBlock * DigestIndexDetail::BloomBlockBytes, h.bloomBits))
+            return false;
+        return probe(key, h);
+    }
+
+    inline size_t DigestIndex::containsBatch(const byte *keys, size_t count, bool *results) const
+    {
+        using namespace DigestIndexDetail;
+
+        constexpr size_t Group = 16;
+        const size_t ks = header->keySize;
+        size_t found = 0;
+        KeyHash h[Group];
+        bool pass[Group];
+
+        for (size_t base = 0; base < count; base += Group)
+        {
+            const size_t n = count - base < Group ? count - base : Group;
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                h[i] = hash(keys + (base + i) * ks);
+                __builtin_prefetch(bloom + h[i].bloomBlock * BloomBlockBytes);
+            }
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                pass[i] = bloomTest(bloom + h[i].bloomBlock * BloomBlockBytes, h[i].bloomBits);
+                if (pass[i])
+                    __builtin_prefetch(tags + h[i].bucket * SlotsPerBucket);
+            }
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                bool hit = pass[i] && probe(keys + (base + i) * ks, h[i]);
+                results[base + i] = hit;
+                found += hit;
+            }
+        }
+
+        return found;
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_DIGEST_INDEX_HPP */
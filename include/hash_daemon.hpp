@@ -0,0 +1,1051 @@
+#ifndef CRYPTOGRAPHY_HASH_DAEMON_HPP
+#define CRYPTOGRAPHY_HASH_DAEMON_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "hash_dispatch.hpp"
+#include "thread_pool.hpp"
+
+namespace Crypto
+{
+    namespace HashDaemonDetail
+    {
+        constexpr uint32_t Magic = 0x44485343; ///< "CSHD"
+
+        enum class Op : uint16_t
+        {
+            Hash = 1,
+            Stats = 2
+        };
+
+        ///< one SOCK_SEQPACKET message, a Hash request carries the memfd in SCM_RIGHTS
+        struct Request
+        {
+            uint32_t magic;
+            uint16_t op;
+            uint16_t function; ///< HashDispatch::Function::Sha256 or Md5
+            uint64_t id;
+            uint64_t offset;
+            uint64_t length;
+        };
+
+        ///< answer to the request with the same id, a Stats reply is followed by its text
+        struct Reply
+        {
+            uint32_t magic;
+            int32_t error; ///< errno value, 0 on success
+            uint64_t id;
+            byte digest[32];
+        };
+
+        ///< largest message, a Reply plus the stats text
+        constexpr size_t MaxMessage = 64 * 1024;
+
+        ///< replies held for a client that is not reading them, past this it is dropped
+        constexpr size_t MaxUnsent = 1024;
+
+        inline size_t DigestSize(HashDispatch::Function function)
+        {
+            return function == HashDispatch::Function::Md5 ? 16 : 32;
+        }
+
+        inline sockaddr_un Address(const std::string &path)
+        {
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(address.sun_path))
+                throw std::system_error(ENAMETOOLONG, std::generic_category(), path);
+            std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+            return address;
+        }
+    } // namespace HashDaemonDetail
+
+    /**
+     * @brief
+     *      node local hashing service.
+     *
+     *      short lived processes hand their buffers to one long running
+     *      daemon instead of each paying for cpu detection, kernel tuning and
+     *      cold caches. Clients send sealed memfds over a Unix socket
+     *      (SCM_RIGHTS), the daemon maps them read only and hashes in place.
+     *      Requests drained from all clients in one poll round form a batch:
+     *      small messages of equal length and algorithm go through the multi
+     *      lane kernels together (gathered into one staging buffer), the rest
+     *      are spread over the thread pool.
+     *
+     *      the seals (no write, no shrink) guarantee the data cannot change or
+     *      vanish while mapped; unsealed descriptors are refused with EPERM.
+     *
+     * @code
+     *      HashDaemon daemon;           // HashDaemon::DefaultPath()
+     *      daemon.run();                // until stop()
+     * @endcode
+     */
+    class HashDaemon
+    {
+    public:
+        ///< messages up to this size are batched with others of the same length
+        static constexpr size_t BatchBytes = 4096;
+
+        struct ClientStats
+        {
+            pid_t pid = 0;
+            uid_t uid = 0;
+            uint64_t requests = 0;
+            uint64_t bytes = 0;
+            ///< requests that went through a multi lane batch
+            uint64_t batched = 0;
+            uint64_t errors = 0;
+            ///< time spent hashing this client's data
+            double hashSeconds = 0;
+            double connectedSeconds = 0;
+        };
+
+        /**
+         * @brief
+         *      listen on path, replacing a stale socket file
+         *
+         * @param path
+         * @param threads
+         *      hashing threads, 0 for one per core
+         *
+         * @throw std::system_error when the socket cannot be set up,
+         *      another daemon already answers on path, or path exists and
+         *      is not a socket (ENOTSOCK)
+         */
+        explicit HashDaemon(const std::string &path = DefaultPath(), size_t threads = 0);
+
+        HashDaemon(const HashDaemon &) = delete;
+        HashDaemon &operator=(const HashDaemon &) = delete;
+
+        ///< closes every connection and removes the socket file
+        ~HashDaemon();
+
+        ///< serve clients until stop()
+        void run();
+
+        ///< make run() return; async signal safe
+        void stop();
+
+        ///< connected clients
+        std::vector<ClientStats> stats() const;
+
+        ///< stats() as a table, what a Stats request returns
+        std::string Describe() const;
+
+        /**
+         * @brief
+         *      $CRYPTOGRAPHY_HASHD_SOCKET, else $XDG_RUNTIME_DIR
+         *      /cryptography-hashd.sock, else /tmp/cryptography-hashd-<uid>.sock
+         */
+        static std::string DefaultPath();
+
+    private:
+        struct Client
+        {
+            int fd = -1;
+            bool closed = false;
+            std::chrono::steady_clock::time_point since;
+            ClientStats stats;
+
+            ///< replies the socket had no room for, sent in order on POLLOUT
+            std::deque<std::string> unsent;
+        };
+
+        struct Job
+        {
+            Client *client;
+            HashDaemonDetail::Request request;
+            int fd = -1;
+            const byte *data = nullptr;
+            void *map = nullptr;
+            size_t mapLength = 0;
+            double seconds = 0;
+            bool batched = false;
+            HashDaemonDetail::Reply reply;
+        };
+
+        void acceptClients();
+
+        ///< drain every queued request of the client into jobs
+        void receive(Client &client, std::vector<Job> &jobs);
+
+        ///< check the descriptor and map the requested range
+        void prepare(Job &job);
+
+        void process(std::vector<Job> &jobs);
+
+        ///< send a reply without blocking, queueing it behind earlier ones when the socket is full
+        void send(Client &client, const void *message, size_t len);
+
+        ///< send queued replies until the socket is full again
+        void flush(Client &client);
+
+        std::string path;
+        int listener = -1;
+        int wake = -1;
+        ThreadPool pool;
+        std::vector<std::unique_ptr<Client>> clients;
+        mutable std::mutex statsLock;
+    };
+
+    /**
+     * @brief
+     *      connection to a HashDaemon. Calls look like local hashing and
+     *      block until the digest is back; one client per thread.
+     *
+     *      Sha256(data, len) copies data into a fresh memfd once. Writing
+     *      into a Buffer and passing that avoids even this copy.
+     *
+     * @code
+     *      HashClient client;
+     *      HashClient::Buffer buffer(size);
+     *      fill(buffer.data(), size);
+     *      buffer.seal();
+     *      std::vector<byte> digest = client.Hash(HashDispatch::Function::Sha256, buffer);
+     * @endcode
+     */
+    class HashClient
+    {
+    public:
+        using Function = HashDispatch::Function;
+
+        /**
+         * @brief
+         *      shared memory the daemon can map: write through data(), then
+         *      seal() before handing it over. Sealed buffers are read only.
+         */
+        class Buffer
+        {
+        public:
+            explicit Buffer(size_t size);
+
+            Buffer(Buffer &&other) noexcept;
+            Buffer &operator=(Buffer &&other) noexcept;
+            Buffer(const Buffer &) = delete;
+            Buffer &operator=(const Buffer &) = delete;
+            ~Buffer();
+
+            byte *data()
+            {
+                return static_cast<byte *>(map);
+            }
+
+            const byte *data() const
+            {
+                return static_cast<const byte *>(map);
+            }
+
+            size_t size() const
+            {
+                return size_;
+            }
+
+            int fd() const
+            {
+                return fd_;
+            }
+
+            bool sealed() const
+            {
+                return sealed_;
+            }
+
+            ///< forbid any further change of contents or size, data() becomes read only
+            void seal();
+
+        private:
+            int fd_ = -1;
+            void *map = nullptr;
+            size_t size_ = 0;
+            bool sealed_ = false;
+        };
+
+        ///< requests in flight at once in HashMany
+        static constexpr size_t Window = 64;
+
+        /**
+         * @throw std::system_error when no daemon listens on path
+         */
+        explicit HashClient(const std::string &path = HashDaemon::DefaultPath());
+
+        HashClient(const HashClient &) = delete;
+        HashClient &operator=(const HashClient &) = delete;
+        ~HashClient();
+
+        std::vector<byte> Sha256(const byte *data, size_t len);
+        std::vector<byte> Md5(const byte *data, size_t len);
+
+        /**
+         * @brief
+         *      digest of a sealed buffer, or of len bytes from offset
+         *
+         * @throw std::system_error with the daemon's error
+         */
+        std::vector<byte> Hash(Function function, const Buffer &buffer, uint64_t offset = 0, uint64_t len = UINT64_MAX);
+
+        ///< same for any sealed memfd
+        std::vector<byte> Hash(Function function, int fd, uint64_t offset, uint64_t len);
+
+        /**
+         * @brief
+         *      digests of many ranges of one buffer, pipelined so the daemon
+         *      can batch them
+         */
+        std::vector<std::vector<byte>> HashMany(Function function, const Buffer &buffer,
+                                                const std::vector<std::pair<uint64_t, uint64_t>> &ranges);
+
+        ///< the daemon's per client table
+        std::string Stats();
+
+    private:
+        ///< @return the request id
+        uint64_t sendRequest(HashDaemonDetail::Op op, Function function, int fd, uint64_t offset, uint64_t len);
+
+        ///< next reply, text receives a stats payload
+        HashDaemonDetail::Reply receiveReply(std::string *text = nullptr);
+
+        ///< next reply, which must answer request id (EPROTO otherwise)
+        HashDaemonDetail::Reply receiveReply(uint64_t id, std::string *text = nullptr);
+
+        int socket_ = -1;
+        uint64_t nextId = 1;
+    };
+
+    ///< Implementation
+    inline std::string HashDaemon::DefaultPath()
+    {
+        if (const char *path = std::getenv("CRYPTOGRAPHY_HASHD_SOCKET"))
+            return path;
+        if (const char *runtime = std::getenv("XDG_RUNTIME_DIR"))
+            return std::string(runtime) + "/cryptography-hashd.sock";
+        return "/tmp/cryptography-hashd-" + std::to_string(getuid()) + ".sock";
+    }
+
+    inline HashDaemon::HashDaemon(const std::string &path, size_t threads) : path(path), pool(threads)
+    {
+        sockaddr_un address = HashDaemonDetail::Address(path);
+
+        ///< a socket file nobody answers on is left over from a crash
+        int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (probe >= 0)
+        {
+            bool alive = connect(probe, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+            close(probe);
+            if (alive)
+                throw std::system_error(EADDRINUSE, std::generic_category(), "hash daemon already running on " + path);
+
+            ///< never remove anything but a socket, the path may be a typo for a real file
+            struct stat st;
+            if (lstat(path.c_str(), &st) == 0)
+            {
+                if (!S_ISSOCK(st.st_mode))
+                    throw std::system_error(ENOTSOCK, std::generic_category(), "not a socket: " + path);
+                unlink(path.c_str());
+            }
+        }
+
+        listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (listener < 0)
+            throw std::system_error(errno, std::generic_category(), "socket");
+
+        if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || ::listen(listener, 128) != 0 ||
+            (wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+        {
+            int err = errno;
+            close(listener);
+            throw std::system_error(err, std::generic_category(), "listen " + path);
+        }
+
+        ///< tune or load the kernel table now, not on the first request
+        HashDispatch::get();
+    }
+
+    inline HashDaemon::~HashDaemon()
+    {
+        for (std::unique_ptr<Client> &client : clients)
+            close(client->fd);
+        close(listener);
+        close(wake);
+        unlink(path.c_str());
+    }
+
+    inline void HashDaemon::stop()
+    {
+        uint64_t one = 1;
+        ssize_t ignored = write(wake, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    inline void HashDaemon::acceptClients()
+    {
+        for (;;)
+        {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                return;
+            }
+
+            std::unique_ptr<Client> client(new Client);
+            client->fd = fd;
+            client->since = std::chrono::steady_clock::now();
+
+            ucred credentials = {};
+            socklen_t length = sizeof(credentials);
+            if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0)
+            {
+                client->stats.pid = credentials.pid;
+                client->stats.uid = credentials.uid;
+            }
+
+            std::lock_guard<std::mutex> lock(statsLock);
+            clients.push_back(std::move(client));
+        }
+    }
+
+    inline void HashDaemon::receive(Client &client, std::vector<Job> &jobs)
+    {
+        using namespace HashDaemonDetail;
+
+        for (;;)
+        {
+            Job job;
+            job.client = &client;
+
+            alignas(cmsghdr) char control[CMSG_SPACE(4 * sizeof(int))];
+            iovec iov = {&job.request, sizeof(job.request)};
+            msghdr message = {};
+            message.msg_iov = &iov;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+
+            ssize_t n = recvmsg(client.fd, &message, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            if (n <= 0)
+            {
+                client.closed = true;
+                return;
+            }
+
+            ///< keep the first descriptor, a well behaved client never sends more
+            for (cmsghdr *header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header))
+            {
+                if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+                    continue;
+
+                size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    int fd;
+                    std::memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+                    if (job.fd < 0)
+                        job.fd = fd;
+                    else
+                        close(fd);
+                }
+            }
+
+            if (n != sizeof(Request) || job.request.magic != Magic)
+            {
+                if (job.fd >= 0)
+                    close(job.fd);
+                client.closed = true;
+                return;
+            }
+
+            std::memset(&job.reply, 0, sizeof(job.reply));
+            job.reply.magic = Magic;
+            job.reply.id = job.request.id;
+            if (message.msg_flags & MSG_CTRUNC)
+                job.reply.error = EBADF;
+            if (job.request.op != static_cast<uint16_t>(Op::Hash) && job.request.op != static_cast<uint16_t>(Op::Stats))
+                job.reply.error = EINVAL;
+
+            jobs.push_back(job);
+        }
+    }
+
+    inline void HashDaemon::prepare(Job &job)
+    {
+        const HashDaemonDetail::Request &request = job.request;
+
+        auto fail = [&job](int error) {
+            if (job.reply.error == 0)
+                job.reply.error = error;
+        };
+
+        if (request.function != static_cast<uint16_t>(HashDispatch::Function::Sha256) &&
+            request.function != static_cast<uint16_t>(HashDispatch::Function::Md5))
+            fail(EINVAL);
+        if (job.fd < 0)
+            fail(EBADF);
+        if (job.reply.error != 0)
+            return;
+
+        int seals = fcntl(job.fd, F_GET_SEALS);
+        if (seals < 0 || (seals & (F_SEAL_WRITE | F_SEAL_SHRINK)) != (F_SEAL_WRITE | F_SEAL_SHRINK))
+            return fail(EPERM);
+
+        struct stat st;
+        if (fstat(job.fd, &st) != 0)
+            return fail(errno);
+
+        uint64_t size = static_cast<uint64_t>(st.st_size);
+        if (request.offset > size || request.length > size - request.offset)
+            return fail(ERANGE);
+        if (request.length == 0)
+            return;
+
+        static const uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        uint64_t start = request.offset & ~(page - 1);
+        job.mapLength = static_cast<size_t>(request.length + (request.offset - start));
+        job.map = mmap(nullptr, job.mapLength, PROT_READ, MAP_SHARED, job.fd, static_cast<off_t>(start));
+        if (job.map == MAP_FAILED)
+        {
+            job.map = nullptr;
+            return fail(errno);
+        }
+        job.data = static_cast<const byte *>(job.map) + (request.offset - start);
+    }
+
+    inline void HashDaemon::process(std::vector<Job> &jobs)
+    {
+        using Clock = std::chrono::steady_clock;
+        using HashDaemonDetail::Op;
+
+        std::map<std::pair<uint16_t, uint64_t>, std::vector<Job *>> groups;
+        std::vector<Job *> singles;
+
+        for (Job &job : jobs)
+        {
+            if (job.request.op != static_cast<uint16_t>(Op::Hash))
+            {
+                if (job.fd >= 0)
+                    close(job.fd);
+                job.fd = -1;
+                continue;
+            }
+
+            prepare(job);
+            if (job.fd >= 0)
+                close(job.fd);
+            job.fd = -1;
+
+            if (job.reply.error != 0)
+                continue;
+            if (job.request.length > 0 && job.request.length <= BatchBytes)
+                groups[{job.request.function, job.request.length}].push_back(&job);
+            else
+                singles.push_back(&job);
+        }
+
+        std::vector<std::future<void>> work;
+
+        for (auto &group : groups)
+        {
+            std::vector<Job *> &members = group.second;
+            if (members.size() == 1)
+            {
+                singles.push_back(members[0]);
+                continue;
+            }
+
+            work.push_back(pool.submit([&members] {
+                Clock::time_point start = Clock::now();
+
+                const HashDispatch::Function function = static_cast<HashDispatch::Function>(members[0]->request.function);
+                const size_t len = static_cast<size_t>(members[0]->request.length);
+                const size_t digestSize = HashDaemonDetail::DigestSize(function);
+
+                ///< the lanes want the messages back to back
+                std::vector<byte> staging(len * members.size());
+                for (size_t i = 0; i < members.size(); ++i)
+                    std::memcpy(staging.data() + i * len, members[i]->data, len);
+
+                std::vector<byte> digests(digestSize * members.size());
+                if (function == HashDispatch::Function::Md5)
+                    HashDispatch::Md5Many(staging.data(), len, members.size(), digests.data());
+                else
+                    HashDispatch::Sha256Many(staging.data(), len, members.size(), digests.data());
+
+                double share = std::chrono::duration<double>(Clock::now() - start).count() / members.size();
+                for (size_t i = 0; i < members.size(); ++i)
+                {
+                    std::memcpy(members[i]->reply.digest, digests.data() + i * digestSize, digestSize);
+                    members[i]->seconds = share;
+                    members[i]->batched = true;
+                }
+            }));
+        }
+
+        for (Job *job : singles)
+        {
+            work.push_back(pool.submit([job] {
+                Clock::time_point start = Clock::now();
+                const size_t len = static_cast<size_t>(job->request.length);
+                if (job->request.function == static_cast<uint16_t>(HashDispatch::Function::Md5))
+                    HashDispatch::Md5(job->data, len, job->reply.digest);
+                else
+                    HashDispatch::Sha256(job->data, len, job->reply.digest);
+                job->seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            }));
+        }
+
+        for (std::future<void> &done : work)
+            pool.wait(done);
+
+        for (Job &job : jobs)
+        {
+            if (job.map != nullptr)
+                munmap(job.map, job.mapLength);
+
+            Client &client = *job.client;
+            if (client.closed)
+                continue;
+
+            if (job.request.op == static_cast<uint16_t>(Op::Stats) && job.reply.error == 0)
+            {
+                std::string text = Describe();
+                text.resize(std::min(text.size(), HashDaemonDetail::MaxMessage - sizeof(job.reply)));
+
+                std::string message(reinterpret_cast<const char *>(&job.reply), sizeof(job.reply));
+                message += text;
+                send(client, message.data(), message.size());
+                continue;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(statsLock);
+                ClientStats &stats = client.stats;
+                ++stats.requests;
+                if (job.reply.error != 0)
+                {
+                    ++stats.errors;
+                }
+                else
+                {
+                    stats.bytes += job.request.length;
+                    stats.hashSeconds += job.seconds;
+                    stats.batched += job.batched ? 1 : 0;
+                }
+            }
+            send(client, &job.reply, sizeof(job.reply));
+        }
+    }
+
+    inline void HashDaemon::send(Client &client, const void *message, size_t len)
+    {
+        if (client.closed)
+            return;
+
+        if (client.unsent.empty())
+        {
+            for (;;)
+            {
+                ssize_t n = ::send(client.fd, message, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (n >= 0)
+                    return;
+                if (errno != EINTR)
+                    break;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                client.closed = true;
+                return;
+            }
+        }
+
+        ///< the daemon thread serves every client, it never waits on one of them
+        if (client.unsent.size() >= HashDaemonDetail::MaxUnsent)
+        {
+            client.closed = true;
+            return;
+        }
+        client.unsent.emplace_back(static_cast<const char *>(message), len);
+    }
+
+    inline void HashDaemon::flush(Client &client)
+    {
+        while (!client.unsent.empty() && !client.closed)
+        {
+            const std::string &message = client.unsent.front();
+            ssize_t n = ::send(client.fd, message.data(), message.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n >= 0)
+                client.unsent.pop_front();
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            else if (errno != EINTR)
+                client.closed = true;
+        }
+    }
+
+    inline void HashDaemon::run()
+    {
+        std::vector<pollfd> watched;
+        std::vector<Job> jobs;
+
+        for (;;)
+        {
+            watched.clear();
+            watched.push_back({wake, POLLIN, 0});
+            watched.push_back({listener, POLLIN, 0});
+            ///< a client with replies backed up is not read from until they are out
+            for (std::unique_ptr<Client> &client : clients)
+                watched.push_back({client->fd, static_cast<short>(client->unsent.empty() ? POLLIN : POLLOUT), 0});
+
+            if (poll(watched.data(), watched.size(), -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "poll");
+            }
+
+            if (watched[0].revents != 0)
+            {
+                uint64_t count;
+                ssize_t ignored = read(wake, &count, sizeof(count));
+                (void)ignored;
+                return;
+            }
+
+            ///< everything queued right now is one batch
+            jobs.clear();
+            for (size_t i = 2; i < watched.size(); ++i)
+            {
+                Client &client = *clients[i - 2];
+                if (watched[i].revents & POLLOUT)
+                    flush(client);
+                if (watched[i].revents & (POLLIN | POLLHUP | POLLERR))
+                    receive(client, jobs);
+            }
+
+            process(jobs);
+
+            {
+                std::lock_guard<std::mutex> lock(statsLock);
+                clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                             [](const std::unique_ptr<Client> &client) {
+                                                 if (client->closed)
+                                                     close(client->fd);
+                                                 return client->closed;
+                                             }),
+                              clients.end());
+            }
+
+            if (watched[1].revents != 0)
+                acceptClients();
+        }
+    }
+
+    inline std::vector<HashDaemon::ClientStats> HashDaemon::stats() const
+    {
+        std::lock_guard<std::mutex> lock(statsLock);
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        std::vector<ClientStats> all;
+        for (const std::unique_ptr<Client> &client : clients)
+        {
+            all.push_back(client->stats);
+            all.back().connectedSeconds = std::chrono::duration<double>(now - client->since).count();
+        }
+        return all;
+    }
+
+    inline std::string HashDaemon::Describe() const
+    {
+        std::string text = "pid\tuid\trequests\tbatched\terrors\tbytes\thash_seconds\thash_MB/s\tconnected_seconds\toffered_MB/s\n";
+        char line[256];
+        for (const ClientStats &stats : this->stats())
+        {
+            std::snprintf(line, sizeof(line), "%d\t%u\t%llu\t%llu\t%llu\t%llu\t%.6f\t%.1f\t%.1f\t%.1f\n", static_cast<int>(stats.pid),
+                          static_cast<unsigned>(stats.uid), static_cast<unsigned long long>(stats.requests),
+                          static_cast<unsigned long long>(stats.batched), static_cast<unsigned long long>(stats.errors),
+                          static_cast<unsigned long long>(stats.bytes), stats.hashSeconds,
+                          stats.hashSeconds > 0 ? stats.bytes / stats.hashSeconds / 1e6 : 0.0, stats.connectedSeconds,
+                          stats.connectedSeconds > 0 ? stats.bytes / stats.connectedSeconds / 1e6 : 0.0);
+            text += line;
+        }
+        return text;
+    }
+
+    inline HashClient::Buffer::Buffer(size_t size) : size_(size)
+    {
+        fd_ = memfd_create("cryptography-hash", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd_ < 0)
+            throw std::system_error(errno, std::generic_category(), "memfd_create");
+
+        if (ftruncate(fd_, static_cast<off_t>(size)) != 0)
+        {
+            int err = errno;
+            close(fd_);
+            throw std::system_error(err, std::generic_category(), "ftruncate memfd");
+        }
+
+        if (size == 0)
+            return;
+
+        map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (map == MAP_FAILED)
+        {
+            int err = errno;
+            close(fd_);
+            throw std::system_error(err, std::generic_category(), "mmap memfd");
+        }
+    }
+
+    inline HashClient::Buffer::Buffer(Buffer &&other) noexcept
+        : fd_(other.fd_), map(other.map), size_(other.size_), sealed_(other.sealed_)
+    {
+        other.fd_ = -1;
+        other.map = nullptr;
+        other.size_ = 0;
+    }
+
+    inline HashClient::Buffer &HashClient::Buffer::operator=(Buffer &&other) noexcept
+    {
+        if (this != &other)
+        {
+            std::swap(fd_, other.fd_);
+            std::swap(map, other.map);
+            std::swap(size_, other.size_);
+            std::swap(sealed_, other.sealed_);
+        }
+        return *this;
+    }
+
+    inline HashClient::Buffer::~Buffer()
+    {
+        if (map != nullptr)
+            munmap(map, size_);
+        if (fd_ >= 0)
+            close(fd_);
+    }
+
+    inline void HashClient::Buffer::seal()
+    {
+        if (sealed_)
+            return;
+
+        ///< F_SEAL_WRITE is refused while a writable shared mapping exists
+        if (map != nullptr)
+        {
+            munmap(map, size_);
+            map = nullptr;
+        }
+
+        if (fcntl(fd_, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0)
+            throw std::system_error(errno, std::generic_category(), "seal memfd");
+        sealed_ = true;
+
+        if (size_ == 0)
+            return;
+
+        map = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (map == MAP_FAILED)
+        {
+            map = nullptr;
+            throw std::system_error(errno, std::generic_category(), "mmap memfd");
+        }
+    }
+
+    inline HashClient::HashClient(const std::string &path)
+    {
+        sockaddr_un address = HashDaemonDetail::Address(path);
+
+        socket_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (socket_ < 0)
+            throw std::system_error(errno, std::generic_category(), "socket");
+
+        if (connect(socket_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+        {
+            int err = errno;
+            close(socket_);
+            throw std::system_error(err, std::generic_category(), "connect " + path);
+        }
+    }
+
+    inline HashClient::~HashClient()
+    {
+        close(socket_);
+    }
+
+    inline uint64_t HashClient::sendRequest(HashDaemonDetail::Op op, Function function, int fd, uint64_t offset,
+                                            uint64_t len)
+    {
+        HashDaemonDetail::Request request = {};
+        request.magic = HashDaemonDetail::Magic;
+        request.op = static_cast<uint16_t>(op);
+        request.function = static_cast<uint16_t>(function);
+        request.id = nextId++;
+        request.offset = offset;
+        request.length = len;
+
+        iovec iov = {&request, sizeof(request)};
+        msghdr message = {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        if (fd >= 0)
+        {
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            cmsghdr *header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_RIGHTS;
+            header->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(header), &fd, sizeof(int));
+        }
+
+        while (sendmsg(socket_, &message, MSG_NOSIGNAL) < 0)
+        {
+            if (errno != EINTR)
+                throw std::system_error(errno, std::generic_category(), "hash daemon send");
+        }
+        return request.id;
+    }
+
+    inline HashDaemonDetail::Reply HashClient::receiveReply(std::string *text)
+    {
+        std::vector<char> message(HashDaemonDetail::MaxMessage);
+        ssize_t n;
+        while ((n = recv(socket_, message.data(), message.size(), 0)) < 0)
+        {
+            if (errno != EINTR)
+                throw std::system_error(errno, std::generic_category(), "hash daemon receive");
+        }
+
+        HashDaemonDetail::Reply reply;
+        if (n < static_cast<ssize_t>(sizeof(reply)))
+            throw std::system_error(ECONNRESET, std::generic_category(), "hash daemon closed the connection");
+
+        std::memcpy(&reply, message.data(), sizeof(reply));
+        if (reply.magic != HashDaemonDetail::Magic)
+            throw std::system_error(EPROTO, std::generic_category(), "hash daemon reply");
+        if (text != nullptr)
+            text->assign(message.data() + sizeof(reply), static_cast<size_t>(n) - sizeof(reply));
+        return reply;
+    }
+
+    inline HashDaemonDetail::Reply HashClient::receiveReply(uint64_t id, std::string *text)
+    {
+        ///< a reply left over from an interrupted call would answer the wrong request
+        HashDaemonDetail::Reply reply = receiveReply(text);
+        if (reply.id != id)
+            throw std::system_error(EPROTO, std::generic_category(), "hash daemon reply out of sequence");
+        return reply;
+    }
+
+    inline std::vector<byte> HashClient::Hash(Function function, int fd, uint64_t offset, uint64_t len)
+    {
+        uint64_t id = sendRequest(HashDaemonDetail::Op::Hash, function, fd, offset, len);
+        HashDaemonDetail::Reply reply = receiveReply(id);
+        if (reply.error != 0)
+            throw std::system_error(reply.error, std::generic_category(), "hash daemon");
+
+        return std::vector<byte>(reply.digest, reply.digest + HashDaemonDetail::DigestSize(function));
+    }
+
+    inline std::vector<byte> HashClient::Hash(Function function, const Buffer &buffer, uint64_t offset, uint64_t len)
+    {
+        if (len == UINT64_MAX)
+            len = buffer.size() - std::min<uint64_t>(offset, buffer.size());
+        return Hash(function, buffer.fd(), offset, len);
+    }
+
+    inline std::vector<byte> HashClient::Sha256(const byte *data, size_t len)
+    {
+        Buffer buffer(len);
+        if (len != 0)
+            std::memcpy(buffer.data(), data, len);
+        buffer.seal();
+        return Hash(Function::Sha256, buffer);
+    }
+
+    inline std::vector<byte> HashClient::Md5(const byte *data, size_t len)
+    {
+        Buffer buffer(len);
+        if (len != 0)
+            std::memcpy(buffer.data(), data, len);
+        buffer.seal();
+        return Hash(Function::Md5, buffer);
+    }
+
+    inline std::vector<std::vector<byte>> HashClient::HashMany(Function function, const Buffer &buffer,
+                                                               const std::vector<std::pair<uint64_t, uint64_t>> &ranges)
+    {
+        std::vector<std::vector<byte>> digests(ranges.size());
+        const uint64_t firstId = nextId;
+        size_t sent = 0, received = 0;
+        int error = 0;
+
+        ///< replies come back in request order, keep at most Window outstanding
+        while (received < ranges.size())
+        {
+            while (sent < ranges.size() && sent - received < Window)
+            {
+                sendRequest(HashDaemonDetail::Op::Hash, function, buffer.fd(), ranges[sent].first, ranges[sent].second);
+                ++sent;
+            }
+
+            HashDaemonDetail::Reply reply = receiveReply();
+            size_t index = static_cast<size_t>(reply.id - firstId);
+            if (index >= ranges.size())
+                throw std::system_error(EPROTO, std::generic_category(), "hash daemon reply");
+
+            if (reply.error != 0 && error == 0)
+                error = reply.error;
+            digests[index].assign(reply.digest, reply.digest + HashDaemonDetail::DigestSize(function));
+            ++received;
+        }
+
+        if (error != 0)
+            throw std::system_error(error, std::generic_category(), "hash daemon");
+        return digests;
+    }
+
+    inline std::string HashClient::Stats()
+    {
+        uint64_t id = sendRequest(HashDaemonDetail::Op::Stats, Function::Sha256, -1, 0, 0);
+        std::string text;
+        HashDaemonDetail::Reply reply = receiveReply(id, &text);
+        if (reply.error != 0)
+            throw std::system_error(reply.error, std::generic_category(), "hash daemon");
+        return text;
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_HASH_DAEMON_HPP */
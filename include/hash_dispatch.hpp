@@ -0,0 +1,927 @@
+#ifndef CRYPTOGRAPHY_HASH_DISPATCH_HPP
+#define CRYPTOGRAPHY_HASH_DISPATCH_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cpu_features.hpp"
+#include "md5.hpp"
+#include "md5_lanes.hpp"
+#include "sha256_kernels.hpp"
+#include "sha256_lanes.hpp"
+
+namespace Crypto
+{
+    namespace HashDispatchDetail
+    {
+        ///< part of the cache key, bump whenever a kernel changes speed or meaning
+        constexpr char LibraryVersion[] = "1";
+
+        constexpr size_t SizeClasses = 4;
+
+        ///< message length benchmarked for each size class
+        constexpr size_t ClassBytes[SizeClasses] = {64, 1024, 16384, 131072};
+
+        ///< messages per call when benchmarking the batch functions
+        constexpr size_t BatchCount = 8;
+
+        ///< bytes hashed by one timed trial
+        constexpr size_t TrialBytes = 256 * 1024;
+
+        inline size_t sizeClass(size_t len)
+        {
+            return len < 256 ? 0 : len < 4096 ? 1 : len < 65536 ? 2 : 3;
+        }
+
+        ///< blocks copied then hashed together when a kernel has no fused copy, the tile stays in L1
+        constexpr size_t CopyTileBlocks = 16;
+
+        ///< memcpy, with cache bypassing stores for a 16 byte aligned dst when asked
+#ifdef CRYPTOGRAPHY_X86
+        __attribute__((target("sse2")))
+#endif
+        inline void copyBytes(byte *dst, const byte *src, size_t len, bool nonTemporal)
+        {
+#ifdef CRYPTOGRAPHY_X86
+            ///< plain stores up to dst's next 16 byte boundary, then stream
+            const size_t skew = (16 - (reinterpret_cast<uintptr_t>(dst) & 15)) & 15;
+            if (nonTemporal && len >= skew + 64)
+            {
+                std::memcpy(dst, src, skew);
+                dst += skew;
+                src += skew;
+                len -= skew;
+                for (; len >= 64; len -= 64, src += 64, dst += 64)
+                {
+                    for (int i = 0; i < 4; ++i)
+                        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 16 * i),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16 * i)));
+                }
+            }
+#else
+            (void)nonTemporal;
+#endif
+            std::memcpy(dst, src, len);
+        }
+    } // namespace HashDispatchDetail
+
+    /**
+     * @brief
+     *      per host choice of the fastest SHA-256 / MD5 kernel.
+     *
+     *      the first call to get() times every kernel the cpu supports on a
+     *      few message sizes and routes later calls through a table of
+     *      function pointers. The winners are saved in a small cache file keyed
+     *      by cpu model, cpu features and library version, so the next
+     *      process on the same kind of host only reads that file.
+     *
+     *      the cache is $CRYPTOGRAPHY_KERNEL_CACHE when set (empty disables
+     *      it), otherwise $XDG_CACHE_HOME or ~/.cache /cryptography-kernels.
+     */
+    class HashDispatch
+    {
+    public:
+        enum class Kernel : uint8_t
+        {
+            Scalar,
+            VectorSchedule,
+            ShaNi,
+            MultiLane
+        };
+
+        enum class Function : uint8_t
+        {
+            Sha256,
+            Md5,
+            Sha256Batch,
+            Md5Batch
+        };
+
+        static constexpr size_t Functions = 4;
+        static constexpr size_t SizeClasses = HashDispatchDetail::SizeClasses;
+
+        ///< compress whole 64 byte blocks into a raw state
+        using Sha256Blocks = void (*)(std::array<uint32_t, 8> &, const byte *, size_t);
+        using Md5Blocks = void (*)(std::array<uint32_t, 4> &, const byte *, size_t);
+
+        ///< hash count messages of len bytes each, laid out back to back
+        using Batch = void (*)(const byte *in, size_t len, size_t count, byte *out);
+
+        struct Table
+        {
+            Sha256Blocks sha256[SizeClasses];
+            Md5Blocks md5[SizeClasses];
+            Batch sha256Batch[SizeClasses];
+            Batch md5Batch[SizeClasses];
+
+            Kernel chosen[Functions][SizeClasses];
+
+            ///< true when the choice came from the cache file
+            bool cached = false;
+        };
+
+        /**
+         * @brief
+         *      the table for this process, loaded or tuned on first use
+         */
+        static const Table &get();
+
+        ///< SHA-256 of data into out[32]
+        static void Sha256(const byte *data, size_t len, byte *out);
+
+        ///< MD5 of data into out[16]
+        static void Md5(const byte *data, size_t len, byte *out);
+
+        ///< SHA-256 of src into out[32] while copying it to dst, see Stream::copyData
+        static void Sha256Copy(byte *dst, const byte *src, size_t len, byte *out, bool nonTemporal = true);
+
+        ///< MD5 of src into out[16] while copying it to dst
+        static void Md5Copy(byte *dst, const byte *src, size_t len, byte *out, bool nonTemporal = true);
+
+        ///< SHA-256 of count messages of len bytes, digests back to back in out
+        static void Sha256Many(const byte *in, size_t len, size_t count, byte *out);
+
+        ///< MD5 of count messages of len bytes, digests back to back in out
+        static void Md5Many(const byte *in, size_t len, size_t count, byte *out);
+
+        /**
+         * @brief
+         *      benchmark every available kernel now, without the cache
+         */
+        static Table Tune();
+
+        static bool Available(Function function, Kernel kernel);
+
+        static const char *KernelName(Kernel kernel);
+        static const char *FunctionName(Function function);
+
+        ///< one line per function and size class with the chosen kernel
+        static std::string Describe();
+
+        static std::string CachePath();
+        static std::string CacheKey();
+
+        /**
+         * @brief
+         *      incremental SHA-256 or MD5 through the kernel tuned for the
+         *      largest size class. Whole blocks are compressed in place,
+         *      only a partial block is buffered.
+         */
+        class Stream
+        {
+        public:
+            ///< Function::Sha256 or Function::Md5
+            explicit Stream(Function function);
+
+            void addData(const byte *data, size_t len);
+
+            /**
+             * @brief
+             *      addData(src, len) that also copies src to dst, reading src
+             *      from memory once instead of once for memcpy and once for
+             *      hashing. With nonTemporal, whole blocks bypass the cache,
+             *      for data not read back soon, whatever the alignment of
+             *      dst; only a few bytes at either end are plain stores.
+             */
+            void copyData(byte *dst, const byte *src, size_t len, bool nonTemporal = true);
+
+            ///< write DigestSize() bytes to out, the stream starts over afterwards
+            void GetHash(byte *out);
+
+            size_t DigestSize() const
+            {
+                return function == Function::Md5 ? 16 : 32;
+            }
+
+            void reset();
+
+        private:
+            void blocks(const byte *data, size_t count);
+
+            void copyBlocks(byte *dst, const byte *src, size_t count, bool nonTemporal);
+
+            Function function;
+            Sha256Blocks sha = nullptr;
+            Md5Blocks md5 = nullptr;
+            std::array<uint32_t, 8> shaState;
+            std::array<uint32_t, 4> md5State;
+            byte pending[64];
+            size_t pendingLen = 0;
+            uint64_t total = 0;
+        };
+
+    private:
+        static bool assign(Table &table, Function function, size_t sizeClass, Kernel kernel);
+
+        static Table load();
+        static bool readCache(const std::string &path, const std::string &key, Table &table);
+        static void writeCache(const std::string &path, const std::string &key, const Table &table);
+
+        static void md5BlocksPortable(std::array<uint32_t, 4> &state, const byte *data, size_t blocks);
+
+        static void sha256With(Sha256Blocks blocks, const byte *data, size_t len, byte *out);
+        static void md5With(Md5Blocks blocks, const byte *data, size_t len, byte *out);
+
+        template <Sha256Blocks blocks>
+        static void sha256Each(const byte *in, size_t len, size_t count, byte *out);
+
+        template <Md5Blocks blocks>
+        static void md5Each(const byte *in, size_t len, size_t count, byte *out);
+
+        static void sha256Lanes(const byte *in, size_t len, size_t count, byte *out);
+        static void md5Lanes(const byte *in, size_t len, size_t count, byte *out);
+
+        ///< last 1 or 2 blocks of a message of total bytes: its final total % 64
+        ///< bytes (rest), the padding and the length
+        static size_t tailBlocks(const byte *rest, uint64_t total, bool bigEndian, byte (&tail)[128]);
+    };
+
+    ///< Implementation
+    inline const char *HashDispatch::KernelName(Kernel kernel)
+    {
+        switch (kernel)
+        {
+        case Kernel::Scalar:
+            return "scalar";
+        case Kernel::VectorSchedule:
+            return "vector-schedule";
+        case Kernel::ShaNi:
+            return "sha-ni";
+        default:
+            return "multi-lane";
+        }
+    }
+
+    inline const char *HashDispatch::FunctionName(Function function)
+    {
+        switch (function)
+        {
+        case Function::Sha256:
+            return "sha256";
+        case Function::Md5:
+            return "md5";
+        case Function::Sha256Batch:
+            return "sha256-batch";
+        default:
+            return "md5-batch";
+        }
+    }
+
+    inline bool HashDispatch::Available(Function function, Kernel kernel)
+    {
+        const CpuFeatures &cpu = CpuFeatures::get();
+        bool md5 = function == Function::Md5 || function == Function::Md5Batch;
+        bool batch = function == Function::Sha256Batch || function == Function::Md5Batch;
+
+        switch (kernel)
+        {
+        case Kernel::Scalar:
+            return true;
+#ifdef CRYPTOGRAPHY_X86
+        case Kernel::VectorSchedule:
+            return !md5 && cpu.avx2;
+        case Kernel::ShaNi:
+            return !md5 && cpu.sha && cpu.sse41;
+        case Kernel::MultiLane:
+            return batch && cpu.avx2;
+#endif
+        default:
+            (void)cpu;
+            (void)md5;
+            (void)batch;
+            return false;
+        }
+    }
+
+    inline bool HashDispatch::assign(Table &table, Function function, size_t sizeClass, Kernel kernel)
+    {
+        if (sizeClass >= SizeClasses || !Available(function, kernel))
+            return false;
+
+        Sha256Blocks sha = &Sha256Kernels::blocksPortable;
+        Batch shaEach = &sha256Each<&Sha256Kernels::blocksPortable>;
+#ifdef CRYPTOGRAPHY_X86
+        if (kernel == Kernel::VectorSchedule)
+        {
+            sha = &Sha256Kernels::blocksVectorSchedule;
+            shaEach = &sha256Each<&Sha256Kernels::blocksVectorSchedule>;
+        }
+        else if (kernel == Kernel::ShaNi)
+        {
+            sha = &Sha256Kernels::blocksShaNi;
+            shaEach = &sha256Each<&Sha256Kernels::blocksShaNi>;
+        }
+#endif
+
+        switch (function)
+        {
+        case Function::Sha256:
+            table.sha256[sizeClass] = sha;
+            break;
+        case Function::Md5:
+            table.md5[sizeClass] = &md5BlocksPortable;
+            break;
+        case Function::Sha256Batch:
+            table.sha256Batch[sizeClass] = kernel == Kernel::MultiLane ? &sha256Lanes : shaEach;
+            break;
+        case Function::Md5Batch:
+            table.md5Batch[sizeClass] = kernel == Kernel::MultiLane ? &md5Lanes : &md5Each<&md5BlocksPortable>;
+            break;
+        }
+
+        table.chosen[static_cast<size_t>(function)][sizeClass] = kernel;
+        return true;
+    }
+
+    inline HashDispatch::Table HashDispatch::Tune()
+    {
+        using namespace HashDispatchDetail;
+        using Clock = std::chrono::steady_clock;
+
+        Table table;
+        const Kernel kernels[] = {Kernel::Scalar, Kernel::VectorSchedule, Kernel::ShaNi, Kernel::MultiLane};
+
+        std::vector<byte> input(ClassBytes[SizeClasses - 1] * BatchCount);
+        for (size_t i = 0; i < input.size(); ++i)
+            input[i] = static_cast<byte>(i * 131 + (i >> 9));
+        byte out[32 * BatchCount];
+
+        for (size_t f = 0; f < Functions; ++f)
+        {
+            Function function = static_cast<Function>(f);
+            bool batch = function == Function::Sha256Batch || function == Function::Md5Batch;
+
+            for (size_t c = 0; c < SizeClasses; ++c)
+            {
+                size_t len = ClassBytes[c];
+                size_t count = batch ? BatchCount : 1;
+                size_t reps = TrialBytes / (len * count) + 1;
+
+                std::vector<Kernel> available;
+                for (Kernel kernel : kernels)
+                    if (Available(function, kernel))
+                        available.push_back(kernel);
+
+                ///< a single candidate needs no timing
+                assign(table, function, c, available.front());
+                if (available.size() == 1)
+                    continue;
+
+                double best = 0;
+                for (Kernel kernel : available)
+                {
+                    Table candidate;
+                    assign(candidate, function, c, kernel);
+
+                    auto run = [&] {
+                        for (size_t r = 0; r < reps; ++r)
+                        {
+                            switch (function)
+                            {
+                            case Function::Sha256:
+                                sha256With(candidate.sha256[c], input.data(), len, out);
+                                break;
+                            case Function::Md5:
+                                md5With(candidate.md5[c], input.data(), len, out);
+                                break;
+                            case Function::Sha256Batch:
+                                candidate.sha256Batch[c](input.data(), len, count, out);
+                                break;
+                            case Function::Md5Batch:
+                                candidate.md5Batch[c](input.data(), len, count, out);
+                                break;
+                            }
+                        }
+                    };
+
+                    ///< warm up, then keep the fastest of three trials
+                    run();
+                    double fastest = 0;
+                    for (int trial = 0; trial < 3; ++trial)
+                    {
+                        Clock::time_point start = Clock::now();
+                        run();
+                        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+                        if (trial == 0 || elapsed < fastest)
+                            fastest = elapsed;
+                    }
+
+                    if (kernel == available.front() || fastest < best)
+                    {
+                        best = fastest;
+                        assign(table, function, c, kernel);
+                    }
+                }
+            }
+        }
+
+        return table;
+    }
+
+    inline std::string HashDispatch::CacheKey()
+    {
+        const CpuFeatures &cpu = CpuFeatures::get();
+        std::string key = cpu.model.empty() ? std::string("unknown cpu") : cpu.model;
+
+        key += " |";
+        if (cpu.sse41)
+            key += " sse4.1";
+        if (cpu.avx2)
+            key += " avx2";
+        if (cpu.avx512f)
+            key += " avx512f";
+        if (cpu.sha)
+            key += " sha";
+
+        key += " | ";
+        key += HashDispatchDetail::LibraryVersion;
+        return key;
+    }
+
+    inline std::string HashDispatch::CachePath()
+    {
+        if (const char *path = std::getenv("CRYPTOGRAPHY_KERNEL_CACHE"))
+            return path;
+        if (const char *cache = std::getenv("XDG_CACHE_HOME"))
+            return std::string(cache) + "/cryptography-kernels";
+        if (const char *home = std::getenv("HOME"))
+            return std::string(home) + "/.cache/cryptography-kernels";
+        return std::string();
+    }
+
+    inline bool HashDispatch::readCache(const std::string &path, const std::string &key, Table &table)
+    {
+        std::ifstream in(path);
+        if (!in)
+            return false;
+
+        bool seen[Functions][SizeClasses] = {};
+        std::string line;
+
+        ///< lines are: key \t function \t size class \t kernel
+        while (std::getline(in, line))
+        {
+            std::vector<std::string> fields;
+            std::stringstream stream(line);
+            std::string field;
+            while (std::getline(stream, field, '\t'))
+                fields.push_back(field);
+
+            if (fields.size() != 4 || fields[0] != key)
+                continue;
+
+            for (size_t f = 0; f < Functions; ++f)
+            {
+                if (fields[1] != FunctionName(static_cast<Function>(f)))
+                    continue;
+
+                size_t c = static_cast<size_t>(std::strtoul(fields[2].c_str(), nullptr, 10));
+                for (uint8_t k = 0; k <= static_cast<uint8_t>(Kernel::MultiLane); ++k)
+                {
+                    if (fields[3] == KernelName(static_cast<Kernel>(k)) &&
+                        assign(table, static_cast<Function>(f), c, static_cast<Kernel>(k)))
+                        seen[f][c] = true;
+                }
+            }
+        }
+
+        for (size_t f = 0; f < Functions; ++f)
+            for (size_t c = 0; c < SizeClasses; ++c)
+                if (!seen[f][c])
+                    return false;
+        return true;
+    }
+
+    inline void HashDispatch::writeCache(const std::string &path, const std::string &key, const Table &table)
+    {
+        ///< keep the entries of other hosts sharing the file
+        std::string kept;
+        {
+            std::ifstream in(path);
+            std::string line;
+            while (std::getline(in, line))
+            {
+                if (line.compare(0, key.size() + 1, key + "\t") != 0)
+                    kept += line + "\n";
+            }
+        }
+
+        size_t slash = path.find_last_of('/');
+        if (slash != std::string::npos && slash > 0)
+            mkdir(path.substr(0, slash).c_str(), 0755);
+
+        ///< write a private file and rename it, readers never see half a cache
+        std::string temp = path + "." + std::to_string(getpid());
+        {
+            std::ofstream out(temp, std::ios::trunc);
+            if (!out)
+                return;
+
+            out << kept;
+            for (size_t f = 0; f < Functions; ++f)
+                for (size_t c = 0; c < SizeClasses; ++c)
+                    out << key << '\t' << FunctionName(static_cast<Function>(f)) << '\t' << c << '\t'
+                        << KernelName(table.chosen[f][c]) << '\n';
+
+            if (!out.flush())
+            {
+                out.close();
+                unlink(temp.c_str());
+                return;
+            }
+        }
+
+        if (std::rename(temp.c_str(), path.c_str()) != 0)
+            unlink(temp.c_str());
+    }
+
+    inline HashDispatch::Table HashDispatch::load()
+    {
+        std::string path = CachePath();
+        std::string key = CacheKey();
+
+        Table table;
+        if (!path.empty() && readCache(path, key, table))
+        {
+            table.cached = true;
+            return table;
+        }
+
+        table = Tune();
+        if (!path.empty())
+            writeCache(path, key, table);
+        return table;
+    }
+
+    inline const HashDispatch::Table &HashDispatch::get()
+    {
+        static const Table table = load();
+        return table;
+    }
+
+    inline std::string HashDispatch::Describe()
+    {
+        const Table &table = get();
+        std::string text;
+
+        for (size_t f = 0; f < Functions; ++f)
+        {
+            for (size_t c = 0; c < SizeClasses; ++c)
+            {
+                text += FunctionName(static_cast<Function>(f));
+                text += " " + std::to_string(HashDispatchDetail::ClassBytes[c]) + ": ";
+                text += KernelName(table.chosen[f][c]);
+                text += "\n";
+            }
+        }
+        return text;
+    }
+
+    inline void HashDispatch::md5BlocksPortable(std::array<uint32_t, 4> &state, const byte *data, size_t blocks)
+    {
+        std::array<uint32_t, 16> x;
+        for (size_t i = 0; i < blocks; ++i, data += 64)
+        {
+            Crypto::Md5::toUintArray(data, x);
+            Crypto::Md5::processBlock(state, x);
+        }
+    }
+
+    inline size_t HashDispatch::tailBlocks(const byte *rest, uint64_t total, bool bigEndian, byte (&tail)[128])
+    {
+        size_t restLen = static_cast<size_t>(total % 64);
+        size_t blocks = restLen < 56 ? 1 : 2;
+        uint64_t bits = total * 8;
+
+        std::memset(tail, 0, sizeof(tail));
+        if (restLen > 0)
+            std::memcpy(tail, rest, restLen);
+        tail[restLen] = 0x80;
+
+        byte *length = tail + blocks * 64 - 8;
+        for (size_t i = 0; i < 8; ++i)
+            length[i] = static_cast<byte>(bigEndian ? bits >> (56 - 8 * i) : bits >> (8 * i));
+
+        return blocks;
+    }
+
+    inline void HashDispatch::sha256With(Sha256Blocks blocks, const byte *data, size_t len, byte *out)
+    {
+        std::array<uint32_t, 8> state = Sha26::iv;
+        byte tail[128];
+
+        blocks(state, data, len / 64);
+        blocks(state, tail, tailBlocks(data + len - len % 64, len, true, tail));
+
+        for (size_t i = 0; i < 8; ++i)
+        {
+            out[4 * i] = static_cast<byte>(state[i] >> 24);
+            out[4 * i + 1] = static_cast<byte>(state[i] >> 16);
+            out[4 * i + 2] = static_cast<byte>(state[i] >> 8);
+            out[4 * i + 3] = static_cast<byte>(state[i]);
+        }
+    }
+
+    inline void HashDispatch::md5With(Md5Blocks blocks, const byte *data, size_t len, byte *out)
+    {
+        std::array<uint32_t, 4> state = {
+            static_cast<uint32_t>(Crypto::Md5::MD5InitializerConstant::A), static_cast<uint32_t>(Crypto::Md5::MD5InitializerConstant::B),
+            static_cast<uint32_t>(Crypto::Md5::MD5InitializerConstant::C), static_cast<uint32_t>(Crypto::Md5::MD5InitializerConstant::D)};
+        byte tail[128];
+
+        blocks(state, data, len / 64);
+        blocks(state, tail, tailBlocks(data + len - len % 64, len, false, tail));
+
+        for (size_t i = 0; i < 4; ++i)
+        {
+            out[4 * i] = static_cast<byte>(state[i]);
+            out[4 * i + 1] = static_cast<byte>(state[i] >> 8);
+            out[4 * i + 2] = static_cast<byte>(state[i] >> 16);
+            out[4 * i + 3] = static_cast<byte>(state[i] >> 24);
+        }
+    }
+
+    template <HashDispatch::Sha256Blocks blocks>
+    void HashDispatch::sha256Each(const byte *in, size_t len, size_t count, byte *out)
+    {
+        for (size_t i = 0; i < count; ++i)
+            sha256With(blocks, in + i * len, len, out + i * 32);
+    }
+
+    template <HashDispatch::Md5Blocks blocks>
+    void HashDispatch::md5Each(const byte *in, size_t len, size_t count, byte *out)
+    {
+        for (size_t i = 0; i < count; ++i)
+            md5With(blocks, in + i * len, len, out + i * 16);
+    }
+
+    inline void HashDispatch::sha256Lanes(const byte *in, size_t len, size_t count, byte *out)
+    {
+        const size_t maxLanes = Sha256Lanes::MaxLanes;
+        const size_t full = len / 64;
+        Sha256Lanes::State state;
+        Sha256Lanes::Block m;
+        byte tails[maxLanes][128];
+
+        for (size_t first = 0; first < count; first += maxLanes)
+        {
+            size_t lanes = count - first < maxLanes ? count - first : maxLanes;
+            size_t total = full;
+
+            for (size_t lane = 0; lane < maxLanes; ++lane)
+            {
+                const byte *msg = in + (first + (lane < lanes ? lane : 0)) * len;
+                total = full + tailBlocks(msg + full * 64, len, true, tails[lane]);
+                for (size_t i = 0; i < 8; ++i)
+                    state[i][lane] = Sha26::iv[i];
+            }
+
+            for (size_t block = 0; block < total; ++block)
+            {
+                for (size_t lane = 0; lane < maxLanes; ++lane)
+                {
+                    const byte *src = block < full ? in + (first + (lane < lanes ? lane : 0)) * len + block * 64
+                                                   : tails[lane] + (block - full) * 64;
+                    for (size_t i = 0; i < 16; ++i, src += 4)
+                        m[i][lane] = (static_cast<uint32_t>(src[0]) << 24) | (static_cast<uint32_t>(src[1]) << 16) |
+                                     (static_cast<uint32_t>(src[2]) << 8) | static_cast<uint32_t>(src[3]);
+                }
+                Sha256Lanes::compress(state, m, lanes);
+            }
+
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                byte *dest = out + (first + lane) * 32;
+                for (size_t i = 0; i < 8; ++i)
+                {
+                    dest[4 * i] = static_cast<byte>(state[i][lane] >> 24);
+                    dest[4 * i + 1] = static_cast<byte>(state[i][lane] >> 16);
+                    dest[4 * i + 2] = static_cast<byte>(state[i][lane] >> 8);
+                    dest[4 * i + 3] = static_cast<byte>(state[i][lane]);
+                }
+            }
+        }
+    }
+
+    inline void HashDispatch::md5Lanes(const byte *in, size_t len, size_t count, byte *out)
+    {
+        const size_t maxLanes = Md5Lanes::MaxLanes;
+        const size_t full = len / 64;
+        Md5Lanes::State state;
+        Md5Lanes::Block m;
+        byte tails[maxLanes][128];
+
+        for (size_t first = 0; first < count; first += maxLanes)
+        {
+            size_t lanes = count - first < maxLanes ? count - first : maxLanes;
+            size_t total = full;
+
+            for (size_t lane = 0; lane < maxLanes; ++lane)
+            {
+                const byte *msg = in + (first + (lane < lanes ? lane : 0)) * len;
+                total = full + tailBlocks(msg + full * 64, len, false, tails[lane]);
+                state[0][lane] = static_cast<uint32_t>(Crypto::Md5::MD5InitializerConstant::A);
+                state[1][lane] = static_cast<uint32_t>(Crypto::Md5::MD5InitializerConstant::B);
+                state[2][lane] = static_cast<uint32_t>(Crypto::Md5::MD5InitializerConstant::C);
+                state[3][lane] = static_cast<uint32_t>(Crypto::Md5::MD5InitializerConstant::D);
+            }
+
+            for (size_t block = 0; block < total; ++block)
+            {
+                for (size_t lane = 0; lane < maxLanes; ++lane)
+                {
+                    const byte *src = block < full ? in + (first + (lane < lanes ? lane : 0)) * len + block * 64
+                                                   : tails[lane] + (block - full) * 64;
+                    for (size_t i = 0; i < 16; ++i, src += 4)
+                        m[i][lane] = (static_cast<uint32_t>(src[3]) << 24) | (static_cast<uint32_t>(src[2]) << 16) |
+                                     (static_cast<uint32_t>(src[1]) << 8) | static_cast<uint32_t>(src[0]);
+                }
+                Md5Lanes::compress(state, m, lanes);
+            }
+
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                byte *dest = out + (first + lane) * 16;
+                for (size_t i = 0; i < 4; ++i)
+                {
+                    dest[4 * i] = static_cast<byte>(state[i][lane]);
+                    dest[4 * i + 1] = static_cast<byte>(state[i][lane] >> 8);
+                    dest[4 * i + 2] = static_cast<byte>(state[i][lane] >> 16);
+                    dest[4 * i + 3] = static_cast<byte>(state[i][lane] >> 24);
+                }
+            }
+        }
+    }
+
+    inline HashDispatch::Stream::Stream(Function function) : function(function)
+    {
+        if (function != Function::Sha256 && function != Function::Md5)
+            throw std::invalid_argument("HashDispatch::Stream hashes SHA-256 or MD5");
+
+        const Table &table = get();
+        sha = table.sha256[SizeClasses - 1];
+        md5 = table.md5[SizeClasses - 1];
+        reset();
+    }
+
+    inline void HashDispatch::Stream::reset()
+    {
+        shaState = Sha26::iv;
+        md5State = {static_cast<uint32_t>(Crypto::Md5::MD5InitializerConstant::A),
+                    static_cast<uint32_t>(Crypto::Md5::MD5InitializerConstant::B),
+                    static_cast<uint32_t>(Crypto::Md5::MD5InitializerConstant::C),
+                    static_cast<uint32_t>(Crypto::Md5::MD5InitializerConstant::D)};
+        pendingLen = 0;
+        total = 0;
+    }
+
+    inline void HashDispatch::Stream::blocks(const byte *data, size_t count)
+    {
+        if (function == Function::Md5)
+            md5(md5State, data, count);
+        else
+            sha(shaState, data, count);
+    }
+
+    inline void HashDispatch::Stream::addData(const byte *data, size_t len)
+    {
+        total += len;
+
+        if (pendingLen > 0)
+        {
+            size_t take = std::min(64 - pendingLen, len);
+            std::memcpy(pending + pendingLen, data, take);
+            pendingLen += take;
+            data += take;
+            len -= take;
+
+            if (pendingLen < 64)
+                return;
+            blocks(pending, 1);
+            pendingLen = 0;
+        }
+
+        blocks(data, len / 64);
+        pendingLen = len % 64;
+        std::memcpy(pending, data + len - pendingLen, pendingLen);
+    }
+
+    inline void HashDispatch::Stream::copyBlocks(byte *dst, const byte *src, size_t count, bool nonTemporal)
+    {
+#ifdef CRYPTOGRAPHY_X86
+        if (function == Function::Sha256 && sha == &Sha256Kernels::blocksShaNi)
+        {
+            Sha256Kernels::copyBlocksShaNi(shaState, dst, src, count, nonTemporal);
+            return;
+        }
+#endif
+        for (size_t done = 0; done < count;)
+        {
+            size_t tile = std::min(count - done, HashDispatchDetail::CopyTileBlocks);
+            HashDispatchDetail::copyBytes(dst + 64 * done, src + 64 * done, 64 * tile, nonTemporal);
+            blocks(src + 64 * done, tile);
+            done += tile;
+        }
+    }
+
+    inline void HashDispatch::Stream::copyData(byte *dst, const byte *src, size_t len, bool nonTemporal)
+    {
+        total += len;
+
+        if (pendingLen > 0)
+        {
+            size_t take = std::min(64 - pendingLen, len);
+            std::memcpy(dst, src, take);
+            std::memcpy(pending + pendingLen, src, take);
+            pendingLen += take;
+            src += take;
+            dst += take;
+            len -= take;
+
+            if (pendingLen < 64)
+                return;
+            blocks(pending, 1);
+            pendingLen = 0;
+        }
+
+        copyBlocks(dst, src, len / 64, nonTemporal);
+#ifdef CRYPTOGRAPHY_X86
+        if (nonTemporal)
+            _mm_sfence();
+#endif
+
+        pendingLen = len % 64;
+        std::memcpy(dst + len - pendingLen, src + len - pendingLen, pendingLen);
+        std::memcpy(pending, src + len - pendingLen, pendingLen);
+    }
+
+    inline void HashDispatch::Stream::GetHash(byte *out)
+    {
+        byte tail[128];
+        bool md5Digest = function == Function::Md5;
+        blocks(tail, tailBlocks(pending, total, !md5Digest, tail));
+
+        if (md5Digest)
+        {
+            for (size_t i = 0; i < 16; ++i)
+                out[i] = static_cast<byte>(md5State[i / 4] >> (8 * (i % 4)));
+        }
+        else
+        {
+            for (size_t i = 0; i < 32; ++i)
+                out[i] = static_cast<byte>(shaState[i / 4] >> (24 - 8 * (i % 4)));
+        }
+
+        reset();
+    }
+
+    inline void HashDispatch::Sha256(const byte *data, size_t len, byte *out)
+    {
+        sha256With(get().sha256[HashDispatchDetail::sizeClass(len)], data, len, out);
+    }
+
+    inline void HashDispatch::Md5(const byte *data, size_t len, byte *out)
+    {
+        md5With(get().md5[HashDispatchDetail::sizeClass(len)], data, len, out);
+    }
+
+    inline void HashDispatch::Sha256Copy(byte *dst, const byte *src, size_t len, byte *out, bool nonTemporal)
+    {
+        Stream stream(Function::Sha256);
+        stream.copyData(dst, src, len, nonTemporal);
+        stream.GetHash(out);
+    }
+
+    inline void HashDispatch::Md5Copy(byte *dst, const byte *src, size_t len, byte *out, bool nonTemporal)
+    {
+        Stream stream(Function::Md5);
+        stream.copyData(dst, src, len, nonTemporal);
+        stream.GetHash(out);
+    }
+
+    inline void HashDispatch::Sha256Many(const byte *in, size_t len, size_t count, byte *out)
+    {
+        get().sha256Batch[HashDispatchDetail::sizeClass(len)](in, len, count, out);
+    }
+
+    inline void HashDispatch::Md5Many(const byte *in, size_t len, size_t count, byte *out)
+    {
+        get().md5Batch[HashDispatchDetail::sizeClass(len)](in, len, count, out);
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_HASH_DISPATCH_HPP */
@@ -0,0 +1,195 @@
+#ifndef CRYPTOGRAPHY_HASH_JOB_HPP
+#define CRYPTOGRAPHY_HASH_JOB_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+typedef unsigned char byte;
+
+namespace Crypto
+{
+    namespace HashJobDetail
+    {
+        ///< bytes hashed between clock reads under a time budget
+        constexpr size_t SliceBytes = 4096;
+    } // namespace HashJobDetail
+
+    /**
+     * @brief
+     *      resumable hashing of one buffer in bounded steps, for event loops
+     *      that cannot stall on a multi-MB addData.
+     *
+     *      each step(budget) feeds whole BlockSize blocks to the hasher, up to
+     *      a byte count or a time limit, and remembers where it stopped; the
+     *      last step feeds the tail. Once done(), the digest is read from
+     *      hasher() as usual. Works with anything that has
+     *      addData(const byte *, size_t): Sha26, Md5, Blake3,
+     *      HashDispatch::Stream, ...
+     *
+     *      the buffer is not copied and must stay alive until done().
+     *
+     * @code
+     *      HashJob<Sha26> job(body, len);
+     *      loop.onIdle([&] {
+     *          if (job.step(std::chrono::microseconds(200)))
+     *              reply(job.hasher().GetHash());
+     *      });
+     * @endcode
+     */
+    template <typename Hasher, size_t BlockSize = 64>
+    class HashJob
+    {
+    public:
+        static_assert(BlockSize > 0 && HashJobDetail::SliceBytes % BlockSize == 0,
+                      "a time slice must hold whole blocks");
+
+        struct Progress
+        {
+            uint64_t done = 0;
+            uint64_t total = 0;
+            uint64_t steps = 0;
+
+            ///< time spent inside step(), to compare against the budgets given
+            std::chrono::nanoseconds busy{0};
+
+            double fraction() const
+            {
+                return total == 0 ? 1.0 : static_cast<double>(done) / static_cast<double>(total);
+            }
+        };
+
+        ///< the hasher is built from args, e.g. HashDispatch::Function::Sha256 for a Stream
+        template <typename... Args>
+        HashJob(const byte *data, size_t len, Args &&...args);
+
+        /**
+         * @brief
+         *      hash at most bytes more (rounded down to whole blocks, at
+         *      least one block so every step makes progress)
+         *
+         * @return true once the whole buffer is hashed
+         */
+        bool step(size_t bytes);
+
+        /**
+         * @brief
+         *      hash whole blocks until the next slice would overrun budget,
+         *      at least one slice
+         *
+         * @return true once the whole buffer is hashed
+         */
+        bool step(std::chrono::nanoseconds budget);
+
+        bool done() const
+        {
+            return position == length;
+        }
+
+        Progress progress() const
+        {
+            Progress p;
+            p.done = position;
+            p.total = length;
+            p.steps = steps;
+            p.busy = busy;
+            return p;
+        }
+
+        Hasher &hasher()
+        {
+            return hasher_;
+        }
+
+        /**
+         * @brief
+         *      reuse the job and its hasher for another buffer; the hasher
+         *      must be ready for new data (GetHash() resets Stream, Sha26
+         *      and Md5 need reset())
+         */
+        void restart(const byte *data, size_t len);
+
+    private:
+        ///< feed up to bytes, whole blocks unless it reaches the end
+        void feed(size_t bytes);
+
+        Hasher hasher_;
+        const byte *data;
+        size_t length;
+        size_t position = 0;
+        uint64_t steps = 0;
+        std::chrono::nanoseconds busy{0};
+    };
+
+    ///< Implementation
+    template <typename Hasher, size_t BlockSize>
+    template <typename... Args>
+    HashJob<Hasher, BlockSize>::HashJob(const byte *data, size_t len, Args &&...args)
+        : hasher_(std::forward<Args>(args)...), data(data), length(len)
+    {
+    }
+
+    template <typename Hasher, size_t BlockSize>
+    void HashJob<Hasher, BlockSize>::restart(const byte *data, size_t len)
+    {
+        this->data = data;
+        length = len;
+        position = 0;
+        steps = 0;
+        busy = std::chrono::nanoseconds(0);
+    }
+
+    template <typename Hasher, size_t BlockSize>
+    void HashJob<Hasher, BlockSize>::feed(size_t bytes)
+    {
+        size_t left = length - position;
+        size_t n = left <= bytes ? left : std::max(bytes / BlockSize, size_t(1)) * BlockSize;
+        n = std::min(n, left);
+
+        hasher_.addData(data + position, n);
+        position += n;
+    }
+
+    template <typename Hasher, size_t BlockSize>
+    bool HashJob<Hasher, BlockSize>::step(size_t bytes)
+    {
+        if (done())
+            return true;
+
+        auto start = std::chrono::steady_clock::now();
+        feed(bytes);
+        busy += std::chrono::steady_clock::now() - start;
+        ++steps;
+        return done();
+    }
+
+    template <typename Hasher, size_t BlockSize>
+    bool HashJob<Hasher, BlockSize>::step(std::chrono::nanoseconds budget)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        if (done())
+            return true;
+
+        const Clock::time_point start = Clock::now();
+        Clock::duration elapsed{0};
+        for (uint64_t slices = 1;; ++slices)
+        {
+            feed(HashJobDetail::SliceBytes);
+            elapsed = Clock::now() - start;
+
+            ///< stop before a slice of average length would cross the budget
+            if (done() || elapsed + elapsed / slices > budget)
+                break;
+        }
+
+        busy += elapsed;
+        ++steps;
+        return done();
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_HASH_JOB_HPP */
@@ -0,0 +1,165 @@
+#ifndef CRYPTOGRAPHY_HASHER_POOL_HPP
+#define CRYPTOGRAPHY_HASHER_POOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace Crypto
+{
+    /**
+     * @brief
+     *      per thread cache of ready to use hasher contexts (Sha26, Md5,
+     *      Blake3, Crc32c, ... anything with reset()).
+     *
+     *      acquire() hands out a Lease, the lease resets its context and puts
+     *      it back on the pool of the thread that releases it. Once a thread
+     *      has warmed up, acquiring and releasing never allocates.
+     *
+     * @code
+     *      auto sha = HasherPool<Sha26>::acquire();
+     *      sha->addData(data, len);
+     *      std::vector<byte> digest = sha->GetHash();
+     * @endcode
+     */
+    template <typename Hasher>
+    class HasherPool
+    {
+    public:
+        ///< idle contexts kept per thread, extra ones are destroyed on release
+        static constexpr size_t MaxIdle = 16;
+
+        class Lease
+        {
+        public:
+            Lease(const Lease &) = delete;
+            Lease &operator=(const Lease &) = delete;
+
+            Lease(Lease &&other) noexcept : hasher(other.hasher)
+            {
+                other.hasher = nullptr;
+            }
+
+            Lease &operator=(Lease &&other) noexcept
+            {
+                if (this != &other)
+                {
+                    release();
+                    hasher = other.hasher;
+                    other.hasher = nullptr;
+                }
+                return *this;
+            }
+
+            ~Lease()
+            {
+                release();
+            }
+
+            Hasher *operator->() const
+            {
+                return hasher;
+            }
+
+            Hasher &operator*() const
+            {
+                return *hasher;
+            }
+
+            Hasher *get() const
+            {
+                return hasher;
+            }
+
+            /**
+             * @brief
+             *      reset the context and hand it back now, the lease is
+             *      empty afterwards
+             */
+            void release();
+
+        private:
+            friend class HasherPool;
+
+            explicit Lease(Hasher *hasher) : hasher(hasher)
+            {
+            }
+
+            Hasher *hasher;
+        };
+
+        /**
+         * @brief
+         *      a context in its initial state, from this thread's pool when
+         *      one is idle
+         */
+        static Lease acquire();
+
+        ///< idle contexts on the calling thread
+        static size_t idle();
+
+    private:
+        struct FreeList
+        {
+            std::vector<Hasher *> hashers;
+
+            FreeList()
+            {
+                ///< reserved once, returning a context never grows the vector
+                hashers.reserve(MaxIdle);
+            }
+
+            ~FreeList()
+            {
+                for (Hasher *hasher : hashers)
+                    delete hasher;
+            }
+        };
+
+        static FreeList &freeList();
+    };
+
+    ///< Implementation
+    template <typename Hasher>
+    typename HasherPool<Hasher>::FreeList &HasherPool<Hasher>::freeList()
+    {
+        thread_local FreeList list;
+        return list;
+    }
+
+    template <typename Hasher>
+    typename HasherPool<Hasher>::Lease HasherPool<Hasher>::acquire()
+    {
+        std::vector<Hasher *> &hashers = freeList().hashers;
+        if (hashers.empty())
+            return Lease(new Hasher());
+
+        Hasher *hasher = hashers.back();
+        hashers.pop_back();
+        return Lease(hasher);
+    }
+
+    template <typename Hasher>
+    size_t HasherPool<Hasher>::idle()
+    {
+        return freeList().hashers.size();
+    }
+
+    template <typename Hasher>
+    void HasherPool<Hasher>::Lease::release()
+    {
+        if (hasher == nullptr)
+            return;
+
+        std::unique_ptr<Hasher> owned(hasher);
+        hasher = nullptr;
+        owned->reset();
+
+        std::vector<Hasher *> &hashers = freeList().hashers;
+        if (hashers.size() < MaxIdle)
+            hashers.push_back(owned.release());
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_HASHER_POOL_HPP */
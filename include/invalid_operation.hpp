@@ -0,0 +1,24 @@
+#ifndef CRYPTOGRAPHY_INVALID_OPERATION_HPP
+#define CRYPTOGRAPHY_INVALID_OPERATION_HPP
+
+#include <exception>
+#include <string>
+
+///< a call the object's current state does not allow, e.g. adding data to a closed hasher
+class InvalidOperationException : public std::exception
+{
+private:
+    std::string msg;
+
+public:
+    InvalidOperationException(const std::string& message = "") : msg(message)
+    {
+    }
+
+    const char * what() const noexcept
+    {
+        return msg.c_str();
+    }
+};
+
+#endif /* end of include guard :  CRYPTOGRAPHY_INVALID_OPERATION_HPP */
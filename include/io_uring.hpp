@@ -0,0 +1,237 @@
+#ifndef CRYPTOGRAPHY_IO_URING_HPP
+#define CRYPTOGRAPHY_IO_URING_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace Crypto
+{
+    /**
+     * @brief
+     *      minimal io_uring wrapper over the raw syscalls (no liburing needed).
+     *
+     *      not thread safe: one thread owns the submission and completion rings.
+     */
+    class IoUring
+    {
+    public:
+        /**
+         * @brief Construct a new Io Uring object
+         *
+         * @param entries
+         *      submission queue size
+         *
+         * @throw std::system_error when the kernel does not provide io_uring
+         */
+        explicit IoUring(unsigned entries);
+
+        IoUring(const IoUring &) = delete;
+        IoUring &operator=(const IoUring &) = delete;
+
+        ~IoUring();
+
+        /**
+         * @brief
+         *      check the kernel implements an opcode (IORING_OP_*)
+         */
+        bool supports(uint8_t opcode) const;
+
+        /**
+         * @brief
+         *      next free submission entry, zeroed
+         *
+         * @return io_uring_sqe* or nullptr when the queue is full
+         */
+        io_uring_sqe *getSqe();
+
+        /**
+         * @brief
+         *      submit the prepared entries and wait for at least waitNr completions
+         *
+         * @return number of entries consumed by the kernel, or -errno
+         */
+        int submit(unsigned waitNr = 0);
+
+        /**
+         * @brief
+         *      oldest unseen completion or nullptr, release it with seen()
+         */
+        io_uring_cqe *peek();
+
+        void seen();
+
+        ///< entries prepared with getSqe() that the kernel has not consumed yet
+        unsigned queued() const
+        {
+            return sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        }
+
+        unsigned entries() const
+        {
+            return sqEntries;
+        }
+
+    private:
+        int fd = -1;
+        unsigned sqEntries = 0;
+
+        void *sqRing = MAP_FAILED;
+        void *cqRing = MAP_FAILED;
+        size_t sqRingSize = 0;
+        size_t cqRingSize = 0;
+        io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+
+        unsigned *sqHead = nullptr;
+        unsigned *sqTail = nullptr;
+        unsigned *sqArray = nullptr;
+        unsigned sqMask = 0;
+        unsigned sqeTail = 0;
+
+        unsigned *cqHead = nullptr;
+        unsigned *cqTail = nullptr;
+        unsigned cqMask = 0;
+        io_uring_cqe *cqes = nullptr;
+
+        std::vector<uint8_t> supported;
+
+        void release();
+    };
+
+    ///< Implementation
+    inline IoUring::IoUring(unsigned entries)
+    {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+
+        sqEntries = p.sq_entries;
+        sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+            sqRingSize = cqRingSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cqRing = single ? sqRing
+                        : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes = static_cast<io_uring_sqe *>(mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED)
+        {
+            int err = errno;
+            release();
+            throw std::system_error(err, std::generic_category(), "io_uring mmap");
+        }
+
+        char *sq = static_cast<char *>(sqRing);
+        sqHead = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+        sqTail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+        sqeTail = *sqTail;
+
+        char *cq = static_cast<char *>(cqRing);
+        cqHead = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+        ///< ask which opcodes this kernel knows, older kernels lack the probe itself
+        const unsigned probeOps = 256;
+        std::vector<char> buf(sizeof(io_uring_probe) + probeOps * sizeof(io_uring_probe_op), 0);
+        io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(buf.data());
+        supported.assign(probeOps, 0);
+
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, probeOps) == 0)
+        {
+            for (unsigned i = 0; i < probe->ops_len && i < probeOps; ++i)
+                supported[probe->ops[i].op] = (probe->ops[i].flags & IO_URING_OP_SUPPORTED) != 0;
+        }
+    }
+
+    inline IoUring::~IoUring()
+    {
+        release();
+    }
+
+    inline void IoUring::release()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqEntries * sizeof(io_uring_sqe));
+        if (cqRing != MAP_FAILED && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+        if (fd >= 0)
+            close(fd);
+
+        sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+        sqRing = cqRing = MAP_FAILED;
+        fd = -1;
+    }
+
+    inline bool IoUring::supports(uint8_t opcode) const
+    {
+        return supported[opcode] != 0;
+    }
+
+    inline io_uring_sqe *IoUring::getSqe()
+    {
+        unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (sqeTail - head >= sqEntries)
+            return nullptr;
+
+        unsigned index = sqeTail & sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        sqeTail += 1;
+
+        return sqe;
+    }
+
+    inline int IoUring::submit(unsigned waitNr)
+    {
+        unsigned toSubmit = sqeTail - *sqTail;
+        __atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+
+        unsigned flags = waitNr > 0 ? IORING_ENTER_GETEVENTS : 0;
+        for (;;)
+        {
+            long ret = syscall(__NR_io_uring_enter, fd, toSubmit, waitNr, flags, nullptr, 0);
+            if (ret >= 0)
+                return static_cast<int>(ret);
+            if (errno != EINTR)
+                return -errno;
+        }
+    }
+
+    inline io_uring_cqe *IoUring::peek()
+    {
+        unsigned head = *cqHead;
+        if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+            return nullptr;
+        return &cqes[head & cqMask];
+    }
+
+    inline void IoUring::seen()
+    {
+        __atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE);
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_IO_URING_HPP */
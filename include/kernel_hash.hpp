@@ -0,0 +1,595 @@
+#ifndef CRYPTOGRAPHY_KERNEL_HASH_HPP
+#define CRYPTOGRAPHY_KERNEL_HASH_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash_dispatch.hpp"
+
+#ifdef __linux__
+#include <linux/if_alg.h>
+#endif
+
+#ifndef AF_ALG
+#define AF_ALG 38
+#endif
+
+namespace Crypto
+{
+    /**
+     * @brief
+     *      SHA-256 / MD5 through the Linux kernel crypto API (AF_ALG hash
+     *      sockets, algif_hash).
+     *
+     *      addFd splices file data straight from the page cache into the
+     *      socket, the bytes never enter user memory, and the kernel picks
+     *      its best driver (possibly an offload engine). Every send carries
+     *      MSG_MORE / SPLICE_F_MORE, reading the digest finalizes and leaves
+     *      the socket ready for the next message.
+     *
+     *      sendfile is not used: it drops SPLICE_F_MORE on the last chunk of
+     *      each call, which finalizes the kernel hash early.
+     *
+     * @code
+     *      std::vector<byte> digest = KernelHash::HashFile(KernelHash::Algorithm::Sha256, "disk.img");
+     * @endcode
+     */
+    class KernelHash
+    {
+    public:
+        enum class Algorithm
+        {
+            Sha256,
+            Md5
+        };
+
+        ///< where a digest was actually computed
+        enum class Backend
+        {
+            Userspace,
+            Kernel
+        };
+
+        /**
+         * @brief
+         *      Userspace: always HashDispatch
+         *      Kernel: AF_ALG whenever algif_hash is there, else userspace
+         *      Auto: AF_ALG for regular files of at least AutoThreshold bytes
+         */
+        enum class Policy
+        {
+            Userspace,
+            Kernel,
+            Auto
+        };
+
+        ///< below this the socket round trips cost more than the copy saved
+        static constexpr uint64_t AutoThreshold = 1 << 20;
+
+        /**
+         * @brief
+         *      open an AF_ALG hash socket
+         *
+         * @throw std::system_error when AF_ALG or the algorithm is unavailable
+         */
+        explicit KernelHash(Algorithm algorithm);
+
+        KernelHash(KernelHash &&other) noexcept;
+        KernelHash &operator=(KernelHash &&other) noexcept;
+        KernelHash(const KernelHash &) = delete;
+        KernelHash &operator=(const KernelHash &) = delete;
+        ~KernelHash();
+
+        void addData(const byte *data, size_t len);
+
+        /**
+         * @brief
+         *      hash len bytes of fd from offset without copying them through
+         *      user memory, or everything up to end of file when len is
+         *      UINT64_MAX. Streams (pipes, sockets, ttys, character devices)
+         *      are read from their current position and offset is ignored.
+         *
+         * @throw std::system_error when fd cannot be read
+         */
+        void addFd(int fd, uint64_t offset = 0, uint64_t len = UINT64_MAX);
+
+        ///< write DigestSize() bytes to out, the context starts over afterwards
+        void GetHash(byte *out);
+
+        std::vector<byte> GetHash();
+
+        size_t DigestSize() const
+        {
+            return algorithm == Algorithm::Md5 ? 16 : 32;
+        }
+
+        ///< drop anything added since the last digest
+        void reset();
+
+        /**
+         * @brief
+         *      true when an AF_ALG socket for the algorithm can be opened,
+         *      probed once per process (algif_hash may be a missing module)
+         */
+        static bool Available(Algorithm algorithm);
+
+        /**
+         * @brief
+         *      driver the kernel uses for the algorithm, e.g. "sha256-ni",
+         *      from /proc/crypto; empty when unknown
+         */
+        static std::string Driver(Algorithm algorithm);
+
+        /**
+         * @brief
+         *      process wide default for HashFd / HashFile, initially taken
+         *      from CRYPTOGRAPHY_HASH_BACKEND ("user", "kernel" or "auto"),
+         *      Userspace when unset
+         */
+        static Policy policy();
+
+        static void setPolicy(Policy policy);
+
+        ///< backend the policy picks for size bytes of a (regular when seekable) fd
+        static Backend Select(Algorithm algorithm, Policy policy, uint64_t size, bool seekable);
+
+        /**
+         * @brief
+         *      digest of everything from the current position of fd to end of
+         *      file, through the backend the policy picks; used, when given,
+         *      receives that backend
+         *
+         * @throw std::system_error on read errors
+         */
+        static std::vector<byte> HashFd(Algorithm algorithm, int fd, Policy policy = KernelHash::policy(),
+                                        Backend *used = nullptr);
+
+        static std::vector<byte> HashFile(Algorithm algorithm, const std::string &path,
+                                          Policy policy = KernelHash::policy(), Backend *used = nullptr);
+
+    private:
+        ///< data is spliced file -> pipe -> socket
+        void openPipe();
+
+        ///< move n bytes already in the pipe into the socket
+        void drainPipe(size_t n);
+
+        void sendAll(const byte *data, size_t len);
+
+        ///< addFd counting in consumed the bytes taken from fd, also when it throws
+        void addFd(int fd, uint64_t offset, uint64_t len, uint64_t &consumed);
+
+        static std::atomic<int> &policySlot();
+
+        Algorithm algorithm;
+        int tfm = -1;
+        int op = -1;
+        int pipe[2] = {-1, -1};
+        size_t pipeSize = 0;
+    };
+
+    ///< Implementation
+    namespace KernelHashDetail
+    {
+        inline const char *Name(KernelHash::Algorithm algorithm)
+        {
+            return algorithm == KernelHash::Algorithm::Md5 ? "md5" : "sha256";
+        }
+
+        inline void CloseFd(int &fd)
+        {
+            if (fd >= 0)
+                close(fd);
+            fd = -1;
+        }
+
+        inline HashDispatch::Function DispatchFunction(KernelHash::Algorithm algorithm)
+        {
+            return algorithm == KernelHash::Algorithm::Md5 ? HashDispatch::Function::Md5 : HashDispatch::Function::Sha256;
+        }
+    } // namespace KernelHashDetail
+
+    inline KernelHash::KernelHash(Algorithm algorithm) : algorithm(algorithm)
+    {
+#ifdef __linux__
+        tfm = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (tfm < 0)
+            throw std::system_error(errno, std::generic_category(), "AF_ALG socket");
+
+        sockaddr_alg address = {};
+        address.salg_family = AF_ALG;
+        std::strcpy(reinterpret_cast<char *>(address.salg_type), "hash");
+        std::strcpy(reinterpret_cast<char *>(address.salg_name), KernelHashDetail::Name(algorithm));
+
+        if (bind(tfm, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+            (op = accept4(tfm, nullptr, nullptr, SOCK_CLOEXEC)) < 0)
+        {
+            int err = errno;
+            KernelHashDetail::CloseFd(tfm);
+            throw std::system_error(err, std::generic_category(), std::string("AF_ALG ") + KernelHashDetail::Name(algorithm));
+        }
+#else
+        throw std::system_error(EAFNOSUPPORT, std::generic_category(), "AF_ALG");
+#endif
+    }
+
+    inline KernelHash::KernelHash(KernelHash &&other) noexcept
+        : algorithm(other.algorithm), tfm(other.tfm), op(other.op), pipe{other.pipe[0], other.pipe[1]}, pipeSize(other.pipeSize)
+    {
+        other.tfm = other.op = other.pipe[0] = other.pipe[1] = -1;
+    }
+
+    inline KernelHash &KernelHash::operator=(KernelHash &&other) noexcept
+    {
+        if (this != &other)
+        {
+            std::swap(algorithm, other.algorithm);
+            std::swap(tfm, other.tfm);
+            std::swap(op, other.op);
+            std::swap(pipe, other.pipe);
+            std::swap(pipeSize, other.pipeSize);
+        }
+        return *this;
+    }
+
+    inline KernelHash::~KernelHash()
+    {
+        KernelHashDetail::CloseFd(pipe[0]);
+        KernelHashDetail::CloseFd(pipe[1]);
+        KernelHashDetail::CloseFd(op);
+        KernelHashDetail::CloseFd(tfm);
+    }
+
+    inline void KernelHash::sendAll(const byte *data, size_t len)
+    {
+        while (len > 0)
+        {
+            ssize_t n = send(op, data, len, MSG_MORE);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "AF_ALG send");
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+    }
+
+    inline void KernelHash::addData(const byte *data, size_t len)
+    {
+        sendAll(data, len);
+    }
+
+    inline void KernelHash::openPipe()
+    {
+        if (pipe[0] >= 0)
+            return;
+
+        if (pipe2(pipe, O_CLOEXEC) != 0)
+            throw std::system_error(errno, std::generic_category(), "pipe");
+
+        ///< a bigger pipe means fewer splice round trips, the default 64 KiB still works
+        int size = fcntl(pipe[1], F_SETPIPE_SZ, 1 << 20);
+        if (size < 0)
+            size = fcntl(pipe[1], F_GETPIPE_SZ);
+        pipeSize = size > 0 ? static_cast<size_t>(size) : 65536;
+    }
+
+    inline void KernelHash::drainPipe(size_t n)
+    {
+        while (n > 0)
+        {
+            ssize_t moved = splice(pipe[0], nullptr, op, nullptr, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (moved > 0)
+            {
+                n -= static_cast<size_t>(moved);
+                continue;
+            }
+            if (moved < 0 && errno == EINTR)
+                continue;
+            if (moved < 0 && errno != EINVAL)
+                throw std::system_error(errno, std::generic_category(), "splice to AF_ALG");
+
+            ///< socket refuses spliced pages (older kernels): copy what is in the pipe
+            byte buffer[65536];
+            while (n > 0)
+            {
+                ssize_t got = read(pipe[0], buffer, std::min(n, sizeof(buffer)));
+                if (got < 0 && errno == EINTR)
+                    continue;
+                if (got <= 0)
+                    throw std::system_error(got < 0 ? errno : EIO, std::generic_category(), "pipe read");
+                sendAll(buffer, static_cast<size_t>(got));
+                n -= static_cast<size_t>(got);
+            }
+        }
+    }
+
+    inline void KernelHash::addFd(int fd, uint64_t offset, uint64_t len)
+    {
+        uint64_t consumed = 0;
+        addFd(fd, offset, len, consumed);
+    }
+
+    inline void KernelHash::addFd(int fd, uint64_t offset, uint64_t len, uint64_t &consumed)
+    {
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+            throw std::system_error(errno, std::generic_category(), "fstat");
+
+        ///< only files and block devices take an offset, anything else is read where it stands
+        const bool isPipe = S_ISFIFO(st.st_mode);
+        const bool isStream = !(S_ISREG(st.st_mode) || S_ISBLK(st.st_mode));
+        loff_t position = static_cast<loff_t>(offset);
+
+        ///< a pipe splices straight into the socket
+        if (isPipe)
+        {
+            while (len > 0)
+            {
+                size_t chunk = static_cast<size_t>(std::min<uint64_t>(len, 1 << 20));
+                ssize_t moved = splice(fd, nullptr, op, nullptr, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (moved < 0 && errno == EINTR)
+                    continue;
+                if (moved < 0 && errno == EINVAL)
+                    break;
+                if (moved < 0)
+                    throw std::system_error(errno, std::generic_category(), "splice to AF_ALG");
+                if (moved == 0)
+                    return;
+                len -= static_cast<uint64_t>(moved);
+                consumed += static_cast<uint64_t>(moved);
+            }
+        }
+
+        openPipe();
+
+        while (len > 0)
+        {
+            size_t chunk = static_cast<size_t>(std::min<uint64_t>(len, pipeSize));
+            ssize_t moved = splice(fd, isStream ? nullptr : &position, pipe[1], nullptr, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (moved < 0 && errno == EINTR)
+                continue;
+            if (moved < 0 && errno == EINVAL)
+                break;
+            if (moved < 0)
+                throw std::system_error(errno, std::generic_category(), "splice from fd");
+            if (moved == 0)
+                return;
+
+            consumed += static_cast<uint64_t>(moved);
+            drainPipe(static_cast<size_t>(moved));
+            len -= static_cast<uint64_t>(moved);
+        }
+
+        ///< the file system cannot splice: plain reads, still hashed in the kernel
+        std::vector<byte> buffer(1 << 20);
+        while (len > 0)
+        {
+            size_t chunk = static_cast<size_t>(std::min<uint64_t>(len, buffer.size()));
+            ssize_t got = isStream ? read(fd, buffer.data(), chunk) : pread(fd, buffer.data(), chunk, position);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got < 0)
+                throw std::system_error(errno, std::generic_category(), "read");
+            if (got == 0)
+                return;
+
+            consumed += static_cast<uint64_t>(got);
+            sendAll(buffer.data(), static_cast<size_t>(got));
+            position += got;
+            len -= static_cast<uint64_t>(got);
+        }
+    }
+
+    inline void KernelHash::GetHash(byte *out)
+    {
+        size_t size = DigestSize();
+        for (;;)
+        {
+            ssize_t n = read(op, out, size);
+            if (n == static_cast<ssize_t>(size))
+                return;
+            if (n < 0 && errno == EINTR)
+                continue;
+            throw std::system_error(n < 0 ? errno : EIO, std::generic_category(), "AF_ALG digest");
+        }
+    }
+
+    inline std::vector<byte> KernelHash::GetHash()
+    {
+        std::vector<byte> digest(DigestSize());
+        GetHash(digest.data());
+        return digest;
+    }
+
+    inline void KernelHash::reset()
+    {
+        byte discard[32];
+        GetHash(discard);
+    }
+
+    inline bool KernelHash::Available(Algorithm algorithm)
+    {
+        ///< 0 unknown, 1 available, 2 missing; racing probes agree
+        static std::atomic<int> probed[2];
+        std::atomic<int> &state = probed[algorithm == Algorithm::Md5 ? 1 : 0];
+
+        int known = state.load(std::memory_order_acquire);
+        if (known == 0)
+        {
+            try
+            {
+                KernelHash probe(algorithm);
+                known = 1;
+            }
+            catch (const std::system_error &)
+            {
+                known = 2;
+            }
+            state.store(known, std::memory_order_release);
+        }
+        return known == 1;
+    }
+
+    inline std::string KernelHash::Driver(Algorithm algorithm)
+    {
+        std::ifstream crypto("/proc/crypto");
+        const std::string name = KernelHashDetail::Name(algorithm);
+
+        std::string line, entryName, entryDriver, best;
+        long bestPriority = -1;
+        auto value = [](const std::string &line) {
+            size_t colon = line.find(':');
+            return colon == std::string::npos ? std::string() : line.substr(line.find_first_not_of(' ', colon + 1));
+        };
+
+        ///< entries are blank line separated, the highest priority one serves requests
+        while (std::getline(crypto, line))
+        {
+            if (line.compare(0, 4, "name") == 0)
+                entryName = value(line);
+            else if (line.compare(0, 6, "driver") == 0)
+                entryDriver = value(line);
+            else if (line.compare(0, 8, "priority") == 0 && entryName == name)
+            {
+                long priority = std::strtol(value(line).c_str(), nullptr, 10);
+                if (priority > bestPriority)
+                {
+                    bestPriority = priority;
+                    best = entryDriver;
+                }
+            }
+        }
+        return best;
+    }
+
+    inline std::atomic<int> &KernelHash::policySlot()
+    {
+        static std::atomic<int> slot([] {
+            const char *backend = std::getenv("CRYPTOGRAPHY_HASH_BACKEND");
+            if (backend != nullptr && std::strcmp(backend, "kernel") == 0)
+                return static_cast<int>(Policy::Kernel);
+            if (backend != nullptr && std::strcmp(backend, "auto") == 0)
+                return static_cast<int>(Policy::Auto);
+            return static_cast<int>(Policy::Userspace);
+        }());
+        return slot;
+    }
+
+    inline KernelHash::Policy KernelHash::policy()
+    {
+        return static_cast<Policy>(policySlot().load(std::memory_order_relaxed));
+    }
+
+    inline void KernelHash::setPolicy(Policy policy)
+    {
+        policySlot().store(static_cast<int>(policy), std::memory_order_relaxed);
+    }
+
+    inline KernelHash::Backend KernelHash::Select(Algorithm algorithm, Policy policy, uint64_t size, bool seekable)
+    {
+        if (policy == Policy::Userspace)
+            return Backend::Userspace;
+        if (policy == Policy::Auto && (!seekable || size < AutoThreshold))
+            return Backend::Userspace;
+        return Available(algorithm) ? Backend::Kernel : Backend::Userspace;
+    }
+
+    inline std::vector<byte> KernelHash::HashFd(Algorithm algorithm, int fd, Policy policy, Backend *used)
+    {
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+            throw std::system_error(errno, std::generic_category(), "fstat");
+
+        const bool seekable = S_ISREG(st.st_mode) || S_ISBLK(st.st_mode);
+        off_t position = seekable ? lseek(fd, 0, SEEK_CUR) : 0;
+        if (position < 0)
+            position = 0;
+        uint64_t size = S_ISREG(st.st_mode) && st.st_size > position ? static_cast<uint64_t>(st.st_size - position) : 0;
+
+        Backend backend = Select(algorithm, policy, size, seekable);
+
+        if (backend == Backend::Kernel)
+        {
+            ///< the module can still vanish or refuse the fd, the userspace path is always there
+            uint64_t consumed = 0;
+            try
+            {
+                KernelHash hash(algorithm);
+                hash.addFd(fd, static_cast<uint64_t>(position), UINT64_MAX, consumed);
+                if (seekable)
+                    lseek(fd, 0, SEEK_END);
+                if (used != nullptr)
+                    *used = Backend::Kernel;
+                return hash.GetHash();
+            }
+            catch (const std::system_error &)
+            {
+                ///< bytes already consumed from a stream cannot be replayed
+                if (!seekable && consumed > 0)
+                    throw;
+            }
+        }
+
+        HashDispatch::Stream stream(KernelHashDetail::DispatchFunction(algorithm));
+        std::vector<byte> buffer(1 << 20);
+        for (;;)
+        {
+            ssize_t got = seekable ? pread(fd, buffer.data(), buffer.size(), position) : read(fd, buffer.data(), buffer.size());
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got < 0)
+                throw std::system_error(errno, std::generic_category(), "read");
+            if (got == 0)
+                break;
+
+            stream.addData(buffer.data(), static_cast<size_t>(got));
+            position += got;
+        }
+        if (seekable)
+            lseek(fd, position, SEEK_SET);
+
+        std::vector<byte> digest(stream.DigestSize());
+        stream.GetHash(digest.data());
+        if (used != nullptr)
+            *used = Backend::Userspace;
+        return digest;
+    }
+
+    inline std::vector<byte> KernelHash::HashFile(Algorithm algorithm, const std::string &path, Policy policy, Backend *used)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+
+        try
+        {
+            std::vector<byte> digest = HashFd(algorithm, fd, policy, used);
+            close(fd);
+            return digest;
+        }
+        catch (...)
+        {
+            close(fd);
+            throw;
+        }
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_KERNEL_HASH_HPP */
@@ -1,11 +1,20 @@
 #ifndef CRYPTOGRAPHY_MD5_HPP
 #define CRYPTOGRAPHY_MD5_HPP
 
+#include <array>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <sstream>
+#include <iomanip>
 #include <functional>
 #include <any>
+#include <algorithm>
+#include <unordered_map>
+
+#include <sys/uio.h>
+
+#include "invalid_operation.hpp"
 
 typedef unsigned char byte;
 
@@ -20,11 +29,57 @@ public:
 	static std::string toHex(uint32_t num)
 	{
 		std::stringstream stream;
-		stream << std::hex << num;
+		stream << std::hex << std::setw(8) << std::setfill('0') << num;
 		return stream.str();
 	}
 };
 
+template <typename T>
+class EventHelper final
+{
+private:
+	std::unordered_map<std::string, T> namedListeners;
+
+public:
+	void addListener(const std::string &methodName, T namedEventHandlerMethod)
+	{
+		if (namedListeners.find(methodName) == namedListeners.end())
+			namedListeners[methodName] = namedEventHandlerMethod;
+	}
+	void removeListener(const std::string &methodName)
+	{
+		if (namedListeners.find(methodName) != namedListeners.end())
+			namedListeners.erase(methodName);
+	}
+
+private:
+	std::vector<T> anonymousListeners;
+
+public:
+	void addListener(T unnamedEventHandlerMethod)
+	{
+		anonymousListeners.push_back(unnamedEventHandlerMethod);
+	}
+
+	std::vector<T> listeners()
+	{
+		std::vector<T> allListeners;
+		for (auto listener : namedListeners)
+		{
+			allListeners.push_back(listener.second);
+		}
+		allListeners.insert(allListeners.end(), anonymousListeners.begin(), anonymousListeners.end());
+		return allListeners;
+	}
+
+	template <typename... Args>
+	void invoke(Args... args)
+	{
+		for (auto listener : listeners())
+			listener(args...);
+	}
+};
+
 namespace Crypto
 {
 	/**
@@ -102,7 +157,7 @@ namespace Crypto
 
 			Digest();
 
-			std::string ToHexString();
+			std::string ToHexString() const;
 		};
 
 		///<< helper class providing suporting function
@@ -144,35 +199,77 @@ namespace Crypto
 
 		///< lookup table 4294967296*sin(i)
 
-	private:
+	public:
 		const static std::vector<uint32_t> T;
 
+		/**
+		 * @brief 
+		 *      compress one block of 16 little endian words into a raw
+		 *      A, B, C, D state, without any buffering or padding
+		 * 
+		 * @param state 
+		 * @param x 
+		 */
+		static void processBlock(std::array<uint32_t, 4> &state, const std::array<uint32_t, 16> &x);
+
+		/**
+		 * @brief 
+		 *      load 64 bytes as 16 little endian words
+		 * 
+		 * @param src 
+		 * @param dest 
+		 */
+		static void toUintArray(const byte *src, std::array<uint32_t, 16> &dest);
+
+	private:
+
 		///< X used to proces data in
 		///< 512 bits chunks as 16 32 bit word
 
-		std::vector<uint32_t> X = std::vector<uint32_t>(16);
+		std::array<uint32_t, 16> X;
 
 		///< the finger print obtained.
-		Digest *_digest;
+		Digest _digest;
 
 		///< the input bytes
 		std::vector<byte> _byteInput;
 
+		///< running state of the streaming interface
+		Digest _state;
+		std::array<byte, 64> _pendingBlock;
+		uint32_t _pendingBlockOff = 0;
+		uint64_t _bitsProcessed = 0;
+		bool _closed = false;
+
 		using ValueChanging = std::function<void(std::any sender, MD5ChangingEventArgs *Changing)>;
 
 		using ValueChanged = std::function<void(std::any sender, MD5ChangedEventArgs *Changed)>;
 
+		///< listeners live inside the hasher, nothing is allocated per instance
+		EventHelper<ValueChanging> _onValueChanging;
+		EventHelper<ValueChanged> _onValueChanged;
+
 	public:
-		EventHelper<ValueChanging> *OnValueChanging = new EventHelper<ValueChanging>();
+		EventHelper<ValueChanging> *OnValueChanging = &_onValueChanging;
 
-		EventHelper<ValueChanged> *OnValueChanged = new EventHelper<ValueChanged>();
+		EventHelper<ValueChanged> *OnValueChanged = &_onValueChanged;
+
+		Md5(const Md5 &) = delete;
+		Md5 &operator=(const Md5 &) = delete;
 
-		///<gets or sets as string
 		virtual ~Md5()
 		{
-			delete _digest;
 		}
 
+		/**
+		 * 	@brief 
+		 * 		start over as a fresh hasher without allocating, listeners
+		 * 		stay registered
+		 */
+		void reset();
+
+		///<gets or sets as string
+
 		std::string getStringValue() const;
 		void setStringValue(const std::string &value);
 
@@ -188,15 +285,43 @@ namespace Crypto
 		 */
 		std::string getHexDigest() const;
 
+		/**
+		 * 	@brief 
+		 * 		streaming interface, hash len more bytes without keeping them
+		 * 
+		 * 	@param data 
+		 * 	@param len 
+		 */
+		void addData(const byte *data, size_t len);
+
+		/**
+		 * 	@brief 
+		 * 		hash the fragments as if they were one contiguous buffer,
+		 * 		blocks straddling two fragments are stitched in the pending
+		 * 		block, all others are read in place
+		 * 
+		 * 	@param fragments 
+		 * 	@param count 
+		 */
+		void addData(const struct iovec *fragments, size_t count);
+
+		/**
+		 * 	@brief 
+		 * 		pad the streamed data and get the 16 byte digest
+		 * 
+		 * 	@return std::vector<byte> 
+		 */
+		std::vector<byte> GetHash();
+
 	private:
 		/**
 		 * 	@brief 
 		 * 		calculat md5 signature of the string in Input
 		 * 
-		 * 	@return Digest* 
+		 * 	@return Digest 
 		 * 		the finger print of msg
 		 */
-		Digest *CalculateMD5Value();
+		Digest CalculateMD5Value();
 
 		/********************************************************
 		 * TRANSFORMATIONS :  FF , GG , HH , II  acc to RFC 1321
@@ -255,6 +380,12 @@ namespace Crypto
 		 */
 		void CopyBlock(std::vector<byte> &bMsg, uint32_t block);
 
+		/**
+		 * 	@brief
+		 * 		Copies the 512 bit block at src into X as 16 32 bit words 
+		 */
+		void CopyBlock(const byte *src);
+
 		///< Constructor
 
 	public:
@@ -262,60 +393,6 @@ namespace Crypto
 	};
 }
 
-#include <string>
-#include <unordered_map>
-#include <vector>
-#include <functional>
-
-template <typename T>
-class EventHelper final
-{
-private:
-	std::unordered_map<std::string, T> namedListeners;
-
-public:
-	void addListener(const std::string &methodName, T namedEventHandlerMethod)
-	{
-		if (namedListeners.find(methodName) == namedListeners.end())
-			namedListeners[methodName] = namedEventHandlerMethod;
-	}
-	void removeListener(const std::string &methodName)
-	{
-		if (namedListeners.find(methodName) != namedListeners.end())
-			namedListeners.erase(methodName);
-	}
-
-private:
-	std::vector<T> anonymousListeners;
-
-public:
-	void addListener(T unnamedEventHandlerMethod)
-	{
-		anonymousListeners.push_back(unnamedEventHandlerMethod);
-	}
-
-	std::vector<T> listeners()
-	{
-		std::vector<T> allListeners;
-		for (auto listener : namedListeners)
-		{
-			allListeners.push_back(listener.second);
-		}
-		allListeners.insert(allListeners.end(), anonymousListeners.begin(), anonymousListeners.end());
-		return allListeners;
-	}
-
-	void invoke(std::any sender, MD5ChangingEventArgs Changing)
-	{
-		T(sender, Changing);
-	}
-
-	void invoke(std::any sender, MD5ChangedEventArgs Changing)
-	{
-		T(sender, Changing);
-	}
-};
-
 namespace Crypto
 {
 
@@ -366,7 +443,7 @@ namespace Crypto
 		D = static_cast<uint32_t>(MD5InitializerConstant::D);
 	}
 
-	std::string Md5::Digest::ToHexString()
+	std::string Md5::Digest::ToHexString() const
 	{
 		std::string st;
 		st = StringHelper::toHex(Md5Helper::ReverseByte(A)) +
@@ -438,7 +515,7 @@ namespace Crypto
 		///< raise the event to notify the change
 		if (OnValueChanged != nullptr)
 		{
-			MD5ChangedEventArgs tempVar2(value, _digest->ToHexString());
+			MD5ChangedEventArgs tempVar2(value, _digest.ToHexString());
 			OnValueChanged->invoke(this, &tempVar2);
 		}
 	}
@@ -472,21 +549,21 @@ namespace Crypto
 		///< notify the changed  value
 		if (OnValueChanged != nullptr)
 		{
-			MD5ChangedEventArgs tempVar2(value, _digest->ToHexString());
+			MD5ChangedEventArgs tempVar2(value, _digest.ToHexString());
 			OnValueChanged->invoke(this, &tempVar2);
 		}
 	}
 
 	std::string Md5::getHexDigest() const
 	{
-		return _digest->ToHexString();
+		return _digest.ToHexString();
 	}
 
-	Md5::Digest *Md5::CalculateMD5Value()
+	Md5::Digest Md5::CalculateMD5Value()
 	{
 		std::vector<byte> bMsg; //buffer to hold bits
 		uint32_t N;				//N is the size of msg as  word (32 bit)
-		auto dg = new Digest(); //  the value to be returned
+		Digest dg;				//  the value to be returned
 
 		// create a buffer with bits padded and length is alos padded
 		bMsg = CreatePaddedBuffer();
@@ -496,14 +573,14 @@ namespace Crypto
 		for (uint32_t i = 0; i < N / 16; i++)
 		{
 			CopyBlock(bMsg, i);
-			PerformTransformation(dg->A, dg->B, dg->C, dg->D);
+			PerformTransformation(dg.A, dg.B, dg.C, dg.D);
 		}
 		return dg;
 	}
 
 	void Md5::TransF(uint32_t &a, uint32_t b, uint32_t c, uint32_t d, uint32_t k, unsigned short s, uint32_t i)
 	{
-		a = b + Md5Helper::RotateLeft((a + ((b & c) | (~*(static_cast<uint32_t *>(&d)))) + X[k] + T[i - 1]), s);
+		a = b + Md5Helper::RotateLeft((a + ((b & c) | (~b & d)) + X[k] + T[i - 1]), s);
 	}
 
 	void Md5::TransG(uint32_t &a, uint32_t b, uint32_t c, uint32_t d, uint32_t k, unsigned short s, uint32_t i)
@@ -691,10 +768,162 @@ namespace Crypto
 		}
 	}
 
+	void Md5::CopyBlock(const byte *src)
+	{
+		for (uint32_t j = 0; j < 16; ++j, src += 4)
+		{
+			X[j] = 
+			((static_cast<uint32_t>(src[3])) << 24) | 
+			((static_cast<uint32_t>(src[2])) << 16) | 
+			((static_cast<uint32_t>(src[1])) << 8) | 
+			((static_cast<uint32_t>(src[0])));
+		}
+	}
+
+	void Md5::toUintArray(const byte *src, std::array<uint32_t, 16> &dest)
+	{
+		for (uint32_t j = 0; j < 16; ++j, src += 4)
+		{
+			dest[j] = 
+			((static_cast<uint32_t>(src[3])) << 24) | 
+			((static_cast<uint32_t>(src[2])) << 16) | 
+			((static_cast<uint32_t>(src[1])) << 8) | 
+			((static_cast<uint32_t>(src[0])));
+		}
+	}
+
+	void Md5::processBlock(std::array<uint32_t, 4> &state, const std::array<uint32_t, 16> &x)
+	{
+		///< per round shift amounts, rounds of 16 steps repeat 4 of them
+		static const unsigned short shifts[4][4] = {{7, 12, 17, 22}, {5, 9, 14, 20}, {4, 11, 16, 23}, {6, 10, 15, 21}};
+
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+
+#pragma GCC unroll 64
+		for (uint32_t i = 0; i < 64; ++i)
+		{
+			uint32_t f, k;
+			switch (i / 16)
+			{
+			case 0:
+				f = (b & c) | (~b & d);
+				k = i;
+				break;
+			case 1:
+				f = (b & d) | (c & ~d);
+				k = (5 * i + 1) % 16;
+				break;
+			case 2:
+				f = b ^ c ^ d;
+				k = (3 * i + 5) % 16;
+				break;
+			default:
+				f = c ^ (b | ~d);
+				k = (7 * i) % 16;
+				break;
+			}
+
+			f += a + x[k] + T[i];
+			a = d;
+			d = c;
+			c = b;
+			b += Md5Helper::RotateLeft(f, shifts[i / 16][i % 4]);
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+	}
+
+	void Md5::addData(const byte *data, size_t len)
+	{
+		if (_closed)
+			throw InvalidOperationException("Adding data to a closed hasher.");
+
+		if (len == 0)
+			return;
+
+		_bitsProcessed += static_cast<uint64_t>(len) * 8;
+
+		///< top up a partial block first
+		if (_pendingBlockOff > 0)
+		{
+			size_t amount_to_copy = std::min<size_t>(64 - _pendingBlockOff, len);
+
+			std::copy_n(data, amount_to_copy, _pendingBlock.begin() + _pendingBlockOff);
+			data += amount_to_copy;
+			len -= amount_to_copy;
+			_pendingBlockOff += static_cast<uint32_t>(amount_to_copy);
+
+			if (_pendingBlockOff < 64)
+				return;
+
+			CopyBlock(_pendingBlock.data());
+			PerformTransformation(_state.A, _state.B, _state.C, _state.D);
+			_pendingBlockOff = 0;
+		}
+
+		///< whole blocks are compressed straight from the caller's memory
+		for (; len >= 64; len -= 64, data += 64)
+		{
+			CopyBlock(data);
+			PerformTransformation(_state.A, _state.B, _state.C, _state.D);
+		}
+
+		std::copy_n(data, len, _pendingBlock.begin());
+		_pendingBlockOff = static_cast<uint32_t>(len);
+	}
+
+	void Md5::addData(const struct iovec *fragments, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i)
+			addData(static_cast<const byte *>(fragments[i].iov_base), fragments[i].iov_len);
+	}
+
+	std::vector<byte> Md5::GetHash()
+	{
+		if (!_closed)
+		{
+			uint64_t size_temp = _bitsProcessed;
+
+			const byte first_pad = 0x80;
+			addData(&first_pad, 1);
+
+			///< zero fill up to 56 mod 64, then the bit length little endian
+			std::array<byte, 64 + 8> padding{};
+			size_t zeros = (_pendingBlockOff <= 56 ? 56 : 120) - _pendingBlockOff;
+			for (size_t i = 0; i < 8; ++i)
+				padding[zeros + i] = static_cast<byte>(size_temp >> (8 * i));
+
+			addData(padding.data(), zeros + 8);
+			_closed = true;
+		}
+
+		std::vector<byte> hash(16);
+		const uint32_t words[4] = {_state.A, _state.B, _state.C, _state.D};
+		for (size_t i = 0; i < 16; ++i)
+			hash[i] = static_cast<byte>(words[i / 4] >> (8 * (i % 4)));
+
+		return hash;
+	}
+
 	Md5::Md5()
 	{
 	}
 
+	void Md5::reset()
+	{
+		_state = Digest();
+		_pendingBlockOff = 0;
+		_bitsProcessed = 0;
+		_closed = false;
+
+		///< keeps the capacity, so a reused hasher does not allocate again
+		_byteInput.clear();
+		_digest = Digest();
+	}
+
 } ///< namespace Crypto
 
 #endif /* end of include guard :  CRYPTOGRAPHY_MD5_HPP */
@@ -0,0 +1,161 @@
+#ifndef CRYPTOGRAPHY_MD5_LANES_HPP
+#define CRYPTOGRAPHY_MD5_LANES_HPP
+
+#include <array>
+#include <cstdint>
+
+#include "cpu_features.hpp"
+#include "md5.hpp"
+
+#ifdef CRYPTOGRAPHY_X86
+#include <immintrin.h>
+#endif
+
+namespace Crypto
+{
+    /**
+     * @brief
+     *      MD5 compression of several independent messages at once.
+     *
+     *      same word major layout as Sha256Lanes: state[w][lane] is word w
+     *      (A, B, C, D) of lane, m[i][lane] the little endian message word i.
+     */
+    class Md5Lanes
+    {
+    public:
+        static constexpr size_t MaxLanes = 8;
+
+        using State = uint32_t[4][MaxLanes];
+        using Block = uint32_t[16][MaxLanes];
+
+        /**
+         * @brief
+         *      compress one block into each of the first lanes states
+         *
+         * @param state
+         * @param m
+         * @param lanes
+         *      number of lanes in use, at most MaxLanes
+         */
+        static void compress(State &state, const Block &m, size_t lanes = MaxLanes);
+
+        /**
+         * @brief
+         *      true when compress runs all lanes in one SIMD pass
+         */
+        static bool vectorized();
+
+        /**
+         * @brief
+         *      one lane at a time with Md5::processBlock
+         */
+        static void compressPortable(State &state, const Block &m, size_t lanes);
+
+#ifdef CRYPTOGRAPHY_X86
+        /**
+         * @brief
+         *      8 lanes in the 8 32-bit elements of AVX2 registers
+         */
+        static void compressAvx2(State &state, const Block &m);
+#endif
+    };
+
+    ///< Implementation
+    inline bool Md5Lanes::vectorized()
+    {
+        return CpuFeatures::get().avx2;
+    }
+
+    inline void Md5Lanes::compress(State &state, const Block &m, size_t lanes)
+    {
+#ifdef CRYPTOGRAPHY_X86
+        if (lanes > 1 && CpuFeatures::get().avx2)
+        {
+            compressAvx2(state, m);
+            return;
+        }
+#endif
+        compressPortable(state, m, lanes);
+    }
+
+    inline void Md5Lanes::compressPortable(State &state, const Block &m, size_t lanes)
+    {
+        std::array<uint32_t, 4> s;
+        std::array<uint32_t, 16> x;
+
+        for (size_t lane = 0; lane < lanes; ++lane)
+        {
+            for (size_t i = 0; i < 4; ++i)
+                s[i] = state[i][lane];
+            for (size_t i = 0; i < 16; ++i)
+                x[i] = m[i][lane];
+
+            Md5::processBlock(s, x);
+
+            for (size_t i = 0; i < 4; ++i)
+                state[i][lane] = s[i];
+        }
+    }
+
+#ifdef CRYPTOGRAPHY_X86
+    __attribute__((target("avx2"))) inline void Md5Lanes::compressAvx2(State &state, const Block &m)
+    {
+        using V = __m256i;
+        static const int shifts[4][4] = {{7, 12, 17, 22}, {5, 9, 14, 20}, {4, 11, 16, 23}, {6, 10, 15, 21}};
+
+        V x[16];
+        for (size_t i = 0; i < 16; ++i)
+            x[i] = _mm256_loadu_si256(reinterpret_cast<const V *>(m[i]));
+
+        V a0 = _mm256_loadu_si256(reinterpret_cast<const V *>(state[0]));
+        V b0 = _mm256_loadu_si256(reinterpret_cast<const V *>(state[1]));
+        V c0 = _mm256_loadu_si256(reinterpret_cast<const V *>(state[2]));
+        V d0 = _mm256_loadu_si256(reinterpret_cast<const V *>(state[3]));
+        V a = a0, b = b0, c = c0, d = d0;
+        const V ones = _mm256_set1_epi32(-1);
+
+#pragma GCC unroll 64
+        for (int i = 0; i < 64; ++i)
+        {
+            V f;
+            int k;
+            switch (i / 16)
+            {
+            case 0:
+                f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_andnot_si256(b, d));
+                k = i;
+                break;
+            case 1:
+                f = _mm256_or_si256(_mm256_and_si256(b, d), _mm256_andnot_si256(d, c));
+                k = (5 * i + 1) % 16;
+                break;
+            case 2:
+                f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+                k = (3 * i + 5) % 16;
+                break;
+            default:
+                f = _mm256_xor_si256(c, _mm256_or_si256(b, _mm256_xor_si256(d, ones)));
+                k = (7 * i) % 16;
+                break;
+            }
+
+            f = _mm256_add_epi32(_mm256_add_epi32(f, a),
+                                 _mm256_add_epi32(x[k], _mm256_set1_epi32(static_cast<int>(Md5::T[i]))));
+            const int s = shifts[i / 16][i % 4];
+
+            a = d;
+            d = c;
+            c = b;
+            b = _mm256_add_epi32(b, _mm256_or_si256(_mm256_slli_epi32(f, s), _mm256_srli_epi32(f, 32 - s)));
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<V *>(state[0]), _mm256_add_epi32(a, a0));
+        _mm256_storeu_si256(reinterpret_cast<V *>(state[1]), _mm256_add_epi32(b, b0));
+        _mm256_storeu_si256(reinterpret_cast<V *>(state[2]), _mm256_add_epi32(c, c0));
+        _mm256_storeu_si256(reinterpret_cast<V *>(state[3]), _mm256_add_epi32(d, d0));
+    }
+#endif
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_MD5_LANES_HPP */
@@ -0,0 +1,680 @@
+#ifndef CRYPTOGRAPHY_MERKLE_LOG_HPP
+#define CRYPTOGRAPHY_MERKLE_LOG_HPP
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sha256_lanes.hpp"
+#include "sha26.hpp"
+#include "thread_pool.hpp"
+
+namespace Crypto
+{
+    namespace MerkleLogDetail
+    {
+        constexpr char Magic[8] = {'C', 'R', 'Y', 'M', 'R', 'K', 'L', '1'};
+        constexpr uint32_t Version = 1;
+
+        ///< the header owns the first page, levels start page aligned
+        constexpr uint64_t HeaderSize = 4096;
+        constexpr uint64_t InitialCapacity = 1024;
+
+        ///< pairs of one level handed to a single pool task
+        constexpr uint64_t PairsPerTask = 4096;
+
+        ///< on-disk header, little endian, followed by level 0 (leaf hashes),
+        ///< level 1, ... each sized for `capacity` leaves
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t hashSize;
+            uint64_t leafCount;
+            uint64_t capacity;
+        };
+
+        ///< largest power of two strictly below n, n > 1
+        inline uint64_t splitPoint(uint64_t n)
+        {
+            uint64_t k = 1;
+            while (k << 1 < n)
+                k <<= 1;
+            return k;
+        }
+
+        inline unsigned log2(uint64_t n)
+        {
+            unsigned l = 0;
+            while (n >>= 1)
+                ++l;
+            return l;
+        }
+    } // namespace MerkleLogDetail
+
+    /**
+     * @brief
+     *      append-only RFC 6962 Merkle tree over SHA-256, persisted in a memory
+     *      mapped node file.
+     *
+     *      every complete subtree root is stored once, level by level, so
+     *      inclusion and consistency proofs read O(log n) stored nodes and
+     *      never rehash leaves. The current root only needs the in-memory
+     *      frontier (the last node of each level with an odd count).
+     *
+     *      one writer at a time. The leaf count in the header is updated after
+     *      the nodes it covers, sync() makes both durable.
+     */
+    class MerkleLog
+    {
+    public:
+        static constexpr size_t HashSize = 32;
+
+        using Hash = std::array<byte, HashSize>;
+
+        /**
+         * @brief
+         *      open a node file, creating an empty log when it does not exist
+         *
+         * @throw std::system_error on I/O errors,
+         *        std::runtime_error when the file is not a Merkle log
+         */
+        explicit MerkleLog(const std::string &path);
+
+        MerkleLog(const MerkleLog &) = delete;
+        MerkleLog &operator=(const MerkleLog &) = delete;
+
+        ~MerkleLog();
+
+        ///< SHA-256(0x00 || data)
+        static Hash LeafHash(const byte *data, size_t len);
+
+        ///< SHA-256(0x01 || left || right)
+        static Hash NodeHash(const Hash &left, const Hash &right);
+
+        ///< append one leaf given as its data
+        void append(const byte *data, size_t len);
+
+        void appendLeafHash(const Hash &leaf);
+
+        /**
+         * @brief
+         *      append count leaf hashes laid out back to back, each new level
+         *      is hashed in one multi-lane pass
+         */
+        void appendLeafHashes(const byte *leaves, size_t count);
+
+        ///< same, the pairs of a level are split across the pool
+        void appendLeafHashes(const byte *leaves, size_t count, ThreadPool &pool);
+
+        uint64_t size() const
+        {
+            return header->leafCount;
+        }
+
+        ///< root of the current tree, from the frontier only
+        Hash root() const;
+
+        ///< root the tree had when it held treeSize leaves
+        Hash rootAt(uint64_t treeSize) const;
+
+        /**
+         * @brief
+         *      audit path of leaf index in the tree of the first treeSize leaves
+         *
+         * @throw std::out_of_range when index >= treeSize or treeSize > size()
+         */
+        std::vector<Hash> inclusionProof(uint64_t index, uint64_t treeSize) const;
+
+        /**
+         * @brief
+         *      proof that the tree of oldSize leaves is a prefix of the tree of
+         *      newSize leaves
+         *
+         * @throw std::out_of_range when oldSize > newSize or newSize > size()
+         */
+        std::vector<Hash> consistencyProof(uint64_t oldSize, uint64_t newSize) const;
+
+        static bool VerifyInclusion(const Hash &leaf, uint64_t index, uint64_t treeSize,
+                                    const std::vector<Hash> &proof, const Hash &root);
+
+        static bool VerifyConsistency(uint64_t oldSize, uint64_t newSize, const Hash &oldRoot, const Hash &newRoot,
+                                      const std::vector<Hash> &proof);
+
+        ///< flush nodes and header to the file
+        void sync();
+
+    private:
+        ///< hash `pairs` adjacent child pairs into out, 8 pairs per Sha256Lanes pass
+        static void hashPairs(const byte *children, size_t pairs, byte *out);
+
+        ///< SHA-256 of the empty string, the root of an empty tree
+        static Hash emptyRoot();
+
+        byte *node(unsigned level, uint64_t index) const;
+        Hash load(unsigned level, uint64_t index) const;
+
+        Hash subtreeHash(uint64_t begin, uint64_t end) const;
+        void path(uint64_t leaf, uint64_t begin, uint64_t end, std::vector<Hash> &out) const;
+        void subproof(uint64_t oldSize, uint64_t begin, uint64_t end, bool complete, std::vector<Hash> &out) const;
+
+        void reserve(uint64_t leaves);
+        void mapFile(uint64_t capacity);
+        void buildLevels(uint64_t oldSize, uint64_t newSize, ThreadPool *pool);
+
+        static uint64_t fileSize(uint64_t capacity);
+        static uint64_t levelOffset(unsigned level, uint64_t capacity);
+
+        std::string path_;
+        int fd = -1;
+        byte *map = nullptr;
+        size_t mapSize = 0;
+        MerkleLogDetail::Header *header = nullptr;
+
+        ///< frontier[i] is the last level i node, meaningful when bit i of size() is set
+        std::vector<Hash> frontier;
+    };
+
+    ///< Implementation
+    inline uint64_t MerkleLog::levelOffset(unsigned level, uint64_t capacity)
+    {
+        ///< levels 0..level-1 hold capacity + capacity/2 + ... nodes
+        return MerkleLogDetail::HeaderSize + (2 * capacity - 2 * (capacity >> level)) * HashSize;
+    }
+
+    inline uint64_t MerkleLog::fileSize(uint64_t capacity)
+    {
+        return MerkleLogDetail::HeaderSize + (2 * capacity - 1) * HashSize;
+    }
+
+    inline MerkleLog::MerkleLog(const std::string &path) : path_(path)
+    {
+        using namespace MerkleLogDetail;
+
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            int err = errno;
+            close(fd);
+            throw std::system_error(err, std::generic_category(), "stat " + path);
+        }
+
+        if (st.st_size == 0)
+        {
+            try
+            {
+                mapFile(InitialCapacity);
+            }
+            catch (...)
+            {
+                close(fd);
+                throw;
+            }
+            std::memcpy(header->magic, Magic, sizeof(Magic));
+            header->version = Version;
+            header->hashSize = HashSize;
+            header->leafCount = 0;
+            header->capacity = InitialCapacity;
+            frontier.resize(log2(InitialCapacity) + 1);
+            return;
+        }
+
+        Header h;
+        bool valid = static_cast<uint64_t>(st.st_size) >= sizeof(Header) && pread(fd, &h, sizeof(h), 0) == sizeof(h) &&
+                     std::memcmp(h.magic, Magic, sizeof(Magic)) == 0 && h.version == Version &&
+                     h.hashSize == HashSize && h.capacity != 0 && (h.capacity & (h.capacity - 1)) == 0 &&
+                     h.leafCount <= h.capacity && fileSize(h.capacity) == static_cast<uint64_t>(st.st_size);
+        if (!valid)
+        {
+            close(fd);
+            throw std::runtime_error("not a Merkle log: " + path);
+        }
+
+        try
+        {
+            mapFile(h.capacity);
+        }
+        catch (...)
+        {
+            close(fd);
+            throw;
+        }
+
+        uint64_t n = header->leafCount;
+        frontier.resize(log2(header->capacity) + 1);
+        for (unsigned level = 0; (n >> level) != 0; ++level)
+        {
+            if ((n >> level) & 1)
+                frontier[level] = load(level, (n >> level) - 1);
+        }
+    }
+
+    inline MerkleLog::~MerkleLog()
+    {
+        if (map != nullptr)
+            munmap(map, mapSize);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    inline void MerkleLog::mapFile(uint64_t capacity)
+    {
+        uint64_t size = fileSize(capacity);
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+            throw std::system_error(errno, std::generic_category(), "truncate " + path_);
+
+        void *p = map == nullptr ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                                 : mremap(map, mapSize, size, MREMAP_MAYMOVE);
+        if (p == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "mmap " + path_);
+
+        map = static_cast<byte *>(p);
+        mapSize = size;
+        header = reinterpret_cast<MerkleLogDetail::Header *>(map);
+    }
+
+    inline void MerkleLog::reserve(uint64_t leaves)
+    {
+        uint64_t oldCapacity = header->capacity;
+        if (leaves <= oldCapacity)
+            return;
+
+        uint64_t capacity = oldCapacity;
+        while (capacity < leaves)
+            capacity <<= 1;
+
+        mapFile(capacity);
+
+        ///< every level moves up, the top one first so no level overwrites one
+        ///< that has not moved yet
+        uint64_t n = header->leafCount;
+        for (unsigned level = MerkleLogDetail::log2(oldCapacity) + 1; level-- > 0;)
+        {
+            std::memmove(map + levelOffset(level, capacity), map + levelOffset(level, oldCapacity),
+                         (n >> level) * HashSize);
+        }
+
+        header->capacity = capacity;
+        frontier.resize(MerkleLogDetail::log2(capacity) + 1);
+    }
+
+    inline byte *MerkleLog::node(unsigned level, uint64_t index) const
+    {
+        return map + levelOffset(level, header->capacity) + index * HashSize;
+    }
+
+    inline MerkleLog::Hash MerkleLog::load(unsigned level, uint64_t index) const
+    {
+        Hash h;
+        std::memcpy(h.data(), node(level, index), HashSize);
+        return h;
+    }
+
+    inline MerkleLog::Hash MerkleLog::LeafHash(const byte *data, size_t len)
+    {
+        const byte prefix = 0x00;
+        Sha26 sha;
+        sha.addData(&prefix, 1);
+        sha.addData(data, len);
+
+        std::vector<byte> digest = sha.GetHash();
+        Hash h;
+        std::copy(digest.begin(), digest.end(), h.begin());
+        return h;
+    }
+
+    inline MerkleLog::Hash MerkleLog::emptyRoot()
+    {
+        Sha26 sha;
+        std::vector<byte> digest = sha.GetHash();
+        Hash h;
+        std::copy(digest.begin(), digest.end(), h.begin());
+        return h;
+    }
+
+    inline MerkleLog::Hash MerkleLog::NodeHash(const Hash &left, const Hash &right)
+    {
+        byte children[2 * HashSize];
+        std::memcpy(children, left.data(), HashSize);
+        std::memcpy(children + HashSize, right.data(), HashSize);
+
+        Hash h;
+        hashPairs(children, 1, h.data());
+        return h;
+    }
+
+    inline void MerkleLog::hashPairs(const byte *children, size_t pairs, byte *out)
+    {
+        const size_t maxLanes = Sha256Lanes::MaxLanes;
+        Sha256Lanes::State state;
+        Sha256Lanes::Block m;
+
+        for (size_t first = 0; first < pairs; first += maxLanes)
+        {
+            size_t lanes = pairs - first < maxLanes ? pairs - first : maxLanes;
+
+            ///< 0x01 || left || right is 65 bytes: one block of 0x01 and the
+            ///< first 63 child bytes, then the last byte and padding
+            for (size_t lane = 0; lane < maxLanes; ++lane)
+            {
+                const byte *c = children + (first + (lane < lanes ? lane : 0)) * 2 * HashSize;
+
+                m[0][lane] = (0x01u << 24) | (static_cast<uint32_t>(c[0]) << 16) | (static_cast<uint32_t>(c[1]) << 8) | c[2];
+                for (size_t i = 1; i < 16; ++i)
+                {
+                    const byte *p = c + 4 * i - 1;
+                    m[i][lane] = (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+                                 (static_cast<uint32_t>(p[2]) << 8) | p[3];
+                }
+
+                for (size_t i = 0; i < 8; ++i)
+                    state[i][lane] = Sha26::iv[i];
+            }
+
+            Sha256Lanes::compress(state, m, lanes);
+
+            for (size_t lane = 0; lane < maxLanes; ++lane)
+            {
+                const byte *c = children + (first + (lane < lanes ? lane : 0)) * 2 * HashSize;
+
+                m[0][lane] = (static_cast<uint32_t>(c[2 * HashSize - 1]) << 24) | 0x800000;
+                for (size_t i = 1; i < 15; ++i)
+                    m[i][lane] = 0;
+                m[15][lane] = (1 + 2 * HashSize) * 8;
+            }
+
+            Sha256Lanes::compress(state, m, lanes);
+
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                byte *dest = out + (first + lane) * HashSize;
+                for (size_t i = 0; i < 8; ++i)
+                {
+                    dest[4 * i] = static_cast<byte>(state[i][lane] >> 24);
+                    dest[4 * i + 1] = static_cast<byte>(state[i][lane] >> 16);
+                    dest[4 * i + 2] = static_cast<byte>(state[i][lane] >> 8);
+                    dest[4 * i + 3] = static_cast<byte>(state[i][lane]);
+                }
+            }
+        }
+    }
+
+    inline void MerkleLog::append(const byte *data, size_t len)
+    {
+        appendLeafHash(LeafHash(data, len));
+    }
+
+    inline void MerkleLog::appendLeafHash(const Hash &leaf)
+    {
+        appendLeafHashes(leaf.data(), 1);
+    }
+
+    inline void MerkleLog::appendLeafHashes(const byte *leaves, size_t count)
+    {
+        uint64_t n = header->leafCount;
+        reserve(n + count);
+        std::memcpy(node(0, n), leaves, count * HashSize);
+        buildLevels(n, n + count, nullptr);
+    }
+
+    inline void MerkleLog::appendLeafHashes(const byte *leaves, size_t count, ThreadPool &pool)
+    {
+        uint64_t n = header->leafCount;
+        reserve(n + count);
+        std::memcpy(node(0, n), leaves, count * HashSize);
+        buildLevels(n, n + count, &pool);
+    }
+
+    inline void MerkleLog::buildLevels(uint64_t oldSize, uint64_t newSize, ThreadPool *pool)
+    {
+        using MerkleLogDetail::PairsPerTask;
+
+        ///< level i+1 gains the parents of the new level i nodes, a level
+        ///< depends only on the one below it
+        for (unsigned level = 0; (newSize >> (level + 1)) != 0; ++level)
+        {
+            uint64_t from = oldSize >> (level + 1);
+            uint64_t to = newSize >> (level + 1);
+            if (from == to)
+                continue;
+
+            if (pool == nullptr || to - from <= PairsPerTask)
+            {
+                hashPairs(node(level, 2 * from), to - from, node(level + 1, from));
+                continue;
+            }
+
+            std::vector<std::future<void>> tasks;
+            for (uint64_t begin = from; begin < to; begin += PairsPerTask)
+            {
+                uint64_t end = to - begin < PairsPerTask ? to : begin + PairsPerTask;
+                tasks.push_back(pool->submit([this, level, begin, end] {
+                    hashPairs(node(level, 2 * begin), end - begin, node(level + 1, begin));
+                }));
+            }
+            for (std::future<void> &task : tasks)
+                pool->wait(task);
+        }
+
+        for (unsigned level = 0; (newSize >> level) != 0; ++level)
+        {
+            if (((newSize >> level) & 1) && (newSize >> level) != (oldSize >> level))
+                frontier[level] = load(level, (newSize >> level) - 1);
+        }
+
+        __atomic_store_n(&header->leafCount, newSize, __ATOMIC_RELEASE);
+    }
+
+    inline MerkleLog::Hash MerkleLog::root() const
+    {
+        uint64_t n = header->leafCount;
+        if (n == 0)
+            return emptyRoot();
+
+        ///< fold the complete subtrees from the smallest (rightmost) up
+        Hash acc;
+        bool any = false;
+        for (unsigned level = 0; (n >> level) != 0; ++level)
+        {
+            if (((n >> level) & 1) == 0)
+                continue;
+            acc = any ? NodeHash(frontier[level], acc) : frontier[level];
+            any = true;
+        }
+        return acc;
+    }
+
+    inline MerkleLog::Hash MerkleLog::rootAt(uint64_t treeSize) const
+    {
+        if (treeSize > header->leafCount)
+            throw std::out_of_range("Merkle log has fewer leaves");
+        if (treeSize == header->leafCount)
+            return root();
+        return treeSize == 0 ? emptyRoot() : subtreeHash(0, treeSize);
+    }
+
+    inline MerkleLog::Hash MerkleLog::subtreeHash(uint64_t begin, uint64_t end) const
+    {
+        uint64_t n = end - begin;
+
+        ///< proofs only split at power of two boundaries, so a full range is a stored node
+        if ((n & (n - 1)) == 0)
+            return load(MerkleLogDetail::log2(n), begin / n);
+
+        uint64_t k = MerkleLogDetail::splitPoint(n);
+        return NodeHash(subtreeHash(begin, begin + k), subtreeHash(begin + k, end));
+    }
+
+    inline void MerkleLog::path(uint64_t leaf, uint64_t begin, uint64_t end, std::vector<Hash> &out) const
+    {
+        if (end - begin <= 1)
+            return;
+
+        uint64_t k = MerkleLogDetail::splitPoint(end - begin);
+        if (leaf < begin + k)
+        {
+            path(leaf, begin, begin + k, out);
+            out.push_back(subtreeHash(begin + k, end));
+        }
+        else
+        {
+            path(leaf, begin + k, end, out);
+            out.push_back(subtreeHash(begin, begin + k));
+        }
+    }
+
+    inline void MerkleLog::subproof(uint64_t oldSize, uint64_t begin, uint64_t end, bool complete,
+                                    std::vector<Hash> &out) const
+    {
+        uint64_t n = end - begin;
+        if (oldSize == n)
+        {
+            if (!complete)
+                out.push_back(subtreeHash(begin, end));
+            return;
+        }
+
+        uint64_t k = MerkleLogDetail::splitPoint(n);
+        if (oldSize <= k)
+        {
+            subproof(oldSize, begin, begin + k, complete, out);
+            out.push_back(subtreeHash(begin + k, end));
+        }
+        else
+        {
+            subproof(oldSize - k, begin + k, end, false, out);
+            out.push_back(subtreeHash(begin, begin + k));
+        }
+    }
+
+    inline std::vector<MerkleLog::Hash> MerkleLog::inclusionProof(uint64_t index, uint64_t treeSize) const
+    {
+        if (treeSize > header->leafCount || index >= treeSize)
+            throw std::out_of_range("leaf is not in the Merkle tree");
+
+        std::vector<Hash> proof;
+        path(index, 0, treeSize, proof);
+        return proof;
+    }
+
+    inline std::vector<MerkleLog::Hash> MerkleLog::consistencyProof(uint64_t oldSize, uint64_t newSize) const
+    {
+        if (newSize > header->leafCount || oldSize > newSize)
+            throw std::out_of_range("Merkle tree sizes are not consistent");
+
+        std::vector<Hash> proof;
+        if (oldSize != 0 && oldSize != newSize)
+            subproof(oldSize, 0, newSize, true, proof);
+        return proof;
+    }
+
+    inline bool MerkleLog::VerifyInclusion(const Hash &leaf, uint64_t index, uint64_t treeSize,
+                                           const std::vector<Hash> &proof, const Hash &root)
+    {
+        if (index >= treeSize)
+            return false;
+
+        ///< RFC 9162 section 2.1.3.2
+        uint64_t fn = index, sn = treeSize - 1;
+        Hash r = leaf;
+        for (const Hash &p : proof)
+        {
+            if (sn == 0)
+                return false;
+
+            if ((fn & 1) || fn == sn)
+            {
+                r = NodeHash(p, r);
+                while ((fn & 1) == 0 && fn != 0)
+                {
+                    fn >>= 1;
+                    sn >>= 1;
+                }
+            }
+            else
+            {
+                r = NodeHash(r, p);
+            }
+            fn >>= 1;
+            sn >>= 1;
+        }
+
+        return sn == 0 && r == root;
+    }
+
+    inline bool MerkleLog::VerifyConsistency(uint64_t oldSize, uint64_t newSize, const Hash &oldRoot,
+                                             const Hash &newRoot, const std::vector<Hash> &proof)
+    {
+        if (oldSize > newSize)
+            return false;
+        if (oldSize == newSize)
+            return proof.empty() && oldRoot == newRoot;
+        if (oldSize == 0)
+            return proof.empty();
+        if (proof.empty())
+            return false;
+
+        ///< RFC 9162 section 2.1.4.2
+        std::vector<Hash> nodes;
+        if ((oldSize & (oldSize - 1)) == 0)
+            nodes.push_back(oldRoot);
+        nodes.insert(nodes.end(), proof.begin(), proof.end());
+
+        uint64_t fn = oldSize - 1, sn = newSize - 1;
+        while (fn & 1)
+        {
+            fn >>= 1;
+            sn >>= 1;
+        }
+
+        Hash fr = nodes[0], sr = nodes[0];
+        for (size_t i = 1; i < nodes.size(); ++i)
+        {
+            if (sn == 0)
+                return false;
+
+            if ((fn & 1) || fn == sn)
+            {
+                fr = NodeHash(nodes[i], fr);
+                sr = NodeHash(nodes[i], sr);
+                while ((fn & 1) == 0 && fn != 0)
+                {
+                    fn >>= 1;
+                    sn >>= 1;
+                }
+            }
+            else
+            {
+                sr = NodeHash(sr, nodes[i]);
+            }
+            fn >>= 1;
+            sn >>= 1;
+        }
+
+        return sn == 0 && fr == oldRoot && sr == newRoot;
+    }
+
+    inline void MerkleLog::sync()
+    {
+        if (msync(map, mapSize, MS_SYNC) != 0)
+            throw std::system_error(errno, std::generic_category(), "msync " + path_);
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_MERKLE_LOG_HPP */
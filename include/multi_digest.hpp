@@ -0,0 +1,144 @@
+#ifndef CRYPTOGRAPHY_MULTI_DIGEST_HPP
+#define CRYPTOGRAPHY_MULTI_DIGEST_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "crc32c.hpp"
+#include "md5.hpp"
+#include "sha26.hpp"
+
+namespace Crypto
+{
+    /**
+     * @brief
+     *      computes MD5, SHA-256 and CRC-32C in a single pass over the input.
+     *
+     *      the input is walked in tiles small enough to stay in L1/L2 while
+     *      every selected algorithm consumes the tile, so each byte is read
+     *      from memory once instead of once per algorithm.
+     */
+    class MultiDigest
+    {
+    public:
+        enum Algorithm : uint32_t
+        {
+            MD5 = 1 << 0,
+            SHA256 = 1 << 1,
+            CRC32C = 1 << 2,
+            All = MD5 | SHA256 | CRC32C
+        };
+
+        ///< digests of the selected algorithms, the others are left empty
+        struct Result
+        {
+            std::vector<byte> md5;
+            std::vector<byte> sha256;
+            uint32_t crc32c = 0;
+        };
+
+        static constexpr size_t DefaultTileSize = 16 * 1024;
+
+        /**
+         * @brief Construct a new Multi Digest object
+         *
+         * @param algorithms
+         *      bitmask of Algorithm values
+         *
+         * @param tileSize
+         *      bytes handed to each algorithm in turn, rounded up to a multiple of 64
+         */
+        explicit MultiDigest(uint32_t algorithms = All, size_t tileSize = DefaultTileSize);
+
+        /**
+         * @brief
+         *
+         * @param data
+         * @param offset
+         * @param len
+         */
+        void addData(std::vector<byte> &data, uint32_t offset, uint32_t len);
+
+        /**
+         * @brief
+         *
+         * @param data
+         * @param len
+         */
+        void addData(const byte *data, size_t len);
+
+        /**
+         * @brief Get the digests of every selected algorithm, closes the hasher
+         *
+         * @return Result
+         */
+        Result GetResult();
+
+        /**
+         * @brief
+         *      one-shot helper
+         */
+        static Result Hash(const byte *data, size_t len, uint32_t algorithms = All);
+
+    private:
+        uint32_t algorithms;
+        size_t tileSize;
+        Md5 md5;
+        Sha26 sha256;
+        Crc32c crc32c;
+    };
+
+    ///< Implementation
+    inline MultiDigest::MultiDigest(uint32_t algorithms, size_t tileSize)
+        : algorithms(algorithms), tileSize(tileSize == 0 ? DefaultTileSize : (tileSize + 63) & ~size_t(63))
+    {
+    }
+
+    inline void MultiDigest::addData(std::vector<byte> &data, uint32_t offset, uint32_t len)
+    {
+        addData(data.data() + offset, len);
+    }
+
+    inline void MultiDigest::addData(const byte *data, size_t len)
+    {
+        while (len > 0)
+        {
+            size_t tile = len < tileSize ? len : tileSize;
+
+            ///< the first consumer pulls the tile into cache, the others hit it there
+            if (algorithms & SHA256)
+                sha256.addData(data, tile);
+            if (algorithms & MD5)
+                md5.addData(data, tile);
+            if (algorithms & CRC32C)
+                crc32c.addData(data, tile);
+
+            data += tile;
+            len -= tile;
+        }
+    }
+
+    inline MultiDigest::Result MultiDigest::GetResult()
+    {
+        Result result;
+
+        if (algorithms & MD5)
+            result.md5 = md5.GetHash();
+        if (algorithms & SHA256)
+            result.sha256 = sha256.GetHash();
+        if (algorithms & CRC32C)
+            result.crc32c = crc32c.GetValue();
+
+        return result;
+    }
+
+    inline MultiDigest::Result MultiDigest::Hash(const byte *data, size_t len, uint32_t algorithms)
+    {
+        MultiDigest digest(algorithms);
+        digest.addData(data, len);
+        return digest.GetResult();
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_MULTI_DIGEST_HPP */
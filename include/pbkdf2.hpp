@@ -0,0 +1,292 @@
+#ifndef CRYPTOGRAPHY_PBKDF2_HPP
+#define CRYPTOGRAPHY_PBKDF2_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "sha256_lanes.hpp"
+#include "sha26.hpp"
+
+namespace Crypto
+{
+    /**
+     * @brief
+     *      PBKDF2-HMAC-SHA256 (RFC 8018) for one password.
+     *
+     *      the ipad / opad midstates are computed once in the constructor, every
+     *      iteration then costs exactly two compressions of fixed 32 byte
+     *      messages with no buffering or allocation. Output blocks, and the
+     *      candidates of DeriveBatch, are iterated side by side in SIMD lanes.
+     */
+    class Pbkdf2HmacSha256
+    {
+    public:
+        static constexpr size_t HashLen = 32;
+
+        /**
+         * @brief Construct a new Pbkdf2HmacSha256 object
+         *
+         * @param password
+         * @param len
+         */
+        Pbkdf2HmacSha256(const byte *password, size_t len);
+
+        /**
+         * @brief Construct a new Pbkdf2HmacSha256 object
+         *
+         * @param password
+         */
+        explicit Pbkdf2HmacSha256(const std::string &password);
+
+        /**
+         * @brief
+         *      derive outLen bytes of key material
+         *
+         * @param salt
+         * @param saltLen
+         * @param iterations
+         *      at least 1
+         * @param out
+         * @param outLen
+         */
+        void derive(const byte *salt, size_t saltLen, uint32_t iterations, byte *out, size_t outLen) const;
+
+        /**
+         * @brief
+         *
+         * @return std::vector<byte>
+         */
+        std::vector<byte> derive(const std::vector<byte> &salt, uint32_t iterations, size_t outLen) const;
+
+        /**
+         * @brief
+         *      derive outLen bytes for each candidate password with the same
+         *      salt, candidate i is written to out + i * outLen
+         */
+        static void DeriveBatch(const std::vector<Pbkdf2HmacSha256> &candidates, const byte *salt, size_t saltLen,
+                                uint32_t iterations, byte *out, size_t outLen);
+
+    private:
+        ///< one output block T_i of one password
+        struct Job
+        {
+            const Pbkdf2HmacSha256 *key;
+            uint32_t blockIndex;
+            byte *out;
+            size_t len;
+        };
+
+        static void run(const Job *jobs, size_t count, const byte *salt, size_t saltLen, uint32_t iterations);
+
+        ///< finish a hash whose first 64 byte block is already in state, over a || b
+        static void finishHash(std::array<uint32_t, 8> &state, const byte *a, size_t aLen, const byte *b, size_t bLen);
+
+        std::array<uint32_t, 8> innerState;
+        std::array<uint32_t, 8> outerState;
+    };
+
+    ///< Implementation
+    inline Pbkdf2HmacSha256::Pbkdf2HmacSha256(const byte *password, size_t len)
+    {
+        std::array<byte, 64> key{};
+
+        if (len > key.size())
+        {
+            Sha26 sha;
+            sha.addData(password, len);
+            std::vector<byte> digest = sha.GetHash();
+            std::copy(digest.begin(), digest.end(), key.begin());
+        }
+        else if (len > 0)
+        {
+            std::memcpy(key.data(), password, len);
+        }
+
+        std::array<byte, 64> pad;
+        std::array<uint32_t, 16> w;
+
+        for (size_t i = 0; i < 64; ++i)
+            pad[i] = key[i] ^ 0x36;
+        Sha26::toUintArray(pad.data(), w);
+        innerState = Sha26::iv;
+        Sha26::processBlock(innerState, w);
+
+        for (size_t i = 0; i < 64; ++i)
+            pad[i] = key[i] ^ 0x5C;
+        Sha26::toUintArray(pad.data(), w);
+        outerState = Sha26::iv;
+        Sha26::processBlock(outerState, w);
+    }
+
+    inline Pbkdf2HmacSha256::Pbkdf2HmacSha256(const std::string &password)
+        : Pbkdf2HmacSha256(reinterpret_cast<const byte *>(password.data()), password.size())
+    {
+    }
+
+    inline void Pbkdf2HmacSha256::derive(const byte *salt, size_t saltLen, uint32_t iterations, byte *out, size_t outLen) const
+    {
+        Job jobs[Sha256Lanes::MaxLanes];
+        uint32_t block = 1;
+
+        while (outLen > 0)
+        {
+            size_t count = 0;
+            for (; count < Sha256Lanes::MaxLanes && outLen > 0; ++count, ++block)
+            {
+                size_t len = outLen < HashLen ? outLen : HashLen;
+                jobs[count] = {this, block, out, len};
+                out += len;
+                outLen -= len;
+            }
+            run(jobs, count, salt, saltLen, iterations);
+        }
+    }
+
+    inline std::vector<byte> Pbkdf2HmacSha256::derive(const std::vector<byte> &salt, uint32_t iterations, size_t outLen) const
+    {
+        std::vector<byte> out(outLen);
+        derive(salt.data(), salt.size(), iterations, out.data(), outLen);
+        return out;
+    }
+
+    inline void Pbkdf2HmacSha256::DeriveBatch(const std::vector<Pbkdf2HmacSha256> &candidates, const byte *salt,
+                                              size_t saltLen, uint32_t iterations, byte *out, size_t outLen)
+    {
+        Job jobs[Sha256Lanes::MaxLanes];
+        size_t count = 0;
+
+        ///< every (candidate, block) pair is an independent lane
+        for (size_t c = 0; c < candidates.size(); ++c)
+        {
+            byte *dest = out + c * outLen;
+            size_t remaining = outLen;
+
+            for (uint32_t block = 1; remaining > 0; ++block)
+            {
+                size_t len = remaining < HashLen ? remaining : HashLen;
+                jobs[count++] = {&candidates[c], block, dest, len};
+                dest += len;
+                remaining -= len;
+
+                if (count == Sha256Lanes::MaxLanes)
+                {
+                    run(jobs, count, salt, saltLen, iterations);
+                    count = 0;
+                }
+            }
+        }
+
+        if (count > 0)
+            run(jobs, count, salt, saltLen, iterations);
+    }
+
+    inline void Pbkdf2HmacSha256::finishHash(std::array<uint32_t, 8> &state, const byte *a, size_t aLen, const byte *b, size_t bLen)
+    {
+        std::array<byte, 64> block;
+        std::array<uint32_t, 16> w;
+        size_t fill = 0;
+        const uint64_t bits = (64 + static_cast<uint64_t>(aLen) + bLen) * 8;
+
+        auto feed = [&](const byte *p, size_t n) {
+            while (n > 0)
+            {
+                size_t take = 64 - fill < n ? 64 - fill : n;
+                std::memcpy(block.data() + fill, p, take);
+                fill += take;
+                p += take;
+                n -= take;
+                if (fill == 64)
+                {
+                    Sha26::toUintArray(block.data(), w);
+                    Sha26::processBlock(state, w);
+                    fill = 0;
+                }
+            }
+        };
+
+        const byte first = 0x80, zero = 0;
+        feed(a, aLen);
+        feed(b, bLen);
+        feed(&first, 1);
+        while (fill != 56)
+            feed(&zero, 1);
+
+        byte length[8];
+        for (size_t i = 0; i < 8; ++i)
+            length[i] = static_cast<byte>(bits >> (56 - 8 * i));
+        feed(length, 8);
+    }
+
+    inline void Pbkdf2HmacSha256::run(const Job *jobs, size_t count, const byte *salt, size_t saltLen, uint32_t iterations)
+    {
+        Sha256Lanes::State inner, outer, u;
+        Sha256Lanes::Block m;
+        uint32_t acc[8][Sha256Lanes::MaxLanes];
+
+        ///< U_1 = HMAC(P, S || INT(i)) has a variable length message, done per lane
+        for (size_t lane = 0; lane < Sha256Lanes::MaxLanes; ++lane)
+        {
+            const Job &job = jobs[lane < count ? lane : 0];
+
+            byte index[4] = {
+                static_cast<byte>(job.blockIndex >> 24), static_cast<byte>(job.blockIndex >> 16),
+                static_cast<byte>(job.blockIndex >> 8), static_cast<byte>(job.blockIndex)};
+
+            std::array<uint32_t, 8> t = job.key->innerState;
+            finishHash(t, salt, saltLen, index, sizeof(index));
+
+            byte tBytes[HashLen];
+            for (size_t i = 0; i < 8; ++i)
+                for (size_t j = 0; j < 4; ++j)
+                    tBytes[4 * i + j] = static_cast<byte>(t[i] >> (24 - 8 * j));
+
+            std::array<uint32_t, 8> u1 = job.key->outerState;
+            finishHash(u1, tBytes, HashLen, nullptr, 0);
+
+            for (size_t i = 0; i < 8; ++i)
+            {
+                u[i][lane] = acc[i][lane] = u1[i];
+                inner[i][lane] = job.key->innerState[i];
+                outer[i][lane] = job.key->outerState[i];
+            }
+        }
+
+        ///< every later message is a 32 byte digest after the 64 byte pad block,
+        ///< so words 8..15 hold the same padding forever
+        for (size_t lane = 0; lane < Sha256Lanes::MaxLanes; ++lane)
+        {
+            m[8][lane] = 0x80000000;
+            for (size_t i = 9; i < 15; ++i)
+                m[i][lane] = 0;
+            m[15][lane] = (64 + 32) * 8;
+        }
+
+        Sha256Lanes::State s;
+        for (uint32_t it = 1; it < iterations; ++it)
+        {
+            std::memcpy(m, u, sizeof(u));
+            std::memcpy(s, inner, sizeof(s));
+            Sha256Lanes::compress(s, m, count);
+
+            std::memcpy(m, s, sizeof(s));
+            std::memcpy(u, outer, sizeof(u));
+            Sha256Lanes::compress(u, m, count);
+
+            for (size_t i = 0; i < 8; ++i)
+                for (size_t lane = 0; lane < Sha256Lanes::MaxLanes; ++lane)
+                    acc[i][lane] ^= u[i][lane];
+        }
+
+        for (size_t lane = 0; lane < count; ++lane)
+        {
+            for (size_t b = 0; b < jobs[lane].len; ++b)
+                jobs[lane].out[b] = static_cast<byte>(acc[b / 4][lane] >> (24 - 8 * (b % 4)));
+        }
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_PBKDF2_HPP */
@@ -0,0 +1,250 @@
+#ifndef CRYPTOGRAPHY_SHA256_FIXED_HPP
+#define CRYPTOGRAPHY_SHA256_FIXED_HPP
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "sha256_lanes.hpp"
+#include "sha26.hpp"
+
+namespace Crypto
+{
+    /**
+     * @brief
+     *      SHA-256 of exactly 32 or 64 byte messages and SHA-256d, the shapes of
+     *      Merkle node and hash-of-hash calls.
+     *
+     *      the padding never depends on the data: a 32 byte message fills one
+     *      block with constant words 8..15, a 64 byte message is followed by a
+     *      constant block whose whole schedule is expanded once. Nothing is
+     *      buffered or allocated. Digests are written as 32 bytes to out.
+     */
+    class Sha256Fixed
+    {
+    public:
+        static constexpr size_t DigestLen = 32;
+
+        static void Hash32(const byte *in, byte *out);
+
+        static void Hash64(const byte *in, byte *out);
+
+        ///< SHA-256(SHA-256(in)) for a 32 byte message
+        static void DoubleHash32(const byte *in, byte *out);
+
+        ///< SHA-256(SHA-256(in)) for a 64 byte message
+        static void DoubleHash64(const byte *in, byte *out);
+
+        ///< SHA-256(SHA-256(in)) for any length, the outer hash uses the 32 byte kernel
+        static void DoubleHash(const byte *in, size_t len, byte *out);
+
+        /**
+         * @brief
+         *      count independent messages laid out back to back in `in`,
+         *      digests back to back in `out`, hashed Sha256Lanes::MaxLanes at a time
+         */
+        static void Hash32Batch(const byte *in, byte *out, size_t count);
+
+        static void Hash64Batch(const byte *in, byte *out, size_t count);
+
+        static void DoubleHash32Batch(const byte *in, byte *out, size_t count);
+
+        static void DoubleHash64Batch(const byte *in, byte *out, size_t count);
+
+    private:
+        using Words = std::array<uint32_t, 8>;
+
+        ///< k[t] + W[t] of the padding block that follows a 64 byte message
+        static const std::array<uint32_t, 64> &padSchedule64();
+
+        ///< hash of a 32 byte message given as 8 big endian words
+        static Words hashWords(const Words &msg);
+
+        static Words hash64(const byte *in);
+
+        static Words load32(const byte *in);
+
+        static void store(const Words &digest, byte *out);
+
+        static void batch(const byte *in, byte *out, size_t count, size_t inLen, bool twice);
+    };
+
+    ///< Implementation
+    inline const std::array<uint32_t, 64> &Sha256Fixed::padSchedule64()
+    {
+        static const std::array<uint32_t, 64> schedule = [] {
+            std::array<uint32_t, 64> w{};
+            w[0] = 0x80000000;
+            w[15] = 64 * 8;
+
+            auto rotr = [](uint32_t x, unsigned n) { return (x >> n) | (x << (32 - n)); };
+            for (size_t t = 16; t < 64; ++t)
+            {
+                uint32_t s0 = rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >> 3);
+                uint32_t s1 = rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >> 10);
+                w[t] = s1 + w[t - 7] + s0 + w[t - 16];
+            }
+
+            for (size_t t = 0; t < 64; ++t)
+                w[t] += Sha26::k[t];
+            return w;
+        }();
+
+        return schedule;
+    }
+
+    inline Sha256Fixed::Words Sha256Fixed::load32(const byte *in)
+    {
+        Words w;
+        for (size_t i = 0; i < 8; ++i)
+            w[i] = (static_cast<uint32_t>(in[4 * i]) << 24) | (static_cast<uint32_t>(in[4 * i + 1]) << 16) |
+                   (static_cast<uint32_t>(in[4 * i + 2]) << 8) | static_cast<uint32_t>(in[4 * i + 3]);
+        return w;
+    }
+
+    inline void Sha256Fixed::store(const Words &digest, byte *out)
+    {
+        for (size_t i = 0; i < 8; ++i)
+        {
+            out[4 * i] = static_cast<byte>(digest[i] >> 24);
+            out[4 * i + 1] = static_cast<byte>(digest[i] >> 16);
+            out[4 * i + 2] = static_cast<byte>(digest[i] >> 8);
+            out[4 * i + 3] = static_cast<byte>(digest[i]);
+        }
+    }
+
+    inline Sha256Fixed::Words Sha256Fixed::hashWords(const Words &msg)
+    {
+        std::array<uint32_t, 16> m{};
+        for (size_t i = 0; i < 8; ++i)
+            m[i] = msg[i];
+        m[8] = 0x80000000;
+        m[15] = 32 * 8;
+
+        Words state = Sha26::iv;
+        Sha26::processBlock(state, m);
+        return state;
+    }
+
+    inline Sha256Fixed::Words Sha256Fixed::hash64(const byte *in)
+    {
+        std::array<uint32_t, 16> m;
+        Sha26::toUintArray(in, m);
+
+        Words state = Sha26::iv;
+        Sha26::processBlock(state, m);
+        Sha26::processSchedule(state, padSchedule64());
+        return state;
+    }
+
+    inline void Sha256Fixed::Hash32(const byte *in, byte *out)
+    {
+        store(hashWords(load32(in)), out);
+    }
+
+    inline void Sha256Fixed::Hash64(const byte *in, byte *out)
+    {
+        store(hash64(in), out);
+    }
+
+    inline void Sha256Fixed::DoubleHash32(const byte *in, byte *out)
+    {
+        store(hashWords(hashWords(load32(in))), out);
+    }
+
+    inline void Sha256Fixed::DoubleHash64(const byte *in, byte *out)
+    {
+        store(hashWords(hash64(in)), out);
+    }
+
+    inline void Sha256Fixed::DoubleHash(const byte *in, size_t len, byte *out)
+    {
+        Sha26 sha;
+        sha.addData(in, len);
+        std::vector<byte> inner = sha.GetHash();
+        Hash32(inner.data(), out);
+    }
+
+    inline void Sha256Fixed::batch(const byte *in, byte *out, size_t count, size_t inLen, bool twice)
+    {
+        const size_t lanesMax = Sha256Lanes::MaxLanes;
+        Sha256Lanes::State state;
+        Sha256Lanes::Block m;
+
+        for (size_t first = 0; first < count; first += lanesMax)
+        {
+            size_t lanes = count - first < lanesMax ? count - first : lanesMax;
+
+            for (size_t lane = 0; lane < lanesMax; ++lane)
+            {
+                ///< idle lanes repeat the first message, their output is dropped
+                const byte *msg = in + (first + (lane < lanes ? lane : 0)) * inLen;
+
+                for (size_t i = 0; i < 16; ++i)
+                {
+                    if (i * 4 < inLen)
+                        m[i][lane] = (static_cast<uint32_t>(msg[4 * i]) << 24) | (static_cast<uint32_t>(msg[4 * i + 1]) << 16) |
+                                     (static_cast<uint32_t>(msg[4 * i + 2]) << 8) | static_cast<uint32_t>(msg[4 * i + 3]);
+                    else
+                        m[i][lane] = i == 8 ? 0x80000000 : i == 15 ? 32 * 8 : 0;
+                }
+
+                for (size_t i = 0; i < 8; ++i)
+                    state[i][lane] = Sha26::iv[i];
+            }
+
+            Sha256Lanes::compress(state, m, lanes);
+            if (inLen == 64)
+                Sha256Lanes::compressSchedule(state, padSchedule64(), lanes);
+
+            if (twice)
+            {
+                for (size_t lane = 0; lane < lanesMax; ++lane)
+                {
+                    for (size_t i = 0; i < 8; ++i)
+                    {
+                        m[i][lane] = state[i][lane];
+                        state[i][lane] = Sha26::iv[i];
+                    }
+                    m[8][lane] = 0x80000000;
+                    for (size_t i = 9; i < 15; ++i)
+                        m[i][lane] = 0;
+                    m[15][lane] = 32 * 8;
+                }
+
+                Sha256Lanes::compress(state, m, lanes);
+            }
+
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                Words digest;
+                for (size_t i = 0; i < 8; ++i)
+                    digest[i] = state[i][lane];
+                store(digest, out + (first + lane) * DigestLen);
+            }
+        }
+    }
+
+    inline void Sha256Fixed::Hash32Batch(const byte *in, byte *out, size_t count)
+    {
+        batch(in, out, count, 32, false);
+    }
+
+    inline void Sha256Fixed::Hash64Batch(const byte *in, byte *out, size_t count)
+    {
+        batch(in, out, count, 64, false);
+    }
+
+    inline void Sha256Fixed::DoubleHash32Batch(const byte *in, byte *out, size_t count)
+    {
+        batch(in, out, count, 32, true);
+    }
+
+    inline void Sha256Fixed::DoubleHash64Batch(const byte *in, byte *out, size_t count)
+    {
+        batch(in, out, count, 64, true);
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_SHA256_FIXED_HPP */
@@ -0,0 +1,239 @@
+#ifndef CRYPTOGRAPHY_SHA256_KERNELS_HPP
+#define CRYPTOGRAPHY_SHA256_KERNELS_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#include "cpu_features.hpp"
+#include "sha26.hpp"
+
+#ifdef CRYPTOGRAPHY_X86
+#include <immintrin.h>
+#endif
+
+namespace Crypto
+{
+    /**
+     * @brief
+     *      single stream SHA-256 block functions: compress `blocks` consecutive
+     *      64 byte blocks of data into a raw state. They all give the same
+     *      result, HashDispatch picks the fastest one for the running cpu.
+     */
+    class Sha256Kernels
+    {
+    public:
+        using State = std::array<uint32_t, 8>;
+
+        ///< Sha26::processBlock per block
+        static void blocksPortable(State &state, const byte *data, size_t blocks);
+
+#ifdef CRYPTOGRAPHY_X86
+        /**
+         * @brief
+         *      schedules of 8 blocks are expanded side by side in AVX2
+         *      registers, the rounds stay scalar (Sha26::processSchedule)
+         */
+        static void blocksVectorSchedule(State &state, const byte *data, size_t blocks);
+
+        ///< SHA extensions (sha256rnds2 / sha256msg1 / sha256msg2)
+        static void blocksShaNi(State &state, const byte *data, size_t blocks);
+
+        /**
+         * @brief
+         *      blocksShaNi that also copies the input to dst: each block is
+         *      loaded once, stored, and compressed from the same registers.
+         *      With nonTemporal the stores bypass the cache; for a dst off a
+         *      16 byte boundary the streamed lanes are shifted onto it and
+         *      the first and last few bytes are plain stores. The caller
+         *      issues the closing sfence.
+         */
+        static void copyBlocksShaNi(State &state, byte *dst, const byte *src, size_t blocks, bool nonTemporal);
+#endif
+    };
+
+    ///< Implementation
+    inline void Sha256Kernels::blocksPortable(State &state, const byte *data, size_t blocks)
+    {
+        std::array<uint32_t, 16> w;
+        for (size_t i = 0; i < blocks; ++i, data += 64)
+        {
+            Sha26::toUintArray(data, w);
+            Sha26::processBlock(state, w);
+        }
+    }
+
+#ifdef CRYPTOGRAPHY_X86
+    namespace Sha256KernelsDetail
+    {
+        __attribute__((target("avx2"), always_inline)) inline __m256i rotr(__m256i x, int n)
+        {
+            return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+        }
+    } // namespace Sha256KernelsDetail
+
+    __attribute__((target("avx2"))) inline void Sha256Kernels::blocksVectorSchedule(State &state, const byte *data, size_t blocks)
+    {
+        using V = __m256i;
+
+        using Sha256KernelsDetail::rotr;
+
+        ///< one 32 byte row per schedule word, lane b belongs to block b
+        alignas(32) uint32_t w[64][8];
+        std::array<uint32_t, 64> kw;
+
+        ///< big endian words of 8 blocks: gather word i of each block into row i
+        const V shuffle = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        const V stride = _mm256_setr_epi32(0, 16, 32, 48, 64, 80, 96, 112);
+
+        for (; blocks >= 8; blocks -= 8, data += 8 * 64)
+        {
+            for (int i = 0; i < 16; ++i)
+            {
+                V words = _mm256_i32gather_epi32(reinterpret_cast<const int *>(data) + i, stride, 4);
+                _mm256_store_si256(reinterpret_cast<V *>(w[i]), _mm256_shuffle_epi8(words, shuffle));
+            }
+
+            for (int t = 16; t < 64; ++t)
+            {
+                V w2 = _mm256_load_si256(reinterpret_cast<const V *>(w[t - 2]));
+                V w15 = _mm256_load_si256(reinterpret_cast<const V *>(w[t - 15]));
+                V s1 = _mm256_xor_si256(_mm256_xor_si256(rotr(w2, 17), rotr(w2, 19)), _mm256_srli_epi32(w2, 10));
+                V s0 = _mm256_xor_si256(_mm256_xor_si256(rotr(w15, 7), rotr(w15, 18)), _mm256_srli_epi32(w15, 3));
+                V sum = _mm256_add_epi32(_mm256_add_epi32(s1, _mm256_load_si256(reinterpret_cast<const V *>(w[t - 7]))),
+                                         _mm256_add_epi32(s0, _mm256_load_si256(reinterpret_cast<const V *>(w[t - 16]))));
+                _mm256_store_si256(reinterpret_cast<V *>(w[t]), sum);
+            }
+
+            for (int b = 0; b < 8; ++b)
+            {
+                for (int t = 0; t < 64; ++t)
+                    kw[t] = w[t][b] + Sha26::k[t];
+                Sha26::processSchedule(state, kw);
+            }
+        }
+
+        blocksPortable(state, data, blocks);
+    }
+
+    namespace Sha256KernelsDetail
+    {
+        ///< the SHA instructions want the state as ABEF / CDGH
+        __attribute__((target("sha,sse4.1"), always_inline)) inline void shaNiLoad(const Sha256Kernels::State &state, __m128i &state0, __m128i &state1)
+        {
+            __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[0])), 0xB1);
+            state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[4])), 0x1B);
+            state0 = _mm_alignr_epi8(tmp, state1, 8);
+            state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+        }
+
+        __attribute__((target("sha,sse4.1"), always_inline)) inline void shaNiStore(Sha256Kernels::State &state, __m128i state0, __m128i state1)
+        {
+            __m128i tmp = _mm_shuffle_epi32(state0, 0x1B);
+            state1 = _mm_shuffle_epi32(state1, 0xB1);
+            state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+            state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[0]), state0);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[4]), state1);
+        }
+
+        ///< 64 rounds over one block already byte swapped into msg
+        __attribute__((target("sha,sse4.1"), always_inline)) inline void shaNiRounds(__m128i &state0, __m128i &state1, __m128i (&msg)[4])
+        {
+            const __m128i abefSave = state0;
+            const __m128i cdghSave = state1;
+
+            ///< 16 groups of 4 rounds, the schedule of later groups is built in
+            ///< the 4 register ring while the current one runs
+#pragma GCC unroll 16
+            for (int i = 0; i < 16; ++i)
+            {
+                __m128i m = _mm_add_epi32(msg[i & 3], _mm_loadu_si128(reinterpret_cast<const __m128i *>(&Sha26::k[4 * i])));
+                state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+
+                if (i >= 3 && i <= 14)
+                {
+                    __m128i next = _mm_add_epi32(msg[(i + 1) & 3], _mm_alignr_epi8(msg[i & 3], msg[(i - 1) & 3], 4));
+                    msg[(i + 1) & 3] = _mm_sha256msg2_epu32(next, msg[i & 3]);
+                }
+
+                state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(m, 0x0E));
+
+                if (i >= 1 && i <= 12)
+                    msg[(i - 1) & 3] = _mm_sha256msg1_epu32(msg[(i - 1) & 3], msg[i & 3]);
+            }
+
+            state0 = _mm_add_epi32(state0, abefSave);
+            state1 = _mm_add_epi32(state1, cdghSave);
+        }
+    } // namespace Sha256KernelsDetail
+
+    __attribute__((target("sha,sse4.1"))) inline void Sha256Kernels::blocksShaNi(State &state, const byte *data, size_t blocks)
+    {
+        using namespace Sha256KernelsDetail;
+
+        const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+        __m128i state0, state1;
+        shaNiLoad(state, state0, state1);
+
+        for (; blocks > 0; --blocks, data += 64)
+        {
+            __m128i msg[4];
+            for (int i = 0; i < 4; ++i)
+                msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16 * i)), byteSwap);
+            shaNiRounds(state0, state1, msg);
+        }
+
+        shaNiStore(state, state0, state1);
+    }
+
+    __attribute__((target("sha,sse4.1"))) inline void Sha256Kernels::copyBlocksShaNi(State &state, byte *dst, const byte *src, size_t blocks, bool nonTemporal)
+    {
+        using namespace Sha256KernelsDetail;
+
+        const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+        __m128i state0, state1;
+        shaNiLoad(state, state0, state1);
+
+        ///< bytes up to dst's next 16 byte boundary, the streamed lanes start there
+        const size_t skew = (16 - (reinterpret_cast<uintptr_t>(dst) & 15)) & 15;
+        if (nonTemporal && skew != 0 && blocks > 0)
+            std::memcpy(dst, src, skew);
+
+        for (; blocks > 0; --blocks, src += 64, dst += 64)
+        {
+            __m128i msg[4];
+            for (int i = 0; i < 4; ++i)
+            {
+                __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16 * i));
+                if (!nonTemporal)
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16 * i), raw);
+                else if (skew == 0)
+                    _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 16 * i), raw);
+                msg[i] = _mm_shuffle_epi8(raw, byteSwap);
+            }
+
+            ///< shifted lanes read up to skew bytes into the next block, the last block ends with a plain copy
+            if (nonTemporal && skew != 0)
+            {
+                for (size_t off = skew; off < 64; off += 16)
+                {
+                    if (blocks == 1 && off + 16 > 64)
+                        std::memcpy(dst + off, src + off, 64 - off);
+                    else
+                        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + off),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + off)));
+                }
+            }
+            shaNiRounds(state0, state1, msg);
+        }
+
+        shaNiStore(state, state0, state1);
+    }
+#endif
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_SHA256_KERNELS_HPP */
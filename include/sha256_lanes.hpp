@@ -0,0 +1,251 @@
+#ifndef CRYPTOGRAPHY_SHA256_LANES_HPP
+#define CRYPTOGRAPHY_SHA256_LANES_HPP
+
+#include <array>
+#include <cstdint>
+
+#include "cpu_features.hpp"
+#include "sha26.hpp"
+
+#ifdef CRYPTOGRAPHY_X86
+#include <immintrin.h>
+#endif
+
+namespace Crypto
+{
+    /**
+     * @brief
+     *      SHA-256 compression of several independent messages at once.
+     *
+     *      states and message blocks are stored word major: state[w][lane] is
+     *      word w of lane, so each row is one vector for the AVX2 kernel.
+     */
+    class Sha256Lanes
+    {
+    public:
+        static constexpr size_t MaxLanes = 8;
+
+        using State = uint32_t[8][MaxLanes];
+        using Block = uint32_t[16][MaxLanes];
+
+        /**
+         * @brief
+         *      compress one block into each of the first lanes states
+         *
+         * @param state
+         * @param m
+         * @param lanes
+         *      number of lanes in use, at most MaxLanes
+         */
+        static void compress(State &state, const Block &m, size_t lanes = MaxLanes);
+
+        /**
+         * @brief
+         *      compress the same constant block into each lane, given its
+         *      expanded schedule with the round constants added (see
+         *      Sha26::processSchedule)
+         *
+         * @param state
+         * @param kw
+         * @param lanes
+         */
+        static void compressSchedule(State &state, const std::array<uint32_t, 64> &kw, size_t lanes = MaxLanes);
+
+        /**
+         * @brief
+         *      true when compress runs all lanes in one SIMD pass
+         */
+        static bool vectorized();
+
+        /**
+         * @brief
+         *      one lane at a time with Sha26::processBlock
+         */
+        static void compressPortable(State &state, const Block &m, size_t lanes);
+
+#ifdef CRYPTOGRAPHY_X86
+        /**
+         * @brief
+         *      8 lanes in the 8 32-bit elements of AVX2 registers
+         */
+        static void compressAvx2(State &state, const Block &m);
+
+        static void compressScheduleAvx2(State &state, const std::array<uint32_t, 64> &kw);
+#endif
+    };
+
+    ///< Implementation
+    inline bool Sha256Lanes::vectorized()
+    {
+        return CpuFeatures::get().avx2;
+    }
+
+    inline void Sha256Lanes::compress(State &state, const Block &m, size_t lanes)
+    {
+#ifdef CRYPTOGRAPHY_X86
+        ///< unused lanes cost the same as used ones, the kernel always runs 8
+        if (lanes > 1 && CpuFeatures::get().avx2)
+        {
+            compressAvx2(state, m);
+            return;
+        }
+#endif
+        compressPortable(state, m, lanes);
+    }
+
+    inline void Sha256Lanes::compressSchedule(State &state, const std::array<uint32_t, 64> &kw, size_t lanes)
+    {
+#ifdef CRYPTOGRAPHY_X86
+        if (lanes > 1 && CpuFeatures::get().avx2)
+        {
+            compressScheduleAvx2(state, kw);
+            return;
+        }
+#endif
+        std::array<uint32_t, 8> s;
+
+        for (size_t lane = 0; lane < lanes; ++lane)
+        {
+            for (size_t i = 0; i < 8; ++i)
+                s[i] = state[i][lane];
+
+            Sha26::processSchedule(s, kw);
+
+            for (size_t i = 0; i < 8; ++i)
+                state[i][lane] = s[i];
+        }
+    }
+
+    inline void Sha256Lanes::compressPortable(State &state, const Block &m, size_t lanes)
+    {
+        std::array<uint32_t, 8> s;
+        std::array<uint32_t, 16> w;
+
+        for (size_t lane = 0; lane < lanes; ++lane)
+        {
+            for (size_t i = 0; i < 8; ++i)
+                s[i] = state[i][lane];
+            for (size_t i = 0; i < 16; ++i)
+                w[i] = m[i][lane];
+
+            Sha26::processBlock(s, w);
+
+            for (size_t i = 0; i < 8; ++i)
+                state[i][lane] = s[i];
+        }
+    }
+
+#ifdef CRYPTOGRAPHY_X86
+    namespace Sha256LanesDetail
+    {
+        using V = __m256i;
+
+        __attribute__((target("avx2"), always_inline)) inline V add(V a, V b) { return _mm256_add_epi32(a, b); }
+
+        __attribute__((target("avx2"), always_inline)) inline V rotr(V x, int n)
+        {
+            return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+        }
+
+        __attribute__((target("avx2"), always_inline)) inline V Sigma0(V x)
+        {
+            return _mm256_xor_si256(_mm256_xor_si256(rotr(x, 2), rotr(x, 13)), rotr(x, 22));
+        }
+
+        __attribute__((target("avx2"), always_inline)) inline V Sigma1(V x)
+        {
+            return _mm256_xor_si256(_mm256_xor_si256(rotr(x, 6), rotr(x, 11)), rotr(x, 25));
+        }
+
+        __attribute__((target("avx2"), always_inline)) inline V sigma0(V x)
+        {
+            return _mm256_xor_si256(_mm256_xor_si256(rotr(x, 7), rotr(x, 18)), _mm256_srli_epi32(x, 3));
+        }
+
+        __attribute__((target("avx2"), always_inline)) inline V sigma1(V x)
+        {
+            return _mm256_xor_si256(_mm256_xor_si256(rotr(x, 17), rotr(x, 19)), _mm256_srli_epi32(x, 10));
+        }
+
+        __attribute__((target("avx2"), always_inline)) inline V ch(V x, V y, V z)
+        {
+            return _mm256_xor_si256(_mm256_and_si256(x, y), _mm256_andnot_si256(x, z));
+        }
+
+        __attribute__((target("avx2"), always_inline)) inline V maj(V x, V y, V z)
+        {
+            return _mm256_or_si256(_mm256_and_si256(_mm256_or_si256(x, y), z), _mm256_and_si256(x, y));
+        }
+
+        ///< one round, kw is the round constant plus the schedule word
+        __attribute__((target("avx2"), always_inline)) inline void step(V (&s)[8], V kw)
+        {
+            V T1 = add(add(s[7], Sigma1(s[4])), add(ch(s[4], s[5], s[6]), kw));
+            V T2 = add(Sigma0(s[0]), maj(s[0], s[1], s[2]));
+            s[7] = s[6];
+            s[6] = s[5];
+            s[5] = s[4];
+            s[4] = add(s[3], T1);
+            s[3] = s[2];
+            s[2] = s[1];
+            s[1] = s[0];
+            s[0] = add(T1, T2);
+        }
+
+        __attribute__((target("avx2"), always_inline)) inline void load(V (&s)[8], const uint32_t (&state)[8][8])
+        {
+            for (size_t i = 0; i < 8; ++i)
+                s[i] = _mm256_loadu_si256(reinterpret_cast<const V *>(state[i]));
+        }
+
+        __attribute__((target("avx2"), always_inline)) inline void feedForward(uint32_t (&state)[8][8], const V (&s)[8])
+        {
+            for (size_t i = 0; i < 8; ++i)
+            {
+                V *row = reinterpret_cast<V *>(state[i]);
+                _mm256_storeu_si256(row, add(_mm256_loadu_si256(row), s[i]));
+            }
+        }
+    } // namespace Sha256LanesDetail
+
+    __attribute__((target("avx2"))) inline void Sha256Lanes::compressAvx2(State &state, const Block &m)
+    {
+        using namespace Sha256LanesDetail;
+
+        V w[16];
+        for (size_t i = 0; i < 16; ++i)
+            w[i] = _mm256_loadu_si256(reinterpret_cast<const V *>(m[i]));
+
+        V s[8];
+        load(s, state);
+
+        for (size_t t = 0; t < 64; ++t)
+        {
+            ///< the schedule lives in a 16 word ring
+            if (t >= 16)
+                w[t & 15] = add(add(sigma1(w[(t - 2) & 15]), w[(t - 7) & 15]),
+                                add(sigma0(w[(t - 15) & 15]), w[t & 15]));
+
+            step(s, add(_mm256_set1_epi32(static_cast<int>(Sha26::k[t])), w[t & 15]));
+        }
+
+        feedForward(state, s);
+    }
+
+    __attribute__((target("avx2"))) inline void Sha256Lanes::compressScheduleAvx2(State &state, const std::array<uint32_t, 64> &kw)
+    {
+        using namespace Sha256LanesDetail;
+
+        V s[8];
+        load(s, state);
+
+        for (size_t t = 0; t < 64; ++t)
+            step(s, _mm256_set1_epi32(static_cast<int>(kw[t])));
+
+        feedForward(state, s);
+    }
+#endif
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_SHA256_LANES_HPP */
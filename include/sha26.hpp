@@ -1,30 +1,20 @@
 #ifndef CRYPTOGRAPHY_SHA_256_HPP
 #define CRYPTOGRAPHY_SHA_256_HPP
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cstdint>
 #include <vector>
 #include <string>
 #include <exception>
+#include <fstream>
 
-typedef unsigned char byte;
-
+#include <sys/uio.h>
 
-class InvalidOperationException : public std::exception
-{
-private:
-    std::string msg;
-
-public:
-    InvalidOperationException(const std::string& message = "") : msg(message)
-    {
-    }
+#include "invalid_operation.hpp"
 
-    const char * what() const noexcept
-    {
-        return msg.c_str();
-    }
-};
+typedef unsigned char byte;
 
 namespace Crypto
 {
@@ -109,6 +99,42 @@ namespace Crypto
         void processBlock(std::array<uint32_t, 16>& m);
 
     public:
+        /**
+         * @brief 
+         *      compress one block of 16 message words into a raw state,
+         *      without any buffering or padding
+         * 
+         * @param state 
+         * @param m 
+         */
+        static void processBlock(std::array<uint32_t, 8>& state, const std::array<uint32_t, 16>& m);
+
+        /**
+         * @brief 
+         *      run the 64 rounds over an expanded schedule that already has
+         *      the round constants added (kw[t] = k[t] + W[t]), so a constant
+         *      block can be expanded once and reused
+         * 
+         * @param state 
+         * @param kw 
+         */
+        static void processSchedule(std::array<uint32_t, 8>& state, const std::array<uint32_t, 64>& kw);
+
+        /**
+         * @brief 
+         *      load 64 bytes as 16 big endian words
+         * 
+         * @param src 
+         * @param dest 
+         */
+        static void toUintArray(const byte *src, std::array<uint32_t, 16> &dest);
+
+        ///< initial hash value
+        static const std::array<uint32_t, 8> iv;
+
+        ///< round constants
+        static const std::array<uint32_t, 64> k;
+
         /**
          * @brief 
          * 
@@ -119,6 +145,25 @@ namespace Crypto
          */
         void addData(std::vector<byte> &data, uint32_t offset, uint32_t len);
 
+        /**
+         * @brief 
+         * 
+         * @param data 
+         * @param len 
+         */
+        void addData(const byte *data, size_t len);
+
+        /**
+         * @brief 
+         *      hash the fragments as if they were one contiguous buffer,
+         *      blocks straddling two fragments are stitched in the pending
+         *      block, all others are read in place
+         * 
+         * @param fragments 
+         * @param count 
+         */
+        void addData(const struct iovec *fragments, size_t count);
+
         /**
          * @brief Get the Hash object
          * 
@@ -133,6 +178,13 @@ namespace Crypto
          */
 		std::vector<uint32_t> GetHashUInt32();
 
+        /**
+         * @brief 
+         *      start over as a fresh hasher, also after GetHash, without
+         *      allocating
+         */
+        void reset();
+
 	private:
         /**
          * @brief 
@@ -148,7 +200,7 @@ namespace Crypto
          * @param src 
          * @return std::vector<byte> 
          */
-		static std::vector<byte> toByteArray(std::vector<uint32_t> &src);
+		static std::vector<byte> toByteArray(const std::vector<uint32_t> &src);
 
 	public:
         /**
@@ -160,10 +212,7 @@ namespace Crypto
 		static std::vector<byte> HashFile(std::fstream& fs);
 
     private:
-        static const std::array<uint32_t, 64> k;
-        std::array<uint32_t, 8> h{
-            0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
-        };
+        std::array<uint32_t, 8> h = iv;
         std::array<byte, 64> pending_block;
         uint32_t pending_block_off = 0;
         std::array<uint32_t, 16> uint_buffer;
@@ -173,6 +222,10 @@ namespace Crypto
     };
 
     ///< Implementation
+    const std::array<uint32_t, 8> Sha26::iv{
+        0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+    };
+
     const std::array<uint32_t, 64> Sha26::k{
         0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
         0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
@@ -194,7 +247,7 @@ namespace Crypto
     uint32_t Sha26::rotr(uint32_t x, byte n)
     {
         assert(n < 32);
-        return (x << n) | (x >> (32 - n));
+        return (x >> n) | (x << (32 - n));
     }
 
     uint32_t Sha26::ch(uint32_t x, uint32_t y, uint32_t z)
@@ -230,10 +283,13 @@ namespace Crypto
 
     void Sha26::processBlock(std::array<uint32_t, 16>& m) 
     {
-        assert(m.size() == 16);
+        processBlock(h, m);
+    }
 
+    void Sha26::processBlock(std::array<uint32_t, 8>& state, const std::array<uint32_t, 16>& m) 
+    {
 		// 1. Prepare the message schedule (W[t]):
-		std::vector<uint32_t> v(64);
+		std::array<uint32_t, 64> v;
 		for (int t = 0; t < 16; ++t)
 		{
 			v[t] = m[t];
@@ -244,12 +300,22 @@ namespace Crypto
 			v[t] = sigma1(v[t - 2]) + v[t - 7] + sigma0(v[t - 15]) + v[t - 16];
 		}
 
-		
-		uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], _h = h[7];
+		// 2. Fold in the round constants:
+		for (int t = 0; t < 64; ++t)
+		{
+			v[t] += k[t];
+		}
+
+		processSchedule(state, v);
+    }
+
+    void Sha26::processSchedule(std::array<uint32_t, 8>& state, const std::array<uint32_t, 64>& kw) 
+    {
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], _h = state[7];
 
 		for (int t = 0; t < 64; ++t)
 		{
-			uint32_t T1 = _h + Sigma1(e) + ch(e, f, g) + k[t] + v[t];
+			uint32_t T1 = _h + Sigma1(e) + ch(e, f, g) + kw[t];
 			uint32_t T2 = Sigma0(a) + maj(a, b, c);
 			_h = g;
 			g = f;
@@ -261,18 +327,23 @@ namespace Crypto
 			a = T1 + T2;
 		}
 
-		h[0] = a + h[0];
-		h[1] = b + h[1];
-		h[2] = c + h[2];
-		h[3] = d + h[3];
-		h[4] = e + h[4];
-		h[5] = f + h[5];
-		h[6] = g + h[6];
-		h[7] = _h + h[7];
+		state[0] = a + state[0];
+		state[1] = b + state[1];
+		state[2] = c + state[2];
+		state[3] = d + state[3];
+		state[4] = e + state[4];
+		state[5] = f + state[5];
+		state[6] = g + state[6];
+		state[7] = _h + state[7];
 
     }
 
     void Sha26::addData(std::vector<byte> &data, uint32_t offset, uint32_t len) 
+    {
+        addData(data.data() + offset, len);
+    }
+
+    void Sha26::addData(const byte *data, size_t len) 
     {
         if (closed)
 			throw InvalidOperationException("Adding data to a closed hasher.");
@@ -280,36 +351,41 @@ namespace Crypto
 		if (len == 0)
 			return;
 
-		bits_processed += len * 8;
+		bits_processed += static_cast<uint64_t>(len) * 8;
 
-		while (len > 0)
+		///< top up a partial block first
+		if (pending_block_off > 0)
 		{
-			uint32_t amount_to_copy;
-
-			if (len < 64)
-			{
-				if (pending_block_off + len > 64)
-					amount_to_copy = 64 - pending_block_off;
-				else
-					amount_to_copy = len;
-			}
-			else
-				amount_to_copy = 64 - pending_block_off;
+			size_t amount_to_copy = std::min<size_t>(64 - pending_block_off, len);
 
-			std::copy_n(data.begin() + offset, amount_to_copy, pending_block.begin() + pending_block_off);
+			std::copy_n(data, amount_to_copy, pending_block.begin() + pending_block_off);
 			len -= amount_to_copy;
-			offset += amount_to_copy;
-			pending_block_off += amount_to_copy;
+			data += amount_to_copy;
+			pending_block_off += static_cast<uint32_t>(amount_to_copy);
 
-			if (pending_block_off == 64)
-			{
-				toUintArray(pending_block, uint_buffer);
-				processBlock(uint_buffer);
-				pending_block_off = 0;
-			}
+			if (pending_block_off < 64)
+				return;
+
+			toUintArray(pending_block, uint_buffer);
+			processBlock(uint_buffer);
+			pending_block_off = 0;
 		}
 
+		///< whole blocks are compressed straight from the caller's memory
+		for (; len >= 64; len -= 64, data += 64)
+		{
+			toUintArray(data, uint_buffer);
+			processBlock(uint_buffer);
+		}
 
+		std::copy_n(data, len, pending_block.begin());
+		pending_block_off = static_cast<uint32_t>(len);
+    }
+
+    void Sha26::addData(const struct iovec *fragments, size_t count) 
+    {
+        for (size_t i = 0; i < count; ++i)
+			addData(static_cast<const byte *>(fragments[i].iov_base), fragments[i].iov_len);
     }
     
     std::vector<byte> Sha26::GetHash() 
@@ -323,7 +399,8 @@ namespace Crypto
 		{
 			uint64_t size_temp = bits_processed;
 
-			addData({0x80}, 0, 1);
+			const byte first_pad = 0x80;
+			addData(&first_pad, 1);
 
 			uint32_t available_space = 64 - pending_block_off;
 
@@ -341,7 +418,7 @@ namespace Crypto
 				size_temp >>= 8;
 			}
 
-			addData(padding, 0u, static_cast<uint32_t>(padding.size()));
+			addData(padding.data(), padding.size());
 
 			assert(pending_block_off == 0);
 
@@ -353,7 +430,20 @@ namespace Crypto
 		return h_vEC;   
     }
     
+    void Sha26::reset() 
+    {
+        h = iv;
+        pending_block_off = 0;
+        bits_processed = 0;
+        closed = false;
+    }
+    
     void Sha26::toUintArray(std::array<byte, 64> &src, std::array<uint32_t, 16> &dest) 
+    {
+        toUintArray(src.data(), dest);
+    }
+
+    void Sha26::toUintArray(const byte *src, std::array<uint32_t, 16> &dest) 
     {
         for (uint32_t i = 0, j = 0; i < dest.size(); ++i, j += 4)
 		{
@@ -366,7 +456,7 @@ namespace Crypto
 
     }
     
-    std::vector<byte> Sha26::toByteArray(std::vector<uint32_t> &src) 
+    std::vector<byte> Sha26::toByteArray(const std::vector<uint32_t> &src) 
     {
         std::vector<unsigned char> dest(src.size() * 4);
 		int pos = 0;
@@ -0,0 +1,168 @@
+#ifndef CRYPTOGRAPHY_THREAD_POOL_HPP
+#define CRYPTOGRAPHY_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Crypto
+{
+    /**
+     * @brief
+     *      fixed size pool of worker threads fed from a shared queue.
+     *
+     *      a thread waiting on a task of the pool (wait) keeps running
+     *      queued tasks itself, so tasks may fork and join other tasks
+     *      without starving the pool.
+     */
+    class ThreadPool
+    {
+    public:
+        /**
+         * @brief Construct a new Thread Pool object
+         *
+         * @param threads
+         *      number of workers, 0 picks std::thread::hardware_concurrency
+         */
+        explicit ThreadPool(size_t threads = 0);
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        ~ThreadPool();
+
+        /**
+         * @brief
+         *      queue a task for execution
+         *
+         * @return std::future of the task result
+         */
+        template <typename F>
+        auto submit(F &&task) -> std::future<typename std::invoke_result<F>::type>;
+
+        /**
+         * @brief
+         *      run one queued task on the calling thread
+         *
+         * @return true if a task was run
+         */
+        bool runPendingTask();
+
+        /**
+         * @brief
+         *      wait for a future, running queued tasks meanwhile
+         */
+        template <typename T>
+        T wait(std::future<T> &f);
+
+        /**
+         * @brief
+         *      number of worker threads
+         */
+        size_t size() const
+        {
+            return workers.size();
+        }
+
+    private:
+        void workerLoop();
+
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool stopping = false;
+    };
+
+    ///< Implementation
+    inline ThreadPool::ThreadPool(size_t threads)
+    {
+        if (threads == 0)
+            threads = std::thread::hardware_concurrency();
+        if (threads == 0)
+            threads = 1;
+
+        workers.reserve(threads);
+        for (size_t i = 0; i < threads; ++i)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    inline ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    template <typename F>
+    auto ThreadPool::submit(F &&task) -> std::future<typename std::invoke_result<F>::type>
+    {
+        using R = typename std::invoke_result<F>::type;
+
+        auto packaged = std::make_shared<std::packaged_task<R()>>(std::forward<F>(task));
+        std::future<R> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace_back([packaged] { (*packaged)(); });
+        }
+        cv.notify_one();
+
+        return result;
+    }
+
+    inline bool ThreadPool::runPendingTask()
+    {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tasks.empty())
+                return false;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+        return true;
+    }
+
+    template <typename T>
+    T ThreadPool::wait(std::future<T> &f)
+    {
+        while (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            if (!runPendingTask())
+                std::this_thread::yield();
+        }
+        return f.get();
+    }
+
+    inline void ThreadPool::workerLoop()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_THREAD_POOL_HPP */
@@ -0,0 +1,725 @@
+#ifndef CRYPTOGRAPHY_TREE_HASHER_HPP
+#define CRYPTOGRAPHY_TREE_HASHER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "io_uring.hpp"
+#include "md5.hpp"
+#include "sha26.hpp"
+#include "thread_pool.hpp"
+
+namespace Crypto
+{
+    namespace TreeHasherDetail
+    {
+        ///< an io_uring read length is 32 bits, and read(2) moves under 2 GiB anyway
+        constexpr size_t MaxBufferSize = size_t(1) << 30;
+    } // namespace TreeHasherDetail
+
+    /**
+     * @brief
+     *      hashes every regular file below a directory.
+     *
+     *      directories are walked in parallel, files are read in inode or
+     *      physical extent order through io_uring (batched openat / read with
+     *      a bounded queue depth) and the buffers are hashed on a worker pool.
+     *      Without io_uring the files are read with pread on the pool instead.
+     */
+    class TreeHasher
+    {
+    public:
+        enum class Algorithm
+        {
+            SHA256,
+            MD5
+        };
+
+        enum class ReadOrder
+        {
+            None,   ///< directory order
+            Inode,  ///< inode number, free from the directory walk
+            Extent  ///< physical offset of the first extent (FIEMAP), falls back to inode
+        };
+
+        struct Options
+        {
+            Algorithm algorithm = Algorithm::SHA256;
+            ReadOrder order = ReadOrder::Inode;
+
+            ///< io_uring operations in flight, also the number of files open at once
+            unsigned queueDepth = 64;
+
+            ///< each open file uses two buffers of this size, at most 1 GiB
+            size_t bufferSize = 256 * 1024;
+
+            ///< walk and hash workers, 0 for one per cpu
+            size_t threads = 0;
+
+            bool useIoUring = true;
+        };
+
+        struct ManifestEntry
+        {
+            std::string path;
+            uint64_t size = 0;
+            std::vector<byte> digest;
+
+            ///< errno of a failed open or read, the digest is empty then
+            int error = 0;
+        };
+
+        /**
+         * @brief Construct a new Tree Hasher object with the default options
+         */
+        TreeHasher();
+
+        /**
+         * @brief Construct a new Tree Hasher object
+         *
+         * @param options
+         */
+        explicit TreeHasher(const Options &options);
+
+        /**
+         * @brief
+         *      hash all regular files below root (symlinks are not followed)
+         *
+         * @param root
+         *      a directory, or a single file
+         *
+         * @return std::vector<ManifestEntry> sorted by path
+         */
+        std::vector<ManifestEntry> hashTree(const std::string &root);
+
+        /**
+         * @brief
+         *      true when the last hashTree call ran on io_uring
+         */
+        bool usedIoUring() const
+        {
+            return ioUringUsed;
+        }
+
+        /**
+         * @brief
+         *      write one "digest size path" line per entry
+         */
+        static void WriteManifest(std::ostream &os, const std::vector<ManifestEntry> &manifest);
+
+    private:
+        struct FileRef
+        {
+            std::string path;
+            uint64_t inode = 0;
+            uint64_t physical = 0;
+            int error = 0;
+        };
+
+        ///< Sha26 or Md5 behind one streaming interface
+        class FileDigest
+        {
+        public:
+            explicit FileDigest(Algorithm algorithm) : algorithm(algorithm)
+            {
+            }
+
+            void addData(const byte *data, size_t len)
+            {
+                if (algorithm == Algorithm::SHA256)
+                    sha.addData(data, len);
+                else
+                    md5.addData(data, len);
+            }
+
+            std::vector<byte> GetHash()
+            {
+                return algorithm == Algorithm::SHA256 ? sha.GetHash() : md5.GetHash();
+            }
+
+        private:
+            Algorithm algorithm;
+            Sha26 sha;
+            Md5 md5;
+        };
+
+        std::vector<FileRef> walk(const std::string &root);
+        void orderFiles(std::vector<FileRef> &files) const;
+        static uint64_t physicalOffset(const std::string &path);
+
+        bool hashWithIoUring(const std::vector<FileRef> &files, std::vector<ManifestEntry> &manifest);
+        void hashWithPread(const std::vector<FileRef> &files, std::vector<ManifestEntry> &manifest);
+
+        Options options;
+        ThreadPool pool;
+        bool ioUringUsed = false;
+    };
+
+    ///< Implementation
+    inline TreeHasher::TreeHasher() : TreeHasher(Options())
+    {
+    }
+
+    inline TreeHasher::TreeHasher(const Options &options)
+        : options(options), pool(options.threads)
+    {
+        if (this->options.queueDepth == 0)
+            this->options.queueDepth = 1;
+        if (this->options.bufferSize == 0)
+            this->options.bufferSize = 256 * 1024;
+        if (this->options.bufferSize > TreeHasherDetail::MaxBufferSize)
+            this->options.bufferSize = TreeHasherDetail::MaxBufferSize;
+    }
+
+    inline std::vector<TreeHasher::ManifestEntry> TreeHasher::hashTree(const std::string &root)
+    {
+        std::vector<FileRef> files = walk(root);
+        std::vector<ManifestEntry> manifest;
+        manifest.reserve(files.size());
+
+        ///< entries that failed during the walk go straight to the manifest
+        std::vector<FileRef> readable;
+        readable.reserve(files.size());
+        for (auto &file : files)
+        {
+            if (file.error != 0)
+                manifest.push_back({file.path, 0, {}, file.error});
+            else
+                readable.push_back(std::move(file));
+        }
+
+        orderFiles(readable);
+
+        ioUringUsed = options.useIoUring && hashWithIoUring(readable, manifest);
+        if (!ioUringUsed)
+            hashWithPread(readable, manifest);
+
+        std::sort(manifest.begin(), manifest.end(),
+                  [](const ManifestEntry &a, const ManifestEntry &b) { return a.path < b.path; });
+
+        return manifest;
+    }
+
+    inline std::vector<TreeHasher::FileRef> TreeHasher::walk(const std::string &root)
+    {
+        std::vector<FileRef> files;
+
+        struct stat st;
+        if (lstat(root.c_str(), &st) != 0)
+        {
+            files.push_back({root, 0, 0, errno});
+            return files;
+        }
+        if (!S_ISDIR(st.st_mode))
+        {
+            if (S_ISREG(st.st_mode))
+                files.push_back({root, st.st_ino, options.order == ReadOrder::Extent ? physicalOffset(root) : 0, 0});
+            return files;
+        }
+
+        std::mutex filesMutex;
+        std::atomic<size_t> pending{1};
+        const bool extents = options.order == ReadOrder::Extent;
+
+        std::function<void(const std::string &)> visit = [&](const std::string &dir) {
+            std::vector<FileRef> local;
+
+            DIR *d = opendir(dir.c_str());
+            if (d == nullptr)
+            {
+                local.push_back({dir, 0, 0, errno});
+            }
+            else
+            {
+                while (dirent *e = readdir(d))
+                {
+                    if (std::strcmp(e->d_name, ".") == 0 || std::strcmp(e->d_name, "..") == 0)
+                        continue;
+
+                    std::string path = dir == "/" ? "/" + std::string(e->d_name) : dir + "/" + e->d_name;
+                    unsigned char type = e->d_type;
+
+                    if (type == DT_UNKNOWN)
+                    {
+                        struct stat est;
+                        if (lstat(path.c_str(), &est) == 0)
+                            type = S_ISDIR(est.st_mode) ? DT_DIR : S_ISREG(est.st_mode) ? DT_REG : DT_UNKNOWN;
+                    }
+
+                    if (type == DT_DIR)
+                    {
+                        pending.fetch_add(1);
+                        pool.submit([&visit, &pending, path] {
+                            visit(path);
+                            pending.fetch_sub(1);
+                        });
+                    }
+                    else if (type == DT_REG)
+                    {
+                        local.push_back({path, static_cast<uint64_t>(e->d_ino), 0, 0});
+                    }
+                }
+                closedir(d);
+            }
+
+            if (extents)
+            {
+                for (auto &file : local)
+                    if (file.error == 0)
+                        file.physical = physicalOffset(file.path);
+            }
+
+            std::lock_guard<std::mutex> lock(filesMutex);
+            files.insert(files.end(), std::make_move_iterator(local.begin()), std::make_move_iterator(local.end()));
+        };
+
+        std::string start = root;
+        while (start.size() > 1 && start.back() == '/')
+            start.pop_back();
+
+        pool.submit([&visit, &pending, start] {
+            visit(start);
+            pending.fetch_sub(1);
+        });
+
+        while (pending.load() > 0)
+        {
+            if (!pool.runPendingTask())
+                std::this_thread::yield();
+        }
+
+        return files;
+    }
+
+    inline uint64_t TreeHasher::physicalOffset(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return 0;
+
+        alignas(fiemap) char buf[sizeof(fiemap) + sizeof(fiemap_extent)] = {};
+        fiemap *map = reinterpret_cast<fiemap *>(buf);
+        map->fm_start = 0;
+        map->fm_length = ~0ULL;
+        map->fm_extent_count = 1;
+
+        uint64_t physical = 0;
+        if (ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0)
+            physical = map->fm_extents[0].fe_physical;
+
+        close(fd);
+        return physical;
+    }
+
+    inline void TreeHasher::orderFiles(std::vector<FileRef> &files) const
+    {
+        switch (options.order)
+        {
+        case ReadOrder::None:
+            break;
+        case ReadOrder::Inode:
+            std::sort(files.begin(), files.end(),
+                      [](const FileRef &a, const FileRef &b) { return a.inode < b.inode; });
+            break;
+        case ReadOrder::Extent:
+            ///< files without extent information (0) sort first, by inode
+            std::sort(files.begin(), files.end(), [](const FileRef &a, const FileRef &b) {
+                return a.physical != b.physical ? a.physical < b.physical : a.inode < b.inode;
+            });
+            break;
+        }
+    }
+
+    inline bool TreeHasher::hashWithIoUring(const std::vector<FileRef> &files, std::vector<ManifestEntry> &manifest)
+    {
+        std::unique_ptr<IoUring> ring;
+        try
+        {
+            ring.reset(new IoUring(options.queueDepth + 1));
+        }
+        catch (const std::system_error &)
+        {
+            return false;
+        }
+
+        if (!ring->supports(IORING_OP_OPENAT) || !ring->supports(IORING_OP_READ) || !ring->supports(IORING_OP_POLL_ADD))
+            return false;
+
+        int doneFd = eventfd(0, EFD_CLOEXEC);
+        if (doneFd < 0)
+            return false;
+
+        ///< one open file, with at most one operation in flight on the ring
+        struct Slot
+        {
+            size_t file = 0;
+            int fd = -1;
+            uint64_t offset = 0;
+            int error = 0;
+            std::unique_ptr<FileDigest> digest;
+            std::vector<byte> buffers[2];
+            bool busy[2] = {false, false};
+            std::deque<std::pair<int, size_t>> ready;
+            int hashingBuffer = -1;
+            bool reading = false;
+            bool eof = false;
+        };
+
+        enum : uint64_t
+        {
+            OpOpen = 0,
+            OpRead = 1,
+            OpPoll = 2
+        };
+
+        const unsigned depth = options.queueDepth;
+        std::vector<Slot> slots(depth);
+        std::vector<size_t> freeSlots;
+        for (size_t s = depth; s > 0; --s)
+            freeSlots.push_back(s - 1);
+
+        std::mutex doneMutex;
+        std::vector<size_t> done;
+        size_t next = 0, active = 0;
+
+        ///< operations handed to the ring and not completed, hashing tasks not finished
+        size_t inflight = 0;
+        std::atomic<size_t> hashing{0};
+
+        auto armPoll = [&] {
+            inflight += 1;
+            io_uring_sqe *sqe = ring->getSqe();
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = doneFd;
+            sqe->poll32_events = POLLIN;
+            sqe->user_data = OpPoll;
+        };
+
+        auto finish = [&](size_t s) {
+            Slot &slot = slots[s];
+            if (slot.fd >= 0)
+                close(slot.fd);
+            slot.fd = -1;
+
+            ManifestEntry entry{files[slot.file].path, slot.offset, {}, slot.error};
+            if (slot.error == 0)
+                entry.digest = slot.digest->GetHash();
+            manifest.push_back(std::move(entry));
+
+            slot.digest.reset();
+            active -= 1;
+            freeSlots.push_back(s);
+        };
+
+        auto startHash = [&](size_t s) {
+            Slot &slot = slots[s];
+            std::pair<int, size_t> job = slot.ready.front();
+            slot.ready.pop_front();
+            slot.hashingBuffer = job.first;
+
+            hashing.fetch_add(1);
+            pool.submit([&, s, job] {
+                Slot &owner = slots[s];
+                owner.digest->addData(owner.buffers[job.first].data(), job.second);
+                {
+                    std::lock_guard<std::mutex> lock(doneMutex);
+                    done.push_back(s);
+                }
+                uint64_t one = 1;
+                ssize_t ignored = write(doneFd, &one, sizeof(one));
+                (void)ignored;
+                hashing.fetch_sub(1);
+            });
+        };
+
+        ///< keep one read in flight while a buffer is free, finish once everything is hashed
+        auto advance = [&](size_t s) {
+            Slot &slot = slots[s];
+
+            if (!slot.eof && !slot.reading)
+            {
+                int b = !slot.busy[0] ? 0 : !slot.busy[1] ? 1 : -1;
+                if (b >= 0)
+                {
+                    slot.busy[b] = true;
+                    slot.reading = true;
+                    inflight += 1;
+
+                    io_uring_sqe *sqe = ring->getSqe();
+                    sqe->opcode = IORING_OP_READ;
+                    sqe->fd = slot.fd;
+                    sqe->addr = reinterpret_cast<uint64_t>(slot.buffers[b].data());
+                    sqe->len = static_cast<uint32_t>(options.bufferSize);
+                    sqe->off = slot.offset;
+                    sqe->user_data = (static_cast<uint64_t>(s) << 3) | (static_cast<uint64_t>(b) << 2) | OpRead;
+                }
+            }
+
+            if (slot.eof && !slot.reading && slot.hashingBuffer < 0 && slot.ready.empty())
+                finish(s);
+        };
+
+        auto startFile = [&](size_t s) {
+            Slot &slot = slots[s];
+            slot.file = next++;
+            slot.fd = -1;
+            slot.offset = 0;
+            slot.error = 0;
+            slot.digest.reset(new FileDigest(options.algorithm));
+            for (auto &buffer : slot.buffers)
+                buffer.resize(options.bufferSize);
+            slot.busy[0] = slot.busy[1] = false;
+            slot.ready.clear();
+            slot.hashingBuffer = -1;
+            slot.reading = false;
+            slot.eof = false;
+            active += 1;
+            inflight += 1;
+
+            io_uring_sqe *sqe = ring->getSqe();
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = reinterpret_cast<uint64_t>(files[slot.file].path.c_str());
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            sqe->user_data = (static_cast<uint64_t>(s) << 3) | OpOpen;
+        };
+
+        try
+        {
+            armPoll();
+
+            while (next < files.size() || active > 0)
+            {
+                while (!freeSlots.empty() && next < files.size())
+                {
+                    size_t s = freeSlots.back();
+                    freeSlots.pop_back();
+                    startFile(s);
+                }
+
+                int ret = ring->submit(1);
+                if (ret < 0 && ret != -EAGAIN && ret != -EBUSY)
+                    throw std::system_error(-ret, std::generic_category(), "io_uring_enter");
+
+                while (io_uring_cqe *cqe = ring->peek())
+                {
+                    uint64_t data = cqe->user_data;
+                    int res = cqe->res;
+                    ring->seen();
+                    inflight -= 1;
+
+                    uint64_t op = data & 3;
+                    if (op == OpPoll)
+                    {
+                        uint64_t count;
+                        ssize_t ignored = read(doneFd, &count, sizeof(count));
+                        (void)ignored;
+
+                        std::vector<size_t> finished;
+                        {
+                            std::lock_guard<std::mutex> lock(doneMutex);
+                            finished.swap(done);
+                        }
+                        for (size_t s : finished)
+                        {
+                            Slot &slot = slots[s];
+                            slot.busy[slot.hashingBuffer] = false;
+                            slot.hashingBuffer = -1;
+                            if (!slot.ready.empty())
+                                startHash(s);
+                            advance(s);
+                        }
+                        armPoll();
+                        continue;
+                    }
+
+                    size_t s = static_cast<size_t>(data >> 3);
+                    Slot &slot = slots[s];
+
+                    if (op == OpOpen)
+                    {
+                        if (res < 0)
+                        {
+                            slot.error = -res;
+                            slot.eof = true;
+                        }
+                        else
+                        {
+                            slot.fd = res;
+                        }
+                    }
+                    else
+                    {
+                        int b = static_cast<int>((data >> 2) & 1);
+                        slot.reading = false;
+
+                        if (res <= 0)
+                        {
+                            if (res < 0)
+                                slot.error = -res;
+                            slot.eof = true;
+                            slot.busy[b] = false;
+                        }
+                        else
+                        {
+                            slot.offset += static_cast<uint64_t>(res);
+                            slot.ready.emplace_back(b, static_cast<size_t>(res));
+                            if (slot.hashingBuffer < 0)
+                                startHash(s);
+                        }
+                    }
+                    advance(s);
+                }
+            }
+        }
+        catch (...)
+        {
+            ///< hashing tasks and reads the kernel owns still point into slots, let them land first
+            while (hashing.load() > 0)
+            {
+                if (!pool.runPendingTask())
+                    std::this_thread::yield();
+            }
+
+            ///< entries the kernel never consumed die with the ring; wake the poll so it completes too
+            uint64_t one = 1;
+            ssize_t ignored = write(doneFd, &one, sizeof(one));
+            (void)ignored;
+
+            size_t owned = inflight - ring->queued();
+            while (owned > 0 && ring->submit(1) >= 0)
+            {
+                while (io_uring_cqe *cqe = ring->peek())
+                {
+                    uint64_t data = cqe->user_data;
+                    int res = cqe->res;
+                    ring->seen();
+                    owned -= 1;
+
+                    size_t s = static_cast<size_t>(data >> 3);
+                    if ((data & 3) == OpOpen && res >= 0)
+                        slots[s].fd = res;
+                    else if ((data & 3) == OpRead)
+                        slots[s].reading = false;
+                }
+            }
+
+            ///< the ring cannot be reaped: leave buffers of reads still in flight to the kernel
+            for (Slot &slot : slots)
+            {
+                if (slot.reading)
+                {
+                    for (auto &buffer : slot.buffers)
+                        (void)new std::vector<byte>(std::move(buffer));
+                }
+                if (slot.fd >= 0)
+                    close(slot.fd);
+            }
+
+            ring.reset();
+            close(doneFd);
+            throw;
+        }
+
+        ///< the poll request is still armed, the ring teardown cancels it
+        ring.reset();
+        close(doneFd);
+        return true;
+    }
+
+    inline void TreeHasher::hashWithPread(const std::vector<FileRef> &files, std::vector<ManifestEntry> &manifest)
+    {
+        const size_t first = manifest.size();
+        manifest.resize(first + files.size());
+
+        std::vector<std::future<void>> tasks;
+        tasks.reserve(files.size());
+
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            tasks.push_back(pool.submit([this, &files, &manifest, first, i] {
+                ManifestEntry &entry = manifest[first + i];
+                entry.path = files[i].path;
+
+                int fd = open(entry.path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0)
+                {
+                    entry.error = errno;
+                    return;
+                }
+                posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+                FileDigest digest(options.algorithm);
+                std::vector<byte> buffer(options.bufferSize);
+                for (;;)
+                {
+                    ssize_t n = pread(fd, buffer.data(), buffer.size(), static_cast<off_t>(entry.size));
+                    if (n < 0 && errno == EINTR)
+                        continue;
+                    if (n < 0)
+                        entry.error = errno;
+                    if (n <= 0)
+                        break;
+                    digest.addData(buffer.data(), static_cast<size_t>(n));
+                    entry.size += static_cast<uint64_t>(n);
+                }
+                close(fd);
+
+                if (entry.error == 0)
+                    entry.digest = digest.GetHash();
+            }));
+        }
+
+        for (auto &task : tasks)
+            pool.wait(task);
+    }
+
+    inline void TreeHasher::WriteManifest(std::ostream &os, const std::vector<ManifestEntry> &manifest)
+    {
+        static const char digits[] = "0123456789abcdef";
+
+        for (const auto &entry : manifest)
+        {
+            if (entry.error != 0)
+            {
+                os << "-  " << entry.size << "  " << entry.path << "  (" << std::strerror(entry.error) << ")\n";
+                continue;
+            }
+
+            std::string hex;
+            hex.reserve(entry.digest.size() * 2);
+            for (byte b : entry.digest)
+            {
+                hex += digits[b >> 4];
+                hex += digits[b & 15];
+            }
+            os << hex << "  " << entry.size << "  " << entry.path << '\n';
+        }
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_TREE_HASHER_HPP */
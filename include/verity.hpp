@@ -0,0 +1,936 @@
+#ifndef CRYPTOGRAPHY_VERITY_HPP
+#define CRYPTOGRAPHY_VERITY_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "hash_dispatch.hpp"
+#include "thread_pool.hpp"
+
+namespace Crypto
+{
+    namespace VerityDetail
+    {
+        constexpr char Magic[8] = {'C', 'R', 'Y', 'V', 'R', 'T', 'Y', '1'};
+        constexpr uint32_t Version = 2;
+
+        ///< the header owns the first page, hash levels follow leaf level first
+        constexpr uint64_t HeaderSize = 4096;
+
+        constexpr size_t BlockSize = 4096;
+        constexpr size_t HashSize = 32;
+
+        ///< child hashes per hash block
+        constexpr size_t Fanout = BlockSize / HashSize;
+
+        ///< data blocks hashed per Sha256Many call
+        constexpr size_t BatchBlocks = 64;
+
+        ///< data blocks per pool task while building
+        constexpr uint64_t BlocksPerTask = 1024;
+
+        ///< data blocks populated per fault, read ahead of the faulting one
+        constexpr uint64_t FaultAround = 16;
+
+        ///< on-disk header, little endian
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t blockSize;
+            uint32_t hashSize;
+            uint32_t levels;
+            uint64_t dataSize;
+            byte root[HashSize];
+        };
+
+        inline uint64_t blockCount(uint64_t size)
+        {
+            return (size + BlockSize - 1) / BlockSize;
+        }
+
+        /**
+         * @brief
+         *      root = SHA-256(block size ‖ hash size ‖ levels ‖ data size ‖
+         *      top block), fields little endian, so the root also pins the
+         *      geometry the header claims
+         */
+        inline void rootHash(uint64_t dataSize, uint32_t levels, const byte *top, byte *out)
+        {
+            byte message[24 + BlockSize];
+            const uint64_t fields[3] = {uint64_t(BlockSize), uint64_t(HashSize) | uint64_t(levels) << 32, dataSize};
+            for (size_t i = 0; i < 24; ++i)
+                message[i] = static_cast<byte>(fields[i / 8] >> (8 * (i % 8)));
+            std::memcpy(message + 24, top, BlockSize);
+            HashDispatch::Sha256(message, sizeof(message), out);
+        }
+
+        ///< hash blocks of each level, leaf level first, the last level has one block
+        inline std::vector<uint64_t> levelBlocks(uint64_t dataSize)
+        {
+            std::vector<uint64_t> levels;
+            uint64_t entries = blockCount(dataSize);
+            do
+            {
+                uint64_t blocks = std::max<uint64_t>(1, (entries + Fanout - 1) / Fanout);
+                levels.push_back(blocks);
+                entries = blocks;
+            } while (levels.back() > 1);
+            return levels;
+        }
+
+        /**
+         * @brief
+         *      hashes of data blocks [first, first + count) of a size byte
+         *      region into out, the last block zero padded like the tree does
+         */
+        inline void hashBlocks(const byte *data, uint64_t size, uint64_t first, uint64_t count, byte *out)
+        {
+            const uint64_t whole = size / BlockSize;
+            const uint64_t full = first >= whole ? 0 : std::min(count, whole - first);
+            if (full > 0)
+                HashDispatch::Sha256Many(data + first * BlockSize, BlockSize, full, out);
+
+            if (full < count)
+            {
+                byte padded[BlockSize] = {};
+                std::memcpy(padded, data + whole * BlockSize, size - whole * BlockSize);
+                HashDispatch::Sha256(padded, BlockSize, out + full * HashSize);
+            }
+        }
+
+        inline void writeAll(int fd, const void *data, size_t len, const std::string &path)
+        {
+            const byte *p = static_cast<const byte *>(data);
+            while (len > 0)
+            {
+                ssize_t n = write(fd, p, len);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0)
+                    throw std::system_error(errno, std::generic_category(), "write " + path);
+                p += n;
+                len -= static_cast<size_t>(n);
+            }
+        }
+
+        ///< set of block indexes, safe to test and set from several threads
+        class Bitmap
+        {
+        public:
+            explicit Bitmap(uint64_t bits = 0) : words(new std::atomic<uint64_t>[(bits + 63) / 64]()), size((bits + 63) / 64)
+            {
+            }
+
+            bool test(uint64_t i) const
+            {
+                return (words[i / 64].load(std::memory_order_acquire) >> (i % 64) & 1) != 0;
+            }
+
+            void set(uint64_t i)
+            {
+                words[i / 64].fetch_or(uint64_t(1) << (i % 64), std::memory_order_release);
+            }
+
+            uint64_t count() const
+            {
+                uint64_t n = 0;
+                for (uint64_t w = 0; w < size; ++w)
+                    n += static_cast<uint64_t>(__builtin_popcountll(words[w].load(std::memory_order_relaxed)));
+                return n;
+            }
+
+        private:
+            std::unique_ptr<std::atomic<uint64_t>[]> words;
+            uint64_t size;
+        };
+    } // namespace VerityDetail
+
+    ///< a block or hash block does not match the tree
+    class VerityError : public std::runtime_error
+    {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    /**
+     * @brief
+     *      dm-verity style lazy verification of a read-only memory mapped file.
+     *
+     *      BuildTree hashes every 4 KiB block once (SHA-256, last block zero
+     *      padded) into a sidecar file holding the hash tree: 128 hashes per
+     *      4 KiB hash block, level by level, up to one top block. The root
+     *      hashes the top block together with the data size and tree shape,
+     *      so a sidecar cannot pass off a truncated or extended file. Opening only checks the top block against the trusted
+     *      root, so startup is O(1); a data block is checked the first time it
+     *      is used, together with the hash blocks above it that are not yet
+     *      verified, and remembered in a bitmap. Total cost follows the data
+     *      actually touched.
+     *
+     *      Mode::Explicit maps the file directly, callers verifyRange() what
+     *      they are about to read. Mode::Fault hands out an anonymous region
+     *      registered with userfaultfd: a handler thread copies each touched
+     *      block out of the file while hashing it, checks it, and only then
+     *      installs the copy, so code reading data() never sees unverified
+     *      bytes. A block that fails is mapped PROT_NONE and the access faults
+     *      (SIGSEGV), as a dm-verity read fails with EIO. Fault mode needs
+     *      userfaultfd; without privilege it is limited to user mode faults,
+     *      see userModeOnly().
+     *
+     *      in Explicit mode the file and the sidecar must not change while
+     *      mapped; in Fault mode only the sidecar.
+     */
+    class VerifiedFile
+    {
+    public:
+        static constexpr size_t BlockSize = VerityDetail::BlockSize;
+        static constexpr size_t HashSize = VerityDetail::HashSize;
+
+        using Hash = std::array<byte, HashSize>;
+
+        enum class Mode
+        {
+            Explicit,
+            Fault
+        };
+
+        /**
+         * @brief
+         *      hash dataPath into a new sidecar at treePath
+         *
+         * @return the root hash, keep it somewhere trusted
+         * @throw std::system_error on I/O errors
+         */
+        static Hash BuildTree(const std::string &dataPath, const std::string &treePath);
+
+        ///< same, leaf blocks split across the pool
+        static Hash BuildTree(const std::string &dataPath, const std::string &treePath, ThreadPool &pool);
+
+        ///< root recorded in the sidecar, only as trustworthy as the sidecar itself
+        static Hash StoredRoot(const std::string &treePath);
+
+        /**
+         * @brief
+         *      map dataPath, checking it lazily against the tree in treePath
+         *
+         * @throw VerityError when the tree does not lead to root,
+         *        std::runtime_error when treePath is not a tree for dataPath
+         *        (or Fault mode needs 4 KiB pages), std::system_error on I/O errors,
+         *        or in Fault mode when userfaultfd is refused (EPERM without
+         *        CAP_SYS_PTRACE when vm.unprivileged_userfaultfd=0 and the
+         *        kernel predates UFFD_USER_MODE_ONLY, or seccomp/containers
+         *        blocking it)
+         */
+        VerifiedFile(const std::string &dataPath, const std::string &treePath, const Hash &root,
+                     Mode mode = Mode::Explicit);
+
+        ///< trust the root stored in the sidecar, guards against corruption only
+        VerifiedFile(const std::string &dataPath, const std::string &treePath, Mode mode = Mode::Explicit);
+
+        VerifiedFile(const VerifiedFile &) = delete;
+        VerifiedFile &operator=(const VerifiedFile &) = delete;
+
+        ~VerifiedFile();
+
+        ///< the contents, check ranges before reading them in Explicit mode
+        const byte *data() const
+        {
+            return view;
+        }
+
+        uint64_t size() const
+        {
+            return dataSize;
+        }
+
+        Mode mode() const
+        {
+            return mode_;
+        }
+
+        /**
+         * @brief
+         *      check every block overlapping [offset, offset + len) not yet
+         *      verified; in Fault mode the blocks are also installed
+         *
+         * @throw VerityError on the first block that does not match,
+         *        std::out_of_range when the range is past size(),
+         *        std::system_error when Fault mode cannot install a block
+         *        (the block is poisoned like a mismatch)
+         */
+        void verifyRange(uint64_t offset, uint64_t len);
+
+        ///< true when every block overlapping the range passed already
+        bool isVerified(uint64_t offset, uint64_t len) const;
+
+        uint64_t blockCount() const
+        {
+            return blocks;
+        }
+
+        uint64_t verifiedBlocks() const
+        {
+            return verified.count();
+        }
+
+        /**
+         * @brief
+         *      Fault mode fell back to UFFD_USER_MODE_ONLY for lack of privilege:
+         *      only user space reads of data() are served, the kernel reading a
+         *      block not installed yet (write(fd, data(), n), O_DIRECT, ...) fails
+         *      with EFAULT. verifyRange() first installs the range for such uses.
+         */
+        bool userModeOnly() const
+        {
+            return userOnly;
+        }
+
+        ///< blocks that failed verification in Fault mode and were poisoned
+        uint64_t failedBlocks() const
+        {
+            return failures.load(std::memory_order_relaxed);
+        }
+
+    private:
+        static Hash build(const std::string &dataPath, const std::string &treePath, ThreadPool *pool);
+
+        void open(const std::string &dataPath, const std::string &treePath, const Hash *root);
+        void startFaultHandling();
+        void faultLoop();
+
+        const byte *hashBlock(unsigned level, uint64_t index) const
+        {
+            return tree + (levelStart[level] + index) * BlockSize;
+        }
+
+        ///< verify hash block index of level and the ones above it, stopping at a verified one
+        void verifyHashBlock(unsigned level, uint64_t index);
+
+        ///< compare the hash of data block b against its tree entry
+        void checkBlock(uint64_t b, const byte *hash);
+
+        /**
+         * @brief
+         *      Fault mode: copy, check and install blocks [first, first + count)
+         *
+         * @return false if a block failed, error is then the errno of the first
+         *         block that could not be installed, 0 when all failures were mismatches
+         */
+        bool populate(uint64_t first, uint64_t count, int &error);
+
+        /**
+         * @brief
+         *      UFFDIO_COPY checked blocks into the region and wake whoever waits
+         *      on them; a block that cannot be copied is poisoned
+         *
+         * @return errno of the first block that could not be installed, or 0
+         */
+        int install(uint64_t first, uint64_t count, const byte *copies);
+
+        ///< map block b PROT_NONE so reading it faults, for blocks that cannot be served
+        void poison(uint64_t b);
+
+        void close();
+
+        Mode mode_;
+        uint64_t dataSize = 0;
+        uint64_t blocks = 0;
+
+        const byte *fileMap = nullptr;
+        size_t fileMapSize = 0;
+        const byte *tree = nullptr;
+        size_t treeMapSize = 0;
+        Hash root_;
+
+        ///< first hash block of each level, counted from the first level
+        std::vector<uint64_t> levelStart;
+
+        ///< what data() points at: fileMap, or the userfaultfd region
+        const byte *view = nullptr;
+        byte *region = nullptr;
+        size_t regionSize = 0;
+
+        VerityDetail::Bitmap verified;
+        VerityDetail::Bitmap verifiedHashes;
+        std::atomic<uint64_t> failures{0};
+
+        int uffd = -1;
+        bool userOnly = false;
+        int wake = -1;
+        std::thread handler;
+    };
+
+    ///< Implementation
+    inline VerifiedFile::Hash VerifiedFile::BuildTree(const std::string &dataPath, const std::string &treePath)
+    {
+        return build(dataPath, treePath, nullptr);
+    }
+
+    inline VerifiedFile::Hash VerifiedFile::BuildTree(const std::string &dataPath, const std::string &treePath,
+                                                      ThreadPool &pool)
+    {
+        return build(dataPath, treePath, &pool);
+    }
+
+    inline VerifiedFile::Hash VerifiedFile::build(const std::string &dataPath, const std::string &treePath,
+                                                  ThreadPool *pool)
+    {
+        using namespace VerityDetail;
+
+        int fd = ::open(dataPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + dataPath);
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "stat " + dataPath);
+        }
+
+        const uint64_t size = static_cast<uint64_t>(st.st_size);
+        const byte *data = nullptr;
+        if (size > 0)
+        {
+            void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED)
+            {
+                int err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::generic_category(), "mmap " + dataPath);
+            }
+            madvise(map, size, MADV_SEQUENTIAL);
+            data = static_cast<const byte *>(map);
+        }
+        ::close(fd);
+
+        const std::vector<uint64_t> levels = levelBlocks(size);
+        uint64_t total = 0;
+        for (uint64_t n : levels)
+            total += n;
+
+        ///< the whole tree, about 1/128 of the data
+        std::vector<byte> nodes(total * BlockSize);
+        const uint64_t count = VerityDetail::blockCount(size);
+
+        if (pool != nullptr && count > BlocksPerTask)
+        {
+            std::vector<std::future<void>> tasks;
+            for (uint64_t first = 0; first < count; first += BlocksPerTask)
+            {
+                uint64_t n = std::min(BlocksPerTask, count - first);
+                tasks.push_back(pool->submit([&, first, n] { hashBlocks(data, size, first, n, &nodes[first * HashSize]); }));
+            }
+            for (std::future<void> &task : tasks)
+                pool->wait(task);
+        }
+        else if (count > 0)
+            hashBlocks(data, size, 0, count, nodes.data());
+
+        if (data != nullptr)
+            munmap(const_cast<byte *>(data), size);
+
+        ///< each level is contiguous, so its blocks hash in one multi-lane call
+        uint64_t start = 0;
+        for (size_t level = 0; level + 1 < levels.size(); ++level)
+        {
+            HashDispatch::Sha256Many(&nodes[start * BlockSize], BlockSize, levels[level],
+                                     &nodes[(start + levels[level]) * BlockSize]);
+            start += levels[level];
+        }
+
+        Hash root;
+        rootHash(size, static_cast<uint32_t>(levels.size()), &nodes[start * BlockSize], root.data());
+
+        byte page[HeaderSize] = {};
+        Header header = {};
+        std::memcpy(header.magic, Magic, sizeof(Magic));
+        header.version = Version;
+        header.blockSize = BlockSize;
+        header.hashSize = HashSize;
+        header.levels = static_cast<uint32_t>(levels.size());
+        header.dataSize = size;
+        std::memcpy(header.root, root.data(), HashSize);
+        std::memcpy(page, &header, sizeof(header));
+
+        fd = ::open(treePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + treePath);
+
+        try
+        {
+            writeAll(fd, page, sizeof(page), treePath);
+            writeAll(fd, nodes.data(), nodes.size(), treePath);
+        }
+        catch (...)
+        {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+        return root;
+    }
+
+    inline VerifiedFile::Hash VerifiedFile::StoredRoot(const std::string &treePath)
+    {
+        using namespace VerityDetail;
+
+        int fd = ::open(treePath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + treePath);
+
+        Header header;
+        bool valid = pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+                     std::memcmp(header.magic, Magic, sizeof(Magic)) == 0 && header.version == Version;
+        ::close(fd);
+        if (!valid)
+            throw std::runtime_error("not a hash tree: " + treePath);
+
+        Hash root;
+        std::memcpy(root.data(), header.root, HashSize);
+        return root;
+    }
+
+    inline VerifiedFile::VerifiedFile(const std::string &dataPath, const std::string &treePath, const Hash &root,
+                                      Mode mode)
+        : mode_(mode)
+    {
+        open(dataPath, treePath, &root);
+    }
+
+    inline VerifiedFile::VerifiedFile(const std::string &dataPath, const std::string &treePath, Mode mode)
+        : mode_(mode)
+    {
+        open(dataPath, treePath, nullptr);
+    }
+
+    inline VerifiedFile::~VerifiedFile()
+    {
+        close();
+    }
+
+    inline void VerifiedFile::open(const std::string &dataPath, const std::string &treePath, const Hash *root)
+    {
+        using namespace VerityDetail;
+
+        if (mode_ == Mode::Fault && sysconf(_SC_PAGESIZE) != static_cast<long>(BlockSize))
+            throw std::runtime_error("fault driven verification needs 4 KiB pages");
+
+        int treeFd = ::open(treePath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (treeFd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + treePath);
+
+        int dataFd = ::open(dataPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (dataFd < 0)
+        {
+            int err = errno;
+            ::close(treeFd);
+            throw std::system_error(err, std::generic_category(), "open " + dataPath);
+        }
+
+        try
+        {
+            struct stat treeStat, dataStat;
+            if (fstat(treeFd, &treeStat) != 0)
+                throw std::system_error(errno, std::generic_category(), "stat " + treePath);
+            if (fstat(dataFd, &dataStat) != 0)
+                throw std::system_error(errno, std::generic_category(), "stat " + dataPath);
+
+            Header header;
+            bool valid = pread(treeFd, &header, sizeof(header), 0) == sizeof(header) &&
+                         std::memcmp(header.magic, Magic, sizeof(Magic)) == 0 && header.version == Version &&
+                         header.blockSize == BlockSize && header.hashSize == HashSize &&
+                         header.dataSize == static_cast<uint64_t>(dataStat.st_size);
+
+            std::vector<uint64_t> levels;
+            uint64_t total = 0;
+            if (valid)
+            {
+                levels = levelBlocks(header.dataSize);
+                for (uint64_t n : levels)
+                    total += n;
+                valid = header.levels == levels.size() &&
+                        static_cast<uint64_t>(treeStat.st_size) == HeaderSize + total * BlockSize;
+            }
+            if (!valid)
+                throw std::runtime_error("not a hash tree for " + dataPath + ": " + treePath);
+
+            dataSize = header.dataSize;
+            blocks = VerityDetail::blockCount(dataSize);
+            std::memcpy(root_.data(), root != nullptr ? root->data() : header.root, HashSize);
+
+            uint64_t start = 0;
+            for (uint64_t n : levels)
+            {
+                levelStart.push_back(start);
+                start += n;
+            }
+
+            treeMapSize = static_cast<size_t>(treeStat.st_size);
+            void *map = mmap(nullptr, treeMapSize, PROT_READ, MAP_SHARED, treeFd, 0);
+            if (map == MAP_FAILED)
+                throw std::system_error(errno, std::generic_category(), "mmap " + treePath);
+            tree = static_cast<const byte *>(map) + HeaderSize;
+
+            if (dataSize > 0)
+            {
+                fileMapSize = static_cast<size_t>(dataSize);
+                map = mmap(nullptr, fileMapSize, PROT_READ, MAP_SHARED, dataFd, 0);
+                if (map == MAP_FAILED)
+                    throw std::system_error(errno, std::generic_category(), "mmap " + dataPath);
+                fileMap = static_cast<const byte *>(map);
+            }
+
+            verified = Bitmap(blocks);
+            verifiedHashes = Bitmap(total);
+
+            ///< the one O(1) check at open: the top block against the root
+            verifyHashBlock(static_cast<unsigned>(levels.size() - 1), 0);
+
+            view = fileMap;
+            if (mode_ == Mode::Fault && dataSize > 0)
+                startFaultHandling();
+        }
+        catch (...)
+        {
+            ::close(treeFd);
+            ::close(dataFd);
+            close();
+            throw;
+        }
+        ::close(treeFd);
+        ::close(dataFd);
+    }
+
+    inline void VerifiedFile::close()
+    {
+        if (handler.joinable())
+        {
+            uint64_t one = 1;
+            ssize_t n = write(wake, &one, sizeof(one));
+            (void)n;
+            handler.join();
+        }
+        if (wake >= 0)
+            ::close(wake);
+        if (uffd >= 0)
+            ::close(uffd);
+        if (region != nullptr)
+            munmap(region, regionSize);
+        if (fileMap != nullptr)
+            munmap(const_cast<byte *>(fileMap), fileMapSize);
+        if (tree != nullptr)
+            munmap(const_cast<byte *>(tree - VerityDetail::HeaderSize), treeMapSize);
+
+        wake = uffd = -1;
+        region = nullptr;
+        fileMap = tree = view = nullptr;
+    }
+
+    inline void VerifiedFile::verifyHashBlock(unsigned level, uint64_t index)
+    {
+        using namespace VerityDetail;
+
+        const uint64_t id = levelStart[level] + index;
+        if (verifiedHashes.test(id))
+            return;
+
+        Hash hash;
+        bool ok;
+        if (level + 1 == levelStart.size())
+        {
+            rootHash(dataSize, static_cast<uint32_t>(levelStart.size()), hashBlock(level, index), hash.data());
+            ok = hash == root_;
+        }
+        else
+        {
+            HashDispatch::Sha256(hashBlock(level, index), BlockSize, hash.data());
+            verifyHashBlock(level + 1, index / Fanout);
+            ok = std::memcmp(hashBlock(level + 1, index / Fanout) + (index % Fanout) * HashSize, hash.data(),
+                             HashSize) == 0;
+        }
+
+        if (!ok)
+            throw VerityError("hash block " + std::to_string(index) + " of level " + std::to_string(level) +
+                              " does not match the tree");
+        verifiedHashes.set(id);
+    }
+
+    inline void VerifiedFile::checkBlock(uint64_t b, const byte *hash)
+    {
+        using namespace VerityDetail;
+
+        verifyHashBlock(0, b / Fanout);
+        if (std::memcmp(hashBlock(0, b / Fanout) + (b % Fanout) * HashSize, hash, HashSize) != 0)
+            throw VerityError("block " + std::to_string(b) + " does not match the tree");
+    }
+
+    inline void VerifiedFile::verifyRange(uint64_t offset, uint64_t len)
+    {
+        using namespace VerityDetail;
+
+        if (offset > dataSize || len > dataSize - offset)
+            throw std::out_of_range("verifyRange past the end of the file");
+        if (len == 0)
+            return;
+
+        const uint64_t end = (offset + len + BlockSize - 1) / BlockSize;
+        byte hashes[BatchBlocks * HashSize];
+
+        for (uint64_t b = offset / BlockSize; b < end;)
+        {
+            if (verified.test(b))
+            {
+                ++b;
+                continue;
+            }
+
+            uint64_t n = 1;
+            while (b + n < end && n < BatchBlocks && !verified.test(b + n))
+                ++n;
+
+            if (mode_ == Mode::Fault)
+            {
+                int error;
+                if (!populate(b, n, error))
+                {
+                    if (error != 0)
+                        throw std::system_error(error, std::generic_category(), "UFFDIO_COPY");
+                    throw VerityError("range at " + std::to_string(offset) + " does not match the tree");
+                }
+            }
+            else
+            {
+                hashBlocks(fileMap, dataSize, b, n, hashes);
+                for (uint64_t i = 0; i < n; ++i)
+                {
+                    checkBlock(b + i, hashes + i * HashSize);
+                    verified.set(b + i);
+                }
+            }
+            b += n;
+        }
+    }
+
+    inline bool VerifiedFile::isVerified(uint64_t offset, uint64_t len) const
+    {
+        if (offset > dataSize || len > dataSize - offset)
+            return false;
+        for (uint64_t b = offset / BlockSize; b * BlockSize < offset + len; ++b)
+            if (!verified.test(b))
+                return false;
+        return true;
+    }
+
+    inline void VerifiedFile::startFaultHandling()
+    {
+        regionSize = static_cast<size_t>(blocks * BlockSize);
+        void *map = mmap(nullptr, regionSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (map == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        region = static_cast<byte *>(map);
+        madvise(region, regionSize, MADV_NOHUGEPAGE);
+
+        ///< with vm.unprivileged_userfaultfd=0 only CAP_SYS_PTRACE may handle kernel faults,
+        ///< anyone may still handle faults from user mode accesses
+        uffd = static_cast<int>(syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK));
+#ifdef UFFD_USER_MODE_ONLY
+        if (uffd < 0 && errno == EPERM)
+        {
+            uffd = static_cast<int>(syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY));
+            userOnly = uffd >= 0;
+        }
+#endif
+        if (uffd < 0)
+            throw std::system_error(errno, std::generic_category(), "userfaultfd");
+
+        uffdio_api api = {};
+        api.api = UFFD_API;
+        if (ioctl(uffd, UFFDIO_API, &api) != 0)
+            throw std::system_error(errno, std::generic_category(), "UFFDIO_API");
+
+        uffdio_register reg = {};
+        reg.range.start = reinterpret_cast<uintptr_t>(region);
+        reg.range.len = regionSize;
+        reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+        if (ioctl(uffd, UFFDIO_REGISTER, &reg) != 0)
+            throw std::system_error(errno, std::generic_category(), "UFFDIO_REGISTER");
+
+        wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (wake < 0)
+            throw std::system_error(errno, std::generic_category(), "eventfd");
+
+        view = region;
+        handler = std::thread([this] { faultLoop(); });
+    }
+
+    inline void VerifiedFile::faultLoop()
+    {
+        using namespace VerityDetail;
+
+        pollfd fds[2] = {{uffd, POLLIN, 0}, {wake, POLLIN, 0}};
+        for (;;)
+        {
+            if (poll(fds, 2, -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+            if (fds[1].revents != 0)
+                return;
+
+            uffd_msg msg;
+            ssize_t n = read(uffd, &msg, sizeof(msg));
+            if (n != sizeof(msg) || msg.event != UFFD_EVENT_PAGEFAULT)
+                continue;
+
+            const uint64_t b = (msg.arg.pagefault.address - reinterpret_cast<uintptr_t>(region)) / BlockSize;
+
+            ///< read ahead over blocks not installed yet
+            uint64_t count = 1;
+            while (b + count < blocks && count < FaultAround && !verified.test(b + count))
+                ++count;
+            int error;
+            if (!verified.test(b))
+                populate(b, count, error);
+
+            ///< the faulting thread may wait on a block installed by someone else
+            uffdio_range range = {reinterpret_cast<uintptr_t>(region) + b * BlockSize, BlockSize};
+            ioctl(uffd, UFFDIO_WAKE, &range);
+        }
+    }
+
+    inline void VerifiedFile::poison(uint64_t b)
+    {
+        ///< replaces the registered page, the access faults instead of reading it
+        byte *page = region + b * BlockSize;
+        mmap(page, BlockSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        failures.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline int VerifiedFile::install(uint64_t first, uint64_t count, const byte *copies)
+    {
+        using namespace VerityDetail;
+
+        int error = 0;
+        for (uint64_t done = 0; done < count;)
+        {
+            uffdio_copy copy = {};
+            copy.dst = reinterpret_cast<uintptr_t>(region + (first + done) * BlockSize);
+            copy.src = reinterpret_cast<uintptr_t>(copies + done * BlockSize);
+            copy.len = (count - done) * BlockSize;
+            copy.mode = UFFDIO_COPY_MODE_DONTWAKE;
+            const bool complete = ioctl(uffd, UFFDIO_COPY, &copy) == 0;
+            const int err = errno;
+
+            ///< recorded before the readers resume, only for pages that are really there
+            const uint64_t copied = complete ? count - done
+                                             : copy.copy > 0 ? static_cast<uint64_t>(copy.copy) / BlockSize : 0;
+            for (uint64_t b = first + done; b < first + done + copied; ++b)
+                verified.set(b);
+            done += copied;
+            if (complete || err == EAGAIN)
+                continue;
+
+            ///< installed by another thread first, or a hard error: that page cannot be served
+            if (err == EEXIST)
+                verified.set(first + done);
+            else
+            {
+                poison(first + done);
+                if (error == 0)
+                    error = err;
+            }
+            ++done;
+        }
+
+        uffdio_range range = {reinterpret_cast<uintptr_t>(region + first * BlockSize), count * BlockSize};
+        ioctl(uffd, UFFDIO_WAKE, &range);
+        return error;
+    }
+
+    inline bool VerifiedFile::populate(uint64_t first, uint64_t count, int &error)
+    {
+        using namespace VerityDetail;
+
+        ///< hash the copies that get installed, not the file, so what is read is what was checked
+        const uint64_t bytes = std::min<uint64_t>(count * BlockSize, dataSize - first * BlockSize);
+        std::vector<byte> copies(count * BlockSize);
+        std::vector<byte> hashes(count * HashSize);
+        std::memcpy(copies.data(), fileMap + first * BlockSize, bytes);
+        hashBlocks(copies.data(), bytes, 0, count, hashes.data());
+
+        uint64_t runStart = first;
+        uint64_t run = 0;
+        bool ok = true;
+        error = 0;
+
+        auto flush = [&] {
+            if (run == 0)
+                return;
+            int err = install(runStart, run, &copies[(runStart - first) * BlockSize]);
+            if (err != 0)
+            {
+                ok = false;
+                error = error != 0 ? error : err;
+            }
+            run = 0;
+        };
+
+        for (uint64_t b = first; b < first + count; ++b)
+        {
+            if (verified.test(b))
+            {
+                flush();
+                continue;
+            }
+
+            try
+            {
+                checkBlock(b, &hashes[(b - first) * HashSize]);
+            }
+            catch (const VerityError &)
+            {
+                flush();
+                poison(b);
+                uffdio_range range = {reinterpret_cast<uintptr_t>(region + b * BlockSize), BlockSize};
+                ioctl(uffd, UFFDIO_WAKE, &range);
+                ok = false;
+                continue;
+            }
+
+            if (run == 0)
+                runStart = b;
+            ++run;
+        }
+
+        flush();
+        return ok;
+    }
+
+} // namespace Crypto
+
+#endif /* end of include guard :  CRYPTOGRAPHY_VERITY_HPP */
@@ -0,0 +1,263 @@
+/**
+ * hash_latency: tail latency of a single threaded event loop that hashes
+ * large bodies inline, one-shot versus HashJob steps (see hash_job.hpp).
+ *
+ *      g++ -std=c++17 -O2 -pthread -Iinclude tools/hash_latency.cpp -o hash_latency
+ *
+ *      hash_latency [-a sha256|md5] [--portable] [--size MiB] [--every MS]
+ *                   [--budget US] [--bytes KiB] [--tick US] [--seconds S]
+ *
+ * small requests arrive every --tick microseconds and are served on the next
+ * loop iteration, a body of --size MiB arrives every --every milliseconds.
+ * Each mode runs the same schedule; the table shows how long small requests
+ * waited (p50 / p99 / p99.9 / max) and how long a body took to be hashed.
+ * --portable hashes with Sha26 / Md5 instead of the dispatched kernels.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "hash_dispatch.hpp"
+#include "hash_job.hpp"
+#include "md5.hpp"
+#include "sha26.hpp"
+
+namespace
+{
+    using Crypto::HashDispatch;
+    using Clock = std::chrono::steady_clock;
+
+    struct Settings
+    {
+        bool md5 = false;
+        bool portable = false;
+        size_t size = 8 << 20;
+        std::chrono::microseconds every{50000};
+        std::chrono::microseconds budget{100};
+        size_t bytes = 64 << 10;
+        std::chrono::microseconds tick{20};
+        double seconds = 2.0;
+    };
+
+    enum class Mode
+    {
+        OneShot,
+        Bytes,
+        Time
+    };
+
+    struct Result
+    {
+        std::vector<double> waits;
+        std::vector<double> bodies;
+        std::vector<byte> digest;
+    };
+
+    std::vector<byte> finish(HashDispatch::Stream &stream)
+    {
+        std::vector<byte> out(stream.DigestSize());
+        stream.GetHash(out.data());
+        return out;
+    }
+
+    template <typename Hasher>
+    std::vector<byte> finish(Hasher &hasher)
+    {
+        std::vector<byte> out = hasher.GetHash();
+        hasher.reset();
+        return out;
+    }
+
+    double micros(Clock::duration d)
+    {
+        return std::chrono::duration<double, std::micro>(d).count();
+    }
+
+    template <typename Job>
+    Result simulate(Job &job, const std::vector<byte> &body, const Settings &settings, Mode mode)
+    {
+        Result result;
+        const Clock::time_point start = Clock::now();
+        const Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(
+                                                  std::chrono::duration<double>(settings.seconds));
+
+        Clock::time_point nextTick = start;
+        Clock::time_point nextBody = start;
+        Clock::time_point bodyArrived;
+        bool hashing = false;
+
+        for (Clock::time_point now = start; now < end; now = Clock::now())
+        {
+            ///< serve every small request that arrived by now
+            for (; nextTick <= now; nextTick += settings.tick)
+                result.waits.push_back(micros(now - nextTick));
+
+            if (!hashing && nextBody <= now)
+            {
+                job.restart(body.data(), body.size());
+                bodyArrived = nextBody;
+                nextBody += settings.every;
+                hashing = true;
+            }
+            if (!hashing)
+                continue;
+
+            bool done = false;
+            switch (mode)
+            {
+            case Mode::OneShot:
+                done = job.step(body.size());
+                break;
+            case Mode::Bytes:
+                done = job.step(settings.bytes);
+                break;
+            case Mode::Time:
+                done = job.step(std::chrono::nanoseconds(settings.budget));
+                break;
+            }
+
+            if (done)
+            {
+                result.digest = finish(job.hasher());
+                result.bodies.push_back(micros(Clock::now() - bodyArrived));
+                hashing = false;
+            }
+        }
+
+        ///< a body cut off by the end of the run must not leak into the next mode's first digest
+        if (hashing)
+            finish(job.hasher());
+        return result;
+    }
+
+    double percentile(std::vector<double> &values, double p)
+    {
+        if (values.empty())
+            return 0;
+        size_t k = std::min(values.size() - 1, static_cast<size_t>(p * static_cast<double>(values.size())));
+        std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(k), values.end());
+        return values[k];
+    }
+
+    void report(const char *name, Result &result)
+    {
+        double body = percentile(result.bodies, 0.5);
+        std::printf("%-16s %10.1f %10.1f %10.1f %10.1f %12.0f %8zu\n", name, percentile(result.waits, 0.5),
+                    percentile(result.waits, 0.99), percentile(result.waits, 0.999),
+                    result.waits.empty() ? 0.0 : *std::max_element(result.waits.begin(), result.waits.end()), body,
+                    result.bodies.size());
+    }
+
+    template <typename Job>
+    int run(Job &job, const Settings &settings)
+    {
+        std::vector<byte> body(settings.size);
+        std::mt19937_64 random(1);
+        for (byte &b : body)
+            b = static_cast<byte>(random());
+
+        char budget[64], bytes[64];
+        std::snprintf(budget, sizeof(budget), "step(%lldus)", static_cast<long long>(settings.budget.count()));
+        std::snprintf(bytes, sizeof(bytes), "step(%zuKiB)", settings.bytes >> 10);
+
+        std::printf("%zu MiB body every %lld ms, request every %lld us, %.1f s per mode\n", settings.size >> 20,
+                    static_cast<long long>(settings.every.count() / 1000), static_cast<long long>(settings.tick.count()),
+                    settings.seconds);
+        std::printf("%-16s %10s %10s %10s %10s %12s %8s\n", "mode", "p50 us", "p99 us", "p99.9 us", "max us",
+                    "body p50 us", "bodies");
+
+        Result oneShot = simulate(job, body, settings, Mode::OneShot);
+        report("one-shot", oneShot);
+        Result byBytes = simulate(job, body, settings, Mode::Bytes);
+        report(bytes, byBytes);
+        Result byTime = simulate(job, body, settings, Mode::Time);
+        report(budget, byTime);
+
+        ///< a mode that finished no body within the run has nothing to compare
+        const std::vector<byte> *reference = nullptr;
+        bool differ = false;
+        for (const Result *result : {&oneShot, &byBytes, &byTime})
+        {
+            if (result->digest.empty())
+                continue;
+            if (reference != nullptr && result->digest != *reference)
+                differ = true;
+            reference = &result->digest;
+        }
+        if (differ)
+        {
+            std::fprintf(stderr, "hash_latency: digests differ between modes\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    [[noreturn]] void usage(int status)
+    {
+        std::fprintf(status == 0 ? stdout : stderr,
+                     "Usage: hash_latency [-a sha256|md5] [--portable] [--size MiB] [--every MS]\n"
+                     "                    [--budget US] [--bytes KiB] [--tick US] [--seconds S]\n");
+        std::exit(status);
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Settings settings;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (arg == "--help")
+            usage(0);
+        else if (arg == "--portable")
+            settings.portable = true;
+        else if (value == nullptr)
+            usage(1);
+        else if (arg == "-a")
+        {
+            std::string name = argv[++i];
+            if (name != "sha256" && name != "md5")
+                usage(1);
+            settings.md5 = name == "md5";
+        }
+        else if (arg == "--size")
+            settings.size = std::strtoull(argv[++i], nullptr, 10) << 20;
+        else if (arg == "--every")
+            settings.every = std::chrono::microseconds(std::strtoll(argv[++i], nullptr, 10) * 1000);
+        else if (arg == "--budget")
+            settings.budget = std::chrono::microseconds(std::strtoll(argv[++i], nullptr, 10));
+        else if (arg == "--bytes")
+            settings.bytes = std::strtoull(argv[++i], nullptr, 10) << 10;
+        else if (arg == "--tick")
+            settings.tick = std::chrono::microseconds(std::strtoll(argv[++i], nullptr, 10));
+        else if (arg == "--seconds")
+            settings.seconds = std::strtod(argv[++i], nullptr);
+        else
+            usage(1);
+    }
+    if (settings.tick.count() <= 0 || settings.every.count() <= 0 || settings.seconds <= 0)
+        usage(1);
+
+    if (settings.portable && settings.md5)
+    {
+        Crypto::HashJob<Crypto::Md5> job(nullptr, 0);
+        return run(job, settings);
+    }
+    if (settings.portable)
+    {
+        Crypto::HashJob<Crypto::Sha26> job(nullptr, 0);
+        return run(job, settings);
+    }
+
+    Crypto::HashJob<HashDispatch::Stream> job(nullptr, 0, settings.md5 ? HashDispatch::Function::Md5
+                                                                        : HashDispatch::Function::Sha256);
+    return run(job, settings);
+}
@@ -0,0 +1,91 @@
+/**
+ * hashd: node local hashing daemon (see HashDaemon in hash_daemon.hpp).
+ *
+ *      g++ -std=c++17 -O2 -pthread -Iinclude tools/hashd.cpp -o hashd
+ *
+ *      hashd [--socket PATH] [-j N]     serve in the foreground until SIGINT / SIGTERM
+ *      hashd --stats [--socket PATH]    print the per client table of a running daemon
+ */
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "hash_daemon.hpp"
+
+namespace
+{
+    Crypto::HashDaemon *running = nullptr;
+
+    void onSignal(int)
+    {
+        if (running != nullptr)
+            running->stop();
+    }
+
+    [[noreturn]] void usage(int status)
+    {
+        std::fprintf(status == 0 ? stdout : stderr,
+                     "Usage: hashd [--socket PATH] [-j N]\n"
+                     "       hashd --stats [--socket PATH]\n"
+                     "default socket: %s\n",
+                     Crypto::HashDaemon::DefaultPath().c_str());
+        std::exit(status);
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string path = Crypto::HashDaemon::DefaultPath();
+    size_t threads = 0;
+    bool stats = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--stats")
+            stats = true;
+        else if (arg == "--socket" && i + 1 < argc)
+            path = argv[++i];
+        else if (arg.compare(0, 9, "--socket=") == 0)
+            path = arg.substr(9);
+        else if (arg == "-j" && i + 1 < argc)
+            threads = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--help")
+            usage(0);
+        else
+            usage(1);
+    }
+
+    try
+    {
+        if (stats)
+        {
+            Crypto::HashClient client(path);
+            std::cout << client.Stats();
+            return 0;
+        }
+
+        Crypto::HashDaemon daemon(path, threads);
+        running = &daemon;
+
+        struct sigaction action = {};
+        action.sa_handler = onSignal;
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+        signal(SIGPIPE, SIG_IGN);
+
+        std::fprintf(stderr, "hashd: listening on %s\n", path.c_str());
+        daemon.run();
+        running = nullptr;
+    }
+    catch (const std::exception &error)
+    {
+        std::fprintf(stderr, "hashd: %s\n", error.what());
+        return 1;
+    }
+    return 0;
+}
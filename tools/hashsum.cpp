@@ -0,0 +1,906 @@
+/**
+ * hashsum: parallel, coreutils compatible sha256sum / md5sum.
+ *
+ *      g++ -std=c++17 -O2 -pthread -Iinclude tools/hashsum.cpp -o hashsum
+ *
+ * run (or symlinked) as sha256sum / md5sum it picks the algorithm from its
+ * name, otherwise -a sha256|md5 selects it. Files are hashed concurrently,
+ * output stays in argument order and byte for byte matches coreutils.
+ */
+
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blake3.hpp"
+#include "crc32c.hpp"
+#include "hash_dispatch.hpp"
+#include "kernel_hash.hpp"
+#include "thread_pool.hpp"
+
+namespace
+{
+    using Crypto::HashDispatch;
+
+    struct Algorithm
+    {
+        const char *name;
+        const char *tool;
+        const char *tag;
+        HashDispatch::Function function;
+        Crypto::KernelHash::Algorithm kernel;
+        size_t digestSize;
+    };
+
+    const Algorithm Algorithms[] = {
+        {"sha256", "sha256sum", "SHA256", HashDispatch::Function::Sha256, Crypto::KernelHash::Algorithm::Sha256, 32},
+        {"md5", "md5sum", "MD5", HashDispatch::Function::Md5, Crypto::KernelHash::Algorithm::Md5, 16},
+    };
+
+    struct Options
+    {
+        const Algorithm *algorithm = &Algorithms[0];
+        bool binary = false;
+        bool check = false;
+        bool tag = false;
+        bool zero = false;
+        bool quiet = false;
+        bool status = false;
+        bool strict = false;
+        bool warn = false;
+        bool ignoreMissing = false;
+        bool direct = false;
+        bool bench = false;
+        size_t benchMiB = 256;
+        size_t threads = 0;
+        std::vector<std::string> files;
+    };
+
+    struct Result
+    {
+        std::string hex;
+        int error = 0;
+    };
+
+    ///< read size, and O_DIRECT alignment of buffer, offsets and sizes
+    constexpr size_t BufferSize = 1 << 20;
+    constexpr size_t Alignment = 4096;
+
+    std::string program = "sha256sum";
+
+    ///< stdin can only be consumed by one task at a time
+    std::mutex stdinLock;
+
+    std::string toHex(const byte *digest, size_t len)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex(2 * len, '0');
+        for (size_t i = 0; i < len; ++i)
+        {
+            hex[2 * i] = digits[digest[i] >> 4];
+            hex[2 * i + 1] = digits[digest[i] & 15];
+        }
+        return hex;
+    }
+
+    byte *readBuffer()
+    {
+        struct Buffer
+        {
+            void *data = nullptr;
+
+            Buffer()
+            {
+                if (posix_memalign(&data, Alignment, BufferSize) != 0)
+                    throw std::bad_alloc();
+            }
+
+            ~Buffer()
+            {
+                free(data);
+            }
+        };
+
+        thread_local Buffer buffer;
+        return static_cast<byte *>(buffer.data);
+    }
+
+    int readAll(int fd, HashDispatch::Stream &stream, bool positional)
+    {
+        byte *buffer = readBuffer();
+        off_t offset = 0;
+
+        for (;;)
+        {
+            ssize_t n = positional ? pread(fd, buffer, BufferSize, offset) : read(fd, buffer, BufferSize);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                ///< an unaligned tail or a file system without direct io support
+                int flags = fcntl(fd, F_GETFL);
+                if (errno == EINVAL && flags != -1 && (flags & O_DIRECT))
+                {
+                    fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+                    continue;
+                }
+                return errno;
+            }
+            if (n == 0)
+                return 0;
+
+            stream.addData(buffer, static_cast<size_t>(n));
+            offset += n;
+        }
+    }
+
+    Result hashPath(const std::string &path, const Options &options)
+    {
+        Result result;
+        HashDispatch::Stream stream(options.algorithm->function);
+        byte digest[32];
+
+        if (path == "-")
+        {
+            std::lock_guard<std::mutex> lock(stdinLock);
+            result.error = readAll(STDIN_FILENO, stream, false);
+            if (result.error == 0)
+            {
+                stream.GetHash(digest);
+                result.hex = toHex(digest, stream.DigestSize());
+            }
+            return result;
+        }
+
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | (options.direct ? O_DIRECT : 0));
+        if (fd < 0 && options.direct && errno == EINVAL)
+            fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            result.error = errno;
+            return result;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+            result.error = errno;
+        else if (S_ISDIR(st.st_mode))
+            result.error = EISDIR;
+
+        bool done = result.error != 0;
+
+        ///< AF_ALG when the backend policy asks for it, on failure the file is simply read again
+        if (!done && S_ISREG(st.st_mode) &&
+            Crypto::KernelHash::Select(options.algorithm->kernel, Crypto::KernelHash::policy(), st.st_size, true) ==
+                Crypto::KernelHash::Backend::Kernel)
+        {
+            try
+            {
+                Crypto::KernelHash hash(options.algorithm->kernel);
+                hash.addFd(fd);
+                hash.GetHash(digest);
+                result.hex = toHex(digest, hash.DigestSize());
+                close(fd);
+                return result;
+            }
+            catch (const std::system_error &)
+            {
+            }
+        }
+        ///< pread, not mmap: a file truncated while hashed must not SIGBUS the whole run
+        if (!done && S_ISREG(st.st_mode) && !options.direct)
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        if (!done)
+            result.error = readAll(fd, stream, S_ISREG(st.st_mode));
+
+        close(fd);
+
+        if (result.error == 0)
+        {
+            stream.GetHash(digest);
+            result.hex = toHex(digest, stream.DigestSize());
+        }
+        return result;
+    }
+
+    void printError(const std::string &message)
+    {
+        std::string line = program + ": " + message + "\n";
+        fflush(stdout);
+        fwrite(line.data(), 1, line.size(), stderr);
+    }
+
+    ///< file names in diagnostics are shell quoted like coreutils' quotef
+    std::string quote(const std::string &name)
+    {
+        bool plain = !name.empty();
+        for (char c : name)
+            if (!std::isalnum(static_cast<unsigned char>(c)) && !std::strchr("%+,-./:=@_", c))
+                plain = false;
+        if (plain)
+            return name;
+
+        static const char *const controls[] = {"\\a", "\\b", "\\t", "\\n", "\\v", "\\f", "\\r"};
+        std::string out = "'";
+        for (char c : name)
+        {
+            unsigned char u = static_cast<unsigned char>(c);
+            if (c == '\'')
+                out += "'\\''";
+            else if (u >= '\a' && u <= '\r')
+                out += std::string("'$'") + controls[u - '\a'] + "''";
+            else if (u < 0x20 || u == 0x7f)
+            {
+                char octal[8];
+                std::snprintf(octal, sizeof(octal), "\\%03o", u);
+                out += std::string("'$'") + octal + "''";
+            }
+            else
+                out += c;
+        }
+        out += "'";
+
+        ///< drop the empty '' left behind by an escape at the end
+        if (out.size() > 2 && out.compare(out.size() - 2, 2, "''") == 0 && out[out.size() - 3] == '\'')
+            out.erase(out.size() - 2);
+        return out;
+    }
+
+    std::string quoteInput(const std::string &path)
+    {
+        return path == "-" ? quote("standard input") : quote(path);
+    }
+
+    void printFileError(const std::string &name, int error)
+    {
+        printError(quote(name) + ": " + std::strerror(error));
+    }
+
+    ///< coreutils escapes \, newline and carriage return and flags the line with a leading backslash
+    bool needsEscape(const std::string &name)
+    {
+        return name.find_first_of("\\\n\r") != std::string::npos;
+    }
+
+    std::string escape(const std::string &name)
+    {
+        std::string out;
+        out.reserve(name.size());
+        for (char c : name)
+        {
+            if (c == '\\')
+                out += "\\\\";
+            else if (c == '\n')
+                out += "\\n";
+            else if (c == '\r')
+                out += "\\r";
+            else
+                out += c;
+        }
+        return out;
+    }
+
+    bool unescape(const std::string &name, std::string &out)
+    {
+        out.clear();
+        for (size_t i = 0; i < name.size(); ++i)
+        {
+            if (name[i] != '\\')
+            {
+                out += name[i];
+                continue;
+            }
+            if (++i == name.size())
+                return false;
+            if (name[i] == '\\')
+                out += '\\';
+            else if (name[i] == 'n')
+                out += '\n';
+            else if (name[i] == 'r')
+                out += '\r';
+            else
+                return false;
+        }
+        return true;
+    }
+
+    void writeOut(const std::string &text)
+    {
+        fwrite(text.data(), 1, text.size(), stdout);
+    }
+
+    void printDigest(const Options &options, const std::string &name, const std::string &hex)
+    {
+        bool escaped = !options.zero && needsEscape(name);
+        std::string shown = escaped ? escape(name) : name;
+        std::string line = escaped ? "\\" : "";
+
+        if (options.tag)
+            line += std::string(options.algorithm->tag) + " (" + shown + ") = " + hex;
+        else
+            line += hex + (options.binary ? " *" : "  ") + shown;
+
+        line += options.zero ? '\0' : '\n';
+        writeOut(line);
+    }
+
+    int hashFiles(const Options &options, Crypto::ThreadPool &pool)
+    {
+        std::vector<std::string> files = options.files;
+        if (files.empty())
+            files.push_back("-");
+
+        std::vector<std::future<Result>> results;
+        results.reserve(files.size());
+        for (const std::string &file : files)
+            results.push_back(pool.submit([&file, &options] { return hashPath(file, options); }));
+
+        int status = 0;
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            Result result = pool.wait(results[i]);
+            if (result.error != 0)
+            {
+                printFileError(files[i], result.error);
+                status = 1;
+                continue;
+            }
+            printDigest(options, files[i], result.hex);
+        }
+        return status;
+    }
+
+    bool isHex(const std::string &text)
+    {
+        for (char c : text)
+            if (!std::isxdigit(static_cast<unsigned char>(c)))
+                return false;
+        return !text.empty();
+    }
+
+    /**
+     * parse "<hex>  name", "<hex> *name" or "TAG (name) = <hex>", each
+     * optionally escaped with a leading backslash
+     */
+    bool parseLine(std::string line, const Options &options, std::string &name, std::string &hex)
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        size_t i = line.find_first_not_of(" \t");
+        if (i == std::string::npos)
+            return false;
+
+        bool escaped = line[i] == '\\';
+        if (escaped)
+            ++i;
+
+        std::string raw;
+        const size_t hexLen = 2 * options.algorithm->digestSize;
+        const std::string tag = options.algorithm->tag;
+
+        if (line.compare(i, tag.size(), tag) == 0)
+        {
+            size_t j = i + tag.size();
+            if (j < line.size() && line[j] == ' ')
+                ++j;
+            if (j >= line.size() || line[j] != '(')
+                return false;
+
+            size_t close = line.rfind(") = ");
+            if (close == std::string::npos || close < j + 1)
+                return false;
+
+            raw = line.substr(j + 1, close - j - 1);
+            hex = line.substr(close + 4);
+        }
+        else
+        {
+            if (line.size() < i + hexLen + 2)
+                return false;
+
+            hex = line.substr(i, hexLen);
+            size_t j = i + hexLen;
+            if (line[j] != ' ')
+                return false;
+            ++j;
+            if (line[j] == ' ' || line[j] == '*')
+                ++j;
+            raw = line.substr(j);
+        }
+
+        if (hex.size() != hexLen || !isHex(hex) || raw.empty())
+            return false;
+        for (char &c : hex)
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+
+        if (!escaped)
+        {
+            name = raw;
+            return true;
+        }
+        return unescape(raw, name);
+    }
+
+    bool readLines(const std::string &path, std::vector<std::string> &lines)
+    {
+        if (path == "-")
+        {
+            std::lock_guard<std::mutex> lock(stdinLock);
+            for (std::string line; std::getline(std::cin, line);)
+                lines.push_back(line);
+            return !std::cin.bad();
+        }
+
+        std::ifstream in(path);
+        if (!in)
+            return false;
+        for (std::string line; std::getline(in, line);)
+            lines.push_back(line);
+        return !in.bad();
+    }
+
+    std::string plural(size_t n, const char *one, const char *many)
+    {
+        return std::to_string(n) + " " + (n == 1 ? one : many);
+    }
+
+    int checkFile(const std::string &path, const Options &options, Crypto::ThreadPool &pool)
+    {
+        std::vector<std::string> lines;
+        if (!readLines(path, lines))
+        {
+            printFileError(path, errno != 0 ? errno : EIO);
+            return 1;
+        }
+
+        struct Entry
+        {
+            size_t line;
+            std::string name;
+            std::string hex;
+            std::future<Result> result;
+        };
+
+        std::vector<Entry> entries;
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            Entry entry;
+            entry.line = i;
+            if (parseLine(lines[i], options, entry.name, entry.hex))
+                entries.push_back(std::move(entry));
+        }
+
+        for (Entry &entry : entries)
+        {
+            const std::string *name = &entry.name;
+            entry.result = pool.submit([name, &options] { return hashPath(*name, options); });
+        }
+
+        ///< report in line order, malformed lines between the entries around them
+        size_t malformed = 0, mismatched = 0, unreadable = 0, verified = 0;
+        size_t next = 0;
+        auto skipMalformed = [&](size_t upTo) {
+            for (; next < upTo; ++next)
+            {
+                ++malformed;
+                if (options.warn)
+                    printError(quoteInput(path) + ": " + std::to_string(next + 1) + ": improperly formatted " +
+                               options.algorithm->tag + " checksum line");
+            }
+        };
+
+        for (Entry &entry : entries)
+        {
+            skipMalformed(entry.line);
+            ++next;
+
+            Result result = pool.wait(entry.result);
+
+            ///< unlike the digest lines, only newlines force escaping here
+            bool escaped = entry.name.find('\n') != std::string::npos;
+            std::string shown = escaped ? "\\" + escape(entry.name) : entry.name;
+
+            if (result.error != 0)
+            {
+                if (options.ignoreMissing && result.error == ENOENT)
+                    continue;
+
+                printFileError(entry.name, result.error);
+                ++unreadable;
+                if (!options.status)
+                    writeOut(shown + ": FAILED open or read\n");
+                continue;
+            }
+
+            ++verified;
+            if (result.hex != entry.hex)
+            {
+                ++mismatched;
+                if (!options.status)
+                    writeOut(shown + ": FAILED\n");
+            }
+            else if (!options.quiet && !options.status)
+            {
+                writeOut(shown + ": OK\n");
+            }
+        }
+        skipMalformed(lines.size());
+
+        if (entries.empty())
+        {
+            printError(quoteInput(path) + ": no properly formatted checksum lines found");
+            return 1;
+        }
+
+        if (!options.status)
+        {
+            if (malformed > 0)
+                printError("WARNING: " + plural(malformed, "line is", "lines are") + " improperly formatted");
+            if (unreadable > 0)
+                printError("WARNING: " + plural(unreadable, "listed file", "listed files") + " could not be read");
+            if (mismatched > 0)
+                printError("WARNING: " + plural(mismatched, "computed checksum", "computed checksums") + " did NOT match");
+        }
+
+        if (options.ignoreMissing && verified == 0)
+        {
+            if (!options.status)
+                printError(quoteInput(path) + ": no file was verified");
+            return 1;
+        }
+
+        return mismatched > 0 || unreadable > 0 || (options.strict && malformed > 0) ? 1 : 0;
+    }
+
+    template <typename Hash>
+    double throughput(const std::vector<byte> &data, size_t threads, Crypto::ThreadPool &pool, Hash hash)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        size_t slice = (data.size() / threads) & ~size_t(63);
+        auto run = [&] {
+            std::vector<std::future<void>> parts;
+            for (size_t t = 0; t < threads; ++t)
+            {
+                const byte *begin = data.data() + t * slice;
+                size_t len = t + 1 == threads ? data.size() - t * slice : slice;
+                parts.push_back(pool.submit([begin, len, &hash] { hash(begin, len); }));
+            }
+            for (std::future<void> &part : parts)
+                pool.wait(part);
+        };
+
+        run();
+        double best = 0;
+        for (int trial = 0; trial < 3; ++trial)
+        {
+            Clock::time_point start = Clock::now();
+            run();
+            double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            if (trial == 0 || seconds < best)
+                best = seconds;
+        }
+        return static_cast<double>(data.size()) / best / 1e9;
+    }
+
+    int bench(const Options &options, Crypto::ThreadPool &pool)
+    {
+        std::vector<byte> data(options.benchMiB << 20);
+        for (size_t i = 0; i < data.size(); ++i)
+            data[i] = static_cast<byte>(i * 2654435761u >> 13);
+
+        const HashDispatch::Table &table = HashDispatch::get();
+        const size_t largest = HashDispatch::SizeClasses - 1;
+        size_t threads = pool.size();
+
+        auto sha256 = [](const byte *p, size_t n) {
+            HashDispatch::Stream stream(HashDispatch::Function::Sha256);
+            byte digest[32];
+            stream.addData(p, n);
+            stream.GetHash(digest);
+        };
+        auto md5 = [](const byte *p, size_t n) {
+            HashDispatch::Stream stream(HashDispatch::Function::Md5);
+            byte digest[16];
+            stream.addData(p, n);
+            stream.GetHash(digest);
+        };
+        auto blake3 = [](const byte *p, size_t n) {
+            Crypto::Blake3 hasher;
+            hasher.addData(p, n);
+            hasher.GetHash();
+        };
+        auto crc32c = [](const byte *p, size_t n) {
+            uint32_t crc = Crypto::Crc32c::Extend(0, p, n);
+            ///< keep the optimizer from dropping a result nobody reads
+            asm volatile("" : : "r"(crc));
+        };
+
+        std::printf("%zu MiB buffer, %zu threads\n", options.benchMiB, threads);
+        std::printf("%-8s %12s %12s  %s\n", "", "1 thread", "all threads", "kernel");
+
+        auto report = [&](const char *name, double one, double all, const char *kernel) {
+            std::printf("%-8s %7.2f GB/s %7.2f GB/s  %s\n", name, one, all, kernel);
+        };
+
+        report("sha256", throughput(data, 1, pool, sha256), throughput(data, threads, pool, sha256),
+               HashDispatch::KernelName(table.chosen[static_cast<size_t>(HashDispatch::Function::Sha256)][largest]));
+        report("md5", throughput(data, 1, pool, md5), throughput(data, threads, pool, md5),
+               HashDispatch::KernelName(table.chosen[static_cast<size_t>(HashDispatch::Function::Md5)][largest]));
+        report("blake3", throughput(data, 1, pool, blake3), throughput(data, threads, pool, blake3), "-");
+        report("crc32c", throughput(data, 1, pool, crc32c), throughput(data, threads, pool, crc32c), "-");
+
+        ///< whole file digests, userspace reads against AF_ALG splicing
+        int fd = memfd_create("hashsum-bench", MFD_CLOEXEC);
+        if (fd < 0 || write(fd, data.data(), data.size()) != static_cast<ssize_t>(data.size()))
+        {
+            printError(std::string("bench file: ") + std::strerror(errno));
+            return 1;
+        }
+
+        using Crypto::KernelHash;
+        auto fileRate = [&](KernelHash::Algorithm algorithm, KernelHash::Policy policy) {
+            double best = 0;
+            for (int trial = 0; trial < 4; ++trial)
+            {
+                auto start = std::chrono::steady_clock::now();
+                lseek(fd, 0, SEEK_SET);
+                KernelHash::HashFd(algorithm, fd, policy);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if (trial == 1 || (trial > 1 && seconds < best))
+                    best = seconds;
+            }
+            return static_cast<double>(data.size()) / best / 1e9;
+        };
+
+        std::printf("\n%-8s %12s %12s  %s\n", "file", "read", "af_alg", "kernel driver");
+        for (const Algorithm &algorithm : Algorithms)
+        {
+            double user = fileRate(algorithm.kernel, KernelHash::Policy::Userspace);
+            if (KernelHash::Available(algorithm.kernel))
+                std::printf("%-8s %7.2f GB/s %7.2f GB/s  %s\n", algorithm.name, user,
+                            fileRate(algorithm.kernel, KernelHash::Policy::Kernel), KernelHash::Driver(algorithm.kernel).c_str());
+            else
+                std::printf("%-8s %7.2f GB/s %12s  algif_hash unavailable\n", algorithm.name, user, "-");
+        }
+        close(fd);
+        return 0;
+    }
+
+    void usage()
+    {
+        std::printf(
+            "Usage: %s [OPTION]... [FILE]...\n"
+            "Print or check %s checksums, hashing files in parallel.\n"
+            "With no FILE, or when FILE is -, read standard input.\n"
+            "\n"
+            "  -a, --algorithm=NAME  sha256 or md5\n"
+            "  -b, --binary          read in binary mode\n"
+            "  -c, --check           read checksums from the FILEs and check them\n"
+            "      --tag             create a BSD-style checksum\n"
+            "  -t, --text            read in text mode (default)\n"
+            "  -z, --zero            end each output line with NUL, not newline,\n"
+            "                          and disable file name escaping\n"
+            "  -j, --threads=N       hash N files at a time (default: all cores)\n"
+            "      --direct          read with O_DIRECT, bypassing the page cache\n"
+            "      --backend=NAME    user, kernel (AF_ALG, spliced) or auto;\n"
+            "                          default: $CRYPTOGRAPHY_HASH_BACKEND or user\n"
+            "      --bench[=MIB]     report GB/s of each algorithm on this machine\n"
+            "\n"
+            "The following five options are useful only when verifying checksums:\n"
+            "      --ignore-missing  don't fail or report status for missing files\n"
+            "      --quiet           don't print OK for each successfully verified file\n"
+            "      --status          don't output anything, status code shows success\n"
+            "      --strict          exit non-zero for improperly formatted checksum lines\n"
+            "  -w, --warn            warn about improperly formatted checksum lines\n",
+            program.c_str(), program == "md5sum" ? "MD5 (128-bit)" : "SHA256 (256-bit)");
+    }
+
+    bool selectAlgorithm(const std::string &name, Options &options)
+    {
+        for (const Algorithm &algorithm : Algorithms)
+        {
+            if (name == algorithm.name)
+            {
+                options.algorithm = &algorithm;
+                program = algorithm.tool;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    [[noreturn]] void badUsage(const std::string &message)
+    {
+        printError(message);
+        std::fprintf(stderr, "Try '%s --help' for more information.\n", program.c_str());
+        std::exit(1);
+    }
+
+    Options parseArguments(int argc, char **argv)
+    {
+        Options options;
+
+        std::string self = argv[0];
+        self = self.substr(self.find_last_of('/') + 1);
+        if (self.find("md5") != std::string::npos)
+            selectAlgorithm("md5", options);
+        else
+            selectAlgorithm("sha256", options);
+
+        auto value = [&](int &i, const std::string &arg, const std::string &name) -> std::string {
+            if (arg.size() > name.size() && arg[name.size()] == '=')
+                return arg.substr(name.size() + 1);
+            if (i + 1 >= argc)
+                badUsage("option '" + name + "' requires an argument");
+            return argv[++i];
+        };
+
+        bool optionsDone = false;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+
+            if (optionsDone || arg == "-" || arg[0] != '-')
+            {
+                options.files.push_back(arg);
+                continue;
+            }
+
+            if (arg == "--")
+                optionsDone = true;
+            else if (arg == "--binary")
+                options.binary = true;
+            else if (arg == "--text")
+                options.binary = false;
+            else if (arg == "--check")
+                options.check = true;
+            else if (arg == "--tag")
+                options.tag = true;
+            else if (arg == "--zero")
+                options.zero = true;
+            else if (arg == "--quiet")
+                options.quiet = true;
+            else if (arg == "--status")
+                options.status = true;
+            else if (arg == "--strict")
+                options.strict = true;
+            else if (arg == "--warn")
+                options.warn = true;
+            else if (arg == "--ignore-missing")
+                options.ignoreMissing = true;
+            else if (arg == "--direct")
+                options.direct = true;
+            else if (arg.compare(0, 9, "--backend") == 0)
+            {
+                std::string name = value(i, arg, "--backend");
+                if (name == "user")
+                    Crypto::KernelHash::setPolicy(Crypto::KernelHash::Policy::Userspace);
+                else if (name == "kernel")
+                    Crypto::KernelHash::setPolicy(Crypto::KernelHash::Policy::Kernel);
+                else if (name == "auto")
+                    Crypto::KernelHash::setPolicy(Crypto::KernelHash::Policy::Auto);
+                else
+                    badUsage("unknown backend: '" + name + "'");
+            }
+            else if (arg == "--bench")
+                options.bench = true;
+            else if (arg.compare(0, 8, "--bench=") == 0)
+            {
+                options.bench = true;
+                options.benchMiB = std::strtoul(arg.c_str() + 8, nullptr, 10);
+                if (options.benchMiB == 0)
+                    badUsage("invalid buffer size: '" + arg.substr(8) + "'");
+            }
+            else if (arg.compare(0, 11, "--algorithm") == 0)
+            {
+                std::string name = value(i, arg, "--algorithm");
+                if (!selectAlgorithm(name, options))
+                    badUsage("unknown algorithm: '" + name + "'");
+            }
+            else if (arg.compare(0, 9, "--threads") == 0)
+                options.threads = std::strtoul(value(i, arg, "--threads").c_str(), nullptr, 10);
+            else if (arg == "--help")
+            {
+                usage();
+                std::exit(0);
+            }
+            else if (arg[1] == '-')
+                badUsage("unrecognized option '" + arg + "'");
+            else
+            {
+                ///< clustered short options, -a and -j take the rest or the next argument
+                for (size_t j = 1; j < arg.size(); ++j)
+                {
+                    char c = arg[j];
+                    if (c == 'a' || c == 'j')
+                    {
+                        std::string rest = arg.substr(j + 1);
+                        if (rest.empty())
+                        {
+                            if (i + 1 >= argc)
+                                badUsage(std::string("option requires an argument -- '") + c + "'");
+                            rest = argv[++i];
+                        }
+                        if (c == 'j')
+                            options.threads = std::strtoul(rest.c_str(), nullptr, 10);
+                        else if (!selectAlgorithm(rest, options))
+                            badUsage("unknown algorithm: '" + rest + "'");
+                        break;
+                    }
+
+                    switch (c)
+                    {
+                    case 'b':
+                        options.binary = true;
+                        break;
+                    case 't':
+                        options.binary = false;
+                        break;
+                    case 'c':
+                        options.check = true;
+                        break;
+                    case 'z':
+                        options.zero = true;
+                        break;
+                    case 'w':
+                        options.warn = true;
+                        break;
+                    default:
+                        badUsage(std::string("invalid option -- '") + c + "'");
+                    }
+                }
+            }
+        }
+
+        if (options.check && options.tag)
+            badUsage("the --tag option is meaningless when verifying checksums");
+        if (!options.check && (options.quiet || options.status || options.strict || options.warn || options.ignoreMissing))
+            badUsage("the --ignore-missing, --quiet, --status, --strict and --warn options are "
+                     "meaningful only when verifying checksums");
+
+        return options;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options = parseArguments(argc, argv);
+
+    size_t threads = options.threads != 0 ? options.threads : std::thread::hardware_concurrency();
+    Crypto::ThreadPool pool(threads != 0 ? threads : 1);
+
+    if (options.bench)
+        return bench(options, pool);
+
+    if (!options.check)
+        return hashFiles(options, pool);
+
+    std::vector<std::string> files = options.files;
+    if (files.empty())
+        files.push_back("-");
+
+    int status = 0;
+    for (const std::string &file : files)
+        status |= checkFile(file, options, pool);
+    return status;
+}